@@ -0,0 +1,195 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "acmatch.h"
+
+static void *
+acm_realloc(void * ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fatal_sys("realloc");
+    }
+
+    return ptr;
+}
+
+static int
+acm_new_state(acm_t * ac, int depth)
+{
+    int s;
+
+    if (ac->nstates == ac->maxstates) {
+        ac->maxstates = ac->maxstates * 2 + 16;
+        ac->delta = acm_realloc(ac->delta, ac->maxstates * sizeof(ac->delta[0]) );
+        ac->depth = acm_realloc(ac->depth, ac->maxstates * sizeof(int) );
+        ac->out   = acm_realloc(ac->out,   ac->maxstates * sizeof(int) );
+    }
+
+    s = ac->nstates++;
+    memset(ac->delta[s], -1, sizeof(ac->delta[s]) );
+    ac->depth[s] = depth;
+    ac->out[s] = -1;
+
+    return s;
+}
+
+acm_t *
+acm_new(bool icase)
+{
+    acm_t * ac;
+
+    ac = calloc(1, sizeof(* ac) );
+    if (ac == NULL) {
+        fatal_sys("calloc");
+    }
+    ac->icase = icase;
+
+    /* the root */
+    acm_new_state(ac, 0);
+
+    return ac;
+}
+
+void
+acm_free(acm_t * ac)
+{
+    if (ac == NULL) {
+        return;
+    }
+
+    free(ac->delta);
+    free(ac->depth);
+    free(ac->out);
+    free(ac->lens);
+    free(ac);
+}
+
+/*
+ * Add a (non-empty) string of `len' bytes (NUL bytes included) to the set.
+ * `id's are small non-negative ints and a lower `id' wins if several
+ * strings end at the same place.
+ */
+void
+acm_add(acm_t * ac, const char * str, int len, int id)
+{
+    const unsigned char * p = (const unsigned char *) str;
+    int s = 0, c, i;
+
+    if (ac->built) {
+        bug("acm_add() after acm_build()");
+    }
+
+    for (i = 0; i < len; ++i) {
+        c = ac->icase ? tolower(p[i]) : p[i];
+        if (ac->delta[s][c] < 0) {
+            /* don't index `delta' in the same expression, it may move */
+            int t = acm_new_state(ac, ac->depth[s] + 1);
+            ac->delta[s][c] = t;
+        }
+        s = ac->delta[s][c];
+    }
+    if (ac->out[s] < 0 || id < ac->out[s]) {
+        ac->out[s] = id;
+    }
+
+    if (id >= ac->nids) {
+        ac->lens = acm_realloc(ac->lens, (id + 1) * sizeof(int) );
+        for (i = ac->nids; i < id; ++i) {
+            ac->lens[i] = 0;
+        }
+        ac->nids = id + 1;
+    }
+    ac->lens[id] = len;
+}
+
+/*
+ * Turn the trie into a DFA, in BFS order so a state's failure state is
+ * always done before the state itself.
+ */
+void
+acm_build(acm_t * ac)
+{
+    int * queue, * fail;
+    int qhead = 0, qtail = 0;
+    int s, t, f, c;
+
+    queue = acm_realloc(NULL, ac->nstates * sizeof(int) );
+    fail  = acm_realloc(NULL, ac->nstates * sizeof(int) );
+
+    fail[0] = 0;
+    for (c = 0; c < 256; ++c) {
+        t = ac->delta[0][c];
+        if (t < 0) {
+            ac->delta[0][c] = 0;
+        } else {
+            fail[t] = 0;
+            queue[qtail++] = t;
+        }
+    }
+
+    while (qhead < qtail) {
+        s = queue[qhead++];
+
+        f = fail[s];
+        if (ac->out[f] >= 0 && (ac->out[s] < 0 || ac->out[f] < ac->out[s]) ) {
+            ac->out[s] = ac->out[f];
+        }
+
+        for (c = 0; c < 256; ++c) {
+            t = ac->delta[s][c];
+            if (t < 0) {
+                ac->delta[s][c] = ac->delta[f][c];
+            } else {
+                fail[t] = ac->delta[f][c];
+                queue[qtail++] = t;
+            }
+        }
+    }
+
+    if (ac->icase) {
+        for (s = 0; s < ac->nstates; ++s) {
+            for (c = 'A'; c <= 'Z'; ++c) {
+                ac->delta[s][c] = ac->delta[s][tolower(c)];
+            }
+        }
+    }
+
+    free(queue);
+    free(fail);
+    ac->built = true;
+}
+
+/*
+ * Feed `len' bytes to the automaton, starting in `* state' (0 for a new
+ * scan), until the first place where a string ends.
+ *
+ * RETURN: # of bytes consumed, with `* id' set, if a match ends there, or -1
+ *         after all the bytes are consumed without a match. `* state' is
+ *         updated in both cases.
+ */
+int
+acm_scan(const acm_t * ac, int * state, const char * buf, int len, int * id)
+{
+    const unsigned char * p = (const unsigned char *) buf;
+    const unsigned char * end = p + len;
+    int s = * state;
+
+    if ( ! ac->built) {
+        bug("acm_scan() before acm_build()");
+    }
+
+    while (p < end) {
+        s = ac->delta[s][* p++];
+        if (ac->out[s] >= 0) {
+            * state = s;
+            * id = ac->out[s];
+            return p - (const unsigned char *) buf;
+        }
+    }
+
+    * state = s;
+    return -1;
+}
@@ -0,0 +1,36 @@
+
+#ifndef ACMATCH_H__
+#define ACMATCH_H__
+
+#include <stdbool.h>
+
+/*
+ * Aho-Corasick automaton for matching a set of strings in one pass.
+ *
+ * The goto/failure functions are flattened into a full DFA table so each
+ * input byte is one table lookup. Scanning can be stopped and resumed
+ * anywhere by keeping the state, so the input may come in pieces.
+ */
+typedef struct acm {
+    int    nstates;
+    int    maxstates;
+    int  (* delta)[256];    /* state x byte -> state */
+    int  * depth;           /* length of the string a state stands for */
+    int  * out;             /* lowest id of the strings ending at a state,
+                             * -1 if none */
+    int  * lens;            /* length of string `id' */
+    int    nids;
+    bool   icase;
+    bool   built;
+} acm_t;
+
+acm_t * acm_new(bool icase);
+void    acm_free(acm_t * ac);
+void    acm_add(acm_t * ac, const char * str, int len, int id);
+void    acm_build(acm_t * ac);
+int     acm_scan(const acm_t * ac, int * state, const char * buf, int len,
+                 int * id);
+
+#define acm_depth(ac, state)    ( (ac)->depth[state] )
+
+#endif
@@ -1,6 +1,7 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <ctype.h>
 #include <termios.h>
 #include <signal.h>
 #include <regex.h>
@@ -51,6 +52,15 @@ static struct {
 
     int               nsubs;
     struct subst_spec subs[MAX_SUBST];
+
+    /* `send' is streamed to the server, see cli_send_next() */
+    struct {
+        char *  buf;        /* PASS_SEND_CHUNK + 1 for -cr */
+        int     len;
+        int64_t nread;
+        bool    eof;
+        bool    done;
+    } send;
 } g;
 
 static void
@@ -96,7 +106,16 @@ cli_hello(void)
     char errmsg[64];
 
     debug("sending HELLO");
-    if (msg_hello(g.sock) < 0) {
+    if (g.cmdopts->session != NULL && ! streq(g.cmdopts->cmd, CMD_SPAWN) ) {
+        /* to one of the hub's sessions */
+        msg = ttlv_new_struct(TAG_HELLO);
+        ttlv_append_child(msg,
+            ttlv_new_text(TAG_VERSION, strlen(VERSION_), VERSION_),
+            ttlv_new_text(TAG_SESSION, strlen(g.cmdopts->session),
+                          g.cmdopts->session),
+            NULL);
+        cli_msg_send(msg);
+    } else if (msg_hello(g.sock) < 0) {
         fatal(ERROR_PROTO, "msg_hello failed (server dead?)");
     }
 
@@ -407,6 +426,13 @@ cli_loop(void)
             msg_in = cli_msg_recv();
 
             if (msg_in->tag == TAG_ACK) {
+                ttlv_t * t;
+
+                /* send -offset */
+                if (streq(cmdopts->cmd, CMD_SEND) && cmdopts->send.offset
+                    && (t = ttlv_find_child(msg_in, TAG_OUTPUT_OFFSET) ) != NULL) {
+                    printf("%lld\n", (long long) t->v_long);
+                }
                 cli_disconn(0);
             } else if (msg_in->tag == TAG_OUTPUT) {
                 if (g.nsubs > 0) {
@@ -433,7 +459,8 @@ cli_loop(void)
 
                 v2n_error(errcode->v_int, errname, sizeof(errname) );
                 debug("received ERROR: %s (%s)", errmsg->v_text, errname);
-                if (cmdopts->passing) {
+                /* a bad pattern is worth a message even for expect */
+                if (cmdopts->passing && errcode->v_int != ERROR_USAGE) {
                     cli_disconn(errcode->v_int);
                 } else {
                     cli_disconn(-1);
@@ -474,6 +501,14 @@ cli_loop(void)
                     t = ttlv_find_child(msg_in, TAG_NONBLOCK);
                     printf("%s%d\n", get->get_all ? "  Nonblock: " : "", t->v_bool);
                 }
+                if (get->get_all || get->get_bufsize) {
+                    t = ttlv_find_child(msg_in, TAG_BUFSIZE);
+                    printf("%s%d\n", get->get_all ? "   Bufsize: " : "", t->v_int);
+                }
+                if (get->get_all || get->get_history) {
+                    t = ttlv_find_child(msg_in, TAG_HISTORY);
+                    printf("%s%d\n", get->get_all ? "   History: " : "", t->v_int);
+                }
                 if (get->get_all) {
                     t = ttlv_find_child(msg_in, TAG_ZOMBIE_TTL);
                     printf("%s%d\n", get->get_all ? "ZombieIdle: " : "", t->v_int);
@@ -658,6 +693,261 @@ cli_subst_compile(void)
     }
 }
 
+static void
+cli_append_text(ttlv_t * msg, int tag, const char * text)
+{
+    ttlv_append_child(msg,
+        ttlv_new_text(tag, strlen(text), (char *) text),
+        NULL);
+}
+
+/* "A" + "B" --> "AB", a new one */
+static char *
+cli_concat(const char * a, const char * b)
+{
+    char * s;
+
+    s = malloc(strlen(a) + strlen(b) + 1);
+    if (s == NULL) {
+        fatal_sys("malloc");
+    }
+    strcpy(s, a);
+    strcat(s, b);
+
+    return s;
+}
+
+/* `env' is NAME=VALUE */
+static bool
+cli_env_is(const char * env, const char * name)
+{
+    int len = strlen(name);
+
+    return strncmp(env, name, len) == 0 && env[len] == '=';
+}
+
+/*
+ * Relative to the client's cwd, not the hub's.
+ */
+static void
+cli_append_path(ttlv_t * msg, int tag, const char * path, const char * cwd)
+{
+    char * dir, * full;
+
+    if (path[0] == '/') {
+        cli_append_text(msg, tag, path);
+    } else {
+        dir = cli_concat(cwd, "/");
+        full = cli_concat(dir, path);
+        cli_append_text(msg, tag, full);
+        free(full);
+        free(dir);
+    }
+}
+
+/*
+ * Read the next piece of the `send' data, from the command line (or env var)
+ * or from -file/-fd (up to -limit bytes).
+ */
+static int
+cli_send_read(char * buf, int size)
+{
+    struct st_send * st = & g.cmdopts->send;
+    int n;
+
+    if ( ! st->has_fd) {
+        n = MIN(size, st->len - g.send.nread);
+        memcpy(buf, st->data + g.send.nread, n);
+        g.send.eof = (g.send.nread + n == st->len);
+    } else {
+        if (st->limit > 0) {
+            size = MIN(size, st->limit - g.send.nread);
+        }
+        do {
+            n = read(st->fd, buf, size);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            fatal_sys("read(send data)");
+        }
+        g.send.eof = (n == 0
+                      || (st->limit > 0 && g.send.nread + n == st->limit) );
+    }
+    g.send.nread += n;
+
+    return n;
+}
+
+/*
+ * `send -file' (or -fd) of a non-empty regular file: rather than reading and
+ * streaming it here the fd is passed to the server (TAG_SEND_FD) which reads
+ * it into the child's input itself. -strip needs to see the data so it's
+ * not for that.
+ */
+static bool
+cli_send_passfd(void)
+{
+    struct st_send * st = & g.cmdopts->send;
+    struct stat sb;
+
+    if ( ! st->has_fd || st->strip || fstat(st->fd, & sb) < 0
+        || ! S_ISREG(sb.st_mode) || sb.st_size == 0) {
+        return false;
+    }
+
+    /* only the final TAG_SEND is left for cli_send_next() */
+    g.send.eof = true;
+
+    return true;
+}
+
+/*
+ * The next message of a `send'. The data is streamed in TAG_SEND_MORE chunks
+ * and the last one is a TAG_SEND which the server acks after the data has
+ * been written to the child. The server stops reading while the child is
+ * behind so sending them would block as necessary.
+ *
+ * For -strip the trailing white spaces of a chunk are held back until more
+ * data follows (unless a whole chunk is made of them).
+ *
+ * RETURN:
+ *   NULL: All have been sent.
+ */
+static ttlv_t *
+cli_send_next(void)
+{
+    struct st_send * st = & g.cmdopts->send;
+    ttlv_t * msg;
+    int keep;
+
+    if (g.send.done) {
+        return NULL;
+    }
+    if (g.send.buf == NULL) {
+        g.send.buf = malloc(PASS_SEND_CHUNK + 1);
+        if (g.send.buf == NULL) {
+            fatal_sys("malloc");
+        }
+    }
+
+    while ( ! g.send.eof) {
+        g.send.len += cli_send_read(g.send.buf + g.send.len,
+                                    PASS_SEND_CHUNK - g.send.len);
+        if (g.send.eof) {
+            break;
+        }
+
+        keep = 0;
+        if (st->strip) {
+            while (keep < g.send.len
+                   && isspace( (uint8_t) g.send.buf[g.send.len - 1 - keep]) ) {
+                ++keep;
+            }
+            if (keep == PASS_SEND_CHUNK) {
+                keep = 0;
+            }
+        }
+        if (keep < g.send.len) {
+            msg = ttlv_new_raw(TAG_SEND_MORE, g.send.len - keep, g.send.buf);
+            memmove(g.send.buf, g.send.buf + g.send.len - keep, keep);
+            g.send.len = keep;
+
+            return msg;
+        }
+    }
+
+    /* the last one */
+    g.send.done = true;
+    if (st->strip) {
+        while (g.send.len > 0
+               && isspace( (uint8_t) g.send.buf[g.send.len - 1]) ) {
+            --g.send.len;
+        }
+    }
+    if (st->enter) {
+        g.send.buf[g.send.len++] = '\r';
+    }
+
+    return ttlv_new_raw(TAG_SEND, g.send.len, g.send.buf);
+}
+
+/*
+ * `spawn -session NAME': the hub spawns the program, with everything it
+ * needs from the client (args, environment, cwd, winsize).
+ */
+static ttlv_t *
+cli_spawn_msg(void)
+{
+    extern char ** environ;
+    struct st_spawn * spawn = & g.cmdopts->spawn;
+    struct winsize ws;
+    ttlv_t * msg;
+    char ** pp;
+    char * cwd;
+    char * term;
+
+    cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        fatal_sys("getcwd");
+    }
+
+    msg = ttlv_new_struct(TAG_SPAWN);
+    cli_append_text(msg, TAG_SESSION, g.cmdopts->session);
+    for (pp = spawn->argv; * pp != NULL; ++pp) {
+        cli_append_text(msg, TAG_ARGV, * pp);
+    }
+
+    /* don't pass SEXPECT_SOCKFILE and SEXPECT_SESSION to the spawned
+     * process */
+    for (pp = environ; * pp != NULL; ++pp) {
+        if (cli_env_is( * pp, "SEXPECT_SOCKFILE")
+            || cli_env_is( * pp, "SEXPECT_SESSION")
+            || (spawn->TERM != NULL && cli_env_is( * pp, "TERM") ) ) {
+            continue;
+        }
+        cli_append_text(msg, TAG_ENV, * pp);
+    }
+    if (spawn->TERM != NULL) {
+        term = cli_concat("TERM=", spawn->TERM);
+        cli_append_text(msg, TAG_ENV, term);
+        free(term);
+    }
+
+    cli_append_text(msg, TAG_CWD, cwd);
+    if (spawn->logfile != NULL) {
+        cli_append_path(msg, TAG_LOGFILE, spawn->logfile, cwd);
+    }
+    if (spawn->scrollback_file != NULL) {
+        cli_append_path(msg, TAG_SCROLLBACK_FILE, spawn->scrollback_file, cwd);
+    }
+    free(cwd);
+
+    ttlv_append_child(msg,
+        ttlv_new_bool(TAG_LOGFILE_APPEND, spawn->append),
+        ttlv_new_bool(TAG_NOHUP, spawn->nohup),
+        ttlv_new_bool(TAG_NONBLOCK, spawn->nonblock),
+        ttlv_new_bool(TAG_AUTOWAIT, spawn->autowait),
+        ttlv_new_bool(TAG_CLOEXIT, spawn->cloexit),
+        ttlv_new_int(TAG_EXP_TIMEOUT, spawn->def_timeout),
+        ttlv_new_int(TAG_TTL, spawn->ttl),
+        ttlv_new_int(TAG_IDLETIME, spawn->idle),
+        ttlv_new_int(TAG_ZOMBIE_TTL, spawn->zombie_idle),
+        ttlv_new_int(TAG_BUFSIZE, spawn->bufsize),
+        ttlv_new_int(TAG_HISTORY, spawn->history),
+        ttlv_new_long(TAG_SCROLLBACK, spawn->scrollback),
+        ttlv_new_int(TAG_SENDQ, spawn->sendq),
+        NULL);
+
+    /* current winsize */
+    if (g.stdin_is_tty && ioctl(STDIN_FILENO, TIOCGWINSZ, & ws) == 0) {
+        ttlv_append_child(msg,
+            ttlv_new_int(TAG_WINSIZE_ROW, ws.ws_row),
+            ttlv_new_int(TAG_WINSIZE_COL, ws.ws_col),
+            NULL);
+    }
+
+    return msg;
+}
+
 void
 cli_main(struct st_cmdopts * cmdopts)
 {
@@ -684,11 +974,26 @@ cli_main(struct st_cmdopts * cmdopts)
 
         /* expect_out */
     } else if (streq(subcmd, CMD_EXPOUT) ) {
-        msg_out = ttlv_new_int(TAG_EXPOUT, cmdopts->expout.index);
+        if (cmdopts->expout.branch) {
+            msg_out = ttlv_new_struct(TAG_EXPOUT_BRANCH);
+        } else if (cmdopts->expout.offset) {
+            msg_out = ttlv_new_struct(TAG_EXPOUT_OFFSET);
+        } else if (cmdopts->expout.name != NULL) {
+            msg_out = ttlv_new_text(TAG_EXPOUT_NAME, strlen(cmdopts->expout.name),
+                                    cmdopts->expout.name);
+        } else {
+            msg_out = ttlv_new_int(TAG_EXPOUT, cmdopts->expout.index);
+        }
 
         /* get */
     } else if (streq(subcmd, CMD_GET) ) {
         msg_out = ttlv_new_struct(TAG_INFO);
+        if (cmdopts->get.get_range) {
+            ttlv_append_child(msg_out,
+                ttlv_new_long(TAG_RANGE_OFF, cmdopts->get.range_off),
+                ttlv_new_long(TAG_RANGE_LEN, cmdopts->get.range_len),
+                NULL);
+        }
 
         /* kill */
     } else if (streq(subcmd, CMD_KILL) ) {
@@ -700,13 +1005,14 @@ cli_main(struct st_cmdopts * cmdopts)
 
         /* send */
     } else if (streq(subcmd, CMD_SEND) ) {
-        if (cmdopts->send.enter) {
-            msg_out = ttlv_new_raw(TAG_SEND,
-                cmdopts->send.len + 1, cmdopts->send.data);
-            msg_out->v_raw[cmdopts->send.len] = '\r';
-        } else if (cmdopts->send.len > 0) {
-            msg_out = ttlv_new_raw(TAG_SEND,
-                cmdopts->send.len, cmdopts->send.data);
+        if (cli_send_passfd() ) {
+            msg_out = ttlv_new_long(TAG_SEND_FD, cmdopts->send.limit);
+        } else {
+            msg_out = cli_send_next();
+            if (msg_out->tag == TAG_SEND && msg_out->length == 0
+                && ! cmdopts->send.offset) {
+                msg_free(&msg_out);
+            }
         }
 
         /* set */
@@ -738,20 +1044,38 @@ cli_main(struct st_cmdopts * cmdopts)
                 ttlv_new_int(TAG_IDLETIME, cmdopts->set.idle),
                 NULL);
         }
+        if (cmdopts->set.set_bufsize) {
+            ttlv_append_child(msg_out,
+                ttlv_new_int(TAG_BUFSIZE, cmdopts->set.bufsize),
+                NULL);
+        }
+        if (cmdopts->set.set_history) {
+            ttlv_append_child(msg_out,
+                ttlv_new_int(TAG_HISTORY, cmdopts->set.history),
+                NULL);
+        }
+
+        /* spawn -session NAME */
+    } else if (streq(subcmd, CMD_SPAWN) ) {
+        msg_out = cli_spawn_msg();
 
         /* expect, interact, wait */
     } else if (cmdopts->passing) {
         ttlv_t * expflags;
-        ttlv_t * pattern;
+        ttlv_t * branch;
         ttlv_t * timeout;
         ttlv_t * lookback;
         ttlv_t * subcmd;
+        int i;
 
         /* "expect" without a pattern */
         if (cmdopts->pass.subcmd == PASS_SUBCMD_EXPECT
                 && cmdopts->pass.expflags == 0) {
             cmdopts->pass.expflags = PASS_EXPECT_ERE;
-            cmdopts->pass.pattern = ".*";
+            cmdopts->pass.nbranches = 1;
+            cmdopts->pass.branches[0].type = PASS_EXPECT_ERE;
+            cmdopts->pass.branches[0].pattern = ".*";
+            cmdopts->pass.branches[0].patlen = 2;
         }
 
         if ( ! cmdopts->pass.no_input && ! g.stdin_is_tty) {
@@ -771,15 +1095,32 @@ cli_main(struct st_cmdopts * cmdopts)
             ttlv_append_child(msg_out, timeout, NULL);
         }
 
-        if (cmdopts->pass.pattern != NULL) {
-            pattern = ttlv_new_text(TAG_PATTERN,
-                strlen(cmdopts->pass.pattern), cmdopts->pass.pattern);
-            ttlv_append_child(msg_out, pattern, NULL);
+        for (i = 0; i < cmdopts->pass.nbranches; ++i) {
+            struct st_branch * br = & cmdopts->pass.branches[i];
+
+            branch = ttlv_new_struct(TAG_BRANCH);
+            ttlv_append_child(branch,
+                ttlv_new_int(TAG_EXP_FLAGS, br->type),
+                ttlv_new_text(TAG_PATTERN, br->patlen, br->pattern),
+                NULL);
+            ttlv_append_child(msg_out, branch, NULL);
         }
 
         if (cmdopts->pass.lookback > 0) {
             lookback = ttlv_new_int(TAG_LOOKBACK, cmdopts->pass.lookback);
             ttlv_append_child(msg_out, lookback, NULL);
+            if (cmdopts->pass.lookback_unit != LOOKBACK_LINES) {
+                ttlv_append_child(msg_out,
+                    ttlv_new_int(TAG_LOOKBACK_UNIT, cmdopts->pass.lookback_unit),
+                    NULL);
+            }
+        }
+
+        if (cmdopts->pass.has_from || cmdopts->pass.has_since) {
+            ttlv_append_child(msg_out,
+                ttlv_new_long(cmdopts->pass.has_from ? TAG_EXP_FROM : TAG_EXP_SINCE,
+                              cmdopts->pass.from),
+                NULL);
         }
 
         /* unknown */
@@ -817,9 +1158,23 @@ cli_main(struct st_cmdopts * cmdopts)
     }
 
     /* send the initial command */
-    cli_msg_send(msg_out);
+    if (msg_out->tag == TAG_SEND_FD) {
+        if (msg_send_fd(g.sock, msg_out, cmdopts->send.fd) < 0) {
+            fatal(ERROR_PROTO, "msg_send_fd failed (server dead?)");
+        }
+    } else {
+        cli_msg_send(msg_out);
+    }
     msg_free(&msg_out);
 
+    /* the rest of a streamed `send' */
+    if (streq(cmdopts->cmd, CMD_SEND) ) {
+        while ( (msg_out = cli_send_next() ) != NULL) {
+            cli_msg_send(msg_out);
+            msg_free(&msg_out);
+        }
+    }
+
     if (streq(cmdopts->cmd, CMD_INTERACT) ) {
         cli_send_winsize();
     }
@@ -5,12 +5,14 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <regex.h>
 #include <signal.h>
 #include <ctype.h>
 #include <math.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include "common.h"
@@ -40,9 +42,15 @@ static struct v2n_map g_v2n_error[] = {
 
 static struct v2n_map g_v2n_tag[] = {
     V2N_MAP(TAG_ACK),
+    V2N_MAP(TAG_ARGV),
     V2N_MAP(TAG_AUTOWAIT),
+    V2N_MAP(TAG_BRANCH),
+    V2N_MAP(TAG_BUFSIZE),
+    V2N_MAP(TAG_CLOEXIT),
     V2N_MAP(TAG_CLOSE),
+    V2N_MAP(TAG_CWD),
     V2N_MAP(TAG_DISCONN),
+    V2N_MAP(TAG_ENV),
     V2N_MAP(TAG_EOF),
     V2N_MAP(TAG_ERROR),
     V2N_MAP(TAG_ERROR_CODE),
@@ -50,11 +58,17 @@ static struct v2n_map g_v2n_tag[] = {
     V2N_MAP(TAG_EXITED),
     V2N_MAP(TAG_EXPBUF),
     V2N_MAP(TAG_EXPOUT),
+    V2N_MAP(TAG_EXPOUT_BRANCH),
     V2N_MAP(TAG_EXPOUT_INDEX),
+    V2N_MAP(TAG_EXPOUT_NAME),
+    V2N_MAP(TAG_EXPOUT_OFFSET),
     V2N_MAP(TAG_EXPOUT_TEXT),
     V2N_MAP(TAG_EXP_FLAGS),
+    V2N_MAP(TAG_EXP_FROM),
+    V2N_MAP(TAG_EXP_SINCE),
     V2N_MAP(TAG_EXP_TIMEOUT),
     V2N_MAP(TAG_HELLO),
+    V2N_MAP(TAG_HISTORY),
     V2N_MAP(TAG_IDLETIME),
     V2N_MAP(TAG_INFO),
     V2N_MAP(TAG_INPUT),
@@ -62,18 +76,29 @@ static struct v2n_map g_v2n_tag[] = {
     V2N_MAP(TAG_LOGFILE),
     V2N_MAP(TAG_LOGFILE_APPEND),
     V2N_MAP(TAG_LOOKBACK),
+    V2N_MAP(TAG_LOOKBACK_UNIT),
     V2N_MAP(TAG_MATCHED),
     V2N_MAP(TAG_NOHUP),
     V2N_MAP(TAG_NONBLOCK),
     V2N_MAP(TAG_OUTPUT),
+    V2N_MAP(TAG_OUTPUT_OFFSET),
     V2N_MAP(TAG_PASS),
     V2N_MAP(TAG_PASS_SUBCMD),
     V2N_MAP(TAG_PATTERN),
     V2N_MAP(TAG_PID),
     V2N_MAP(TAG_PPID),
     V2N_MAP(TAG_PTSNAME),
+    V2N_MAP(TAG_RANGE_LEN),
+    V2N_MAP(TAG_RANGE_OFF),
+    V2N_MAP(TAG_SCROLLBACK),
+    V2N_MAP(TAG_SCROLLBACK_FILE),
     V2N_MAP(TAG_SEND),
+    V2N_MAP(TAG_SEND_FD),
+    V2N_MAP(TAG_SEND_MORE),
+    V2N_MAP(TAG_SENDQ),
+    V2N_MAP(TAG_SESSION),
     V2N_MAP(TAG_SET),
+    V2N_MAP(TAG_SPAWN),
     V2N_MAP(TAG_TIMED_OUT),
     V2N_MAP(TAG_TTL),
     V2N_MAP(TAG_VERSION),
@@ -232,6 +257,60 @@ fatal_sys(const char *fmt, ...)
     fatal(ERROR_SYS, "%s: %s (%d)", buf, strerror(error), error);
 }
 
+/*
+ * Validate `spawn -bufsize N -history N'.
+ *
+ * RETURN: NULL if OK, or the error message.
+ */
+char *
+bufsize_check(int bufsize, int history)
+{
+    static __thread char buf[128];
+
+    if (bufsize > PASS_MAX_BUFSIZE) {
+        snprintf(buf, sizeof(buf), "bufsize must be <= %d", PASS_MAX_BUFSIZE);
+        return buf;
+    }
+    if (history < PASS_MIN_HISTORY) {
+        snprintf(buf, sizeof(buf), "history must be >= %d", PASS_MIN_HISTORY);
+        return buf;
+    }
+    if (bufsize < history + PASS_MIN_BUFFREE) {
+        snprintf(buf, sizeof(buf), "bufsize must be >= history + %d",
+                 PASS_MIN_BUFFREE);
+        return buf;
+    }
+
+    return NULL;
+}
+
+/*
+ * Make room for one more entry at the end of [* start, * end) in `* arr',
+ * dropping the ones before `* start' if that's enough.
+ */
+void *
+index_push(void * arr, int * start, int * end, int * cap, size_t size)
+{
+    void ** parr = arr;
+
+    if ( * end == * cap) {
+        if ( * start > 0 && * start >= * cap / 2) {
+            memmove( * parr, (char *) * parr + * start * size,
+                    ( * end - * start) * size);
+            * end -= * start;
+            * start = 0;
+        } else {
+            * cap = MAX(16, * cap * 2);
+            * parr = realloc( * parr, * cap * size);
+            if ( * parr == NULL) {
+                fatal_sys("realloc");
+            }
+        }
+    }
+
+    return (char *) * parr + (* end)++ * size;
+}
+
 int
 count1bits(unsigned n)
 {
@@ -284,6 +363,36 @@ Clock_diff(struct timespec * t1, struct timespec * t2)
     return fabs(d2 - d1);
 }
 
+/*
+ * # of seconds from NOW until `when'. Negative if `when' has passed.
+ */
+double
+Clock_remain(const struct timespec * when)
+{
+    struct timespec nowspec;
+
+    Clock_gettime(& nowspec);
+
+    return (when->tv_sec - nowspec.tv_sec) + (when->tv_nsec - nowspec.tv_nsec) / 1e9;
+}
+
+/*
+ * `*to' = `*from' + `secs'
+ */
+void
+Clock_add(struct timespec * to, const struct timespec * from, double secs)
+{
+    long sec = (long) secs;
+    long nsec = (secs - sec) * 1e9;
+
+    to->tv_sec  = from->tv_sec  + sec;
+    to->tv_nsec = from->tv_nsec + nsec;
+    if (to->tv_nsec >= 1000000000L) {
+        to->tv_sec  += 1;
+        to->tv_nsec -= 1000000000L;
+    }
+}
+
 void *
 Realloc(void ** pptr, size_t size)
 {
@@ -874,29 +983,102 @@ msg_free(ttlv_t **msg)
     ttlv_free(msg);
 }
 
+/*
+ * readn() for a unix socket, also receiving the fd passed along with the
+ * data (SCM_RIGHTS), if any. `*pfd' is -1 if there's none.
+ */
+static ssize_t
+readn_fd(int sock, void * buf, size_t n, int * pfd)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) )];
+    } cmsg;
+    struct cmsghdr * c;
+    struct msghdr mh;
+    struct iovec iov;
+    ssize_t nread, more;
+    int flags = 0;
+
+#ifdef MSG_CMSG_CLOEXEC
+    flags = MSG_CMSG_CLOEXEC;
+#endif
+
+    * pfd = -1;
+
+    memset( & mh, 0, sizeof(mh) );
+    iov.iov_base = buf;
+    iov.iov_len = n;
+    mh.msg_iov = & iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cmsg.buf;
+    mh.msg_controllen = sizeof(cmsg.buf);
+
+    do {
+        nread = recvmsg(sock, & mh, flags);
+    } while (nread < 0 && errno == EINTR);
+    if (nread <= 0) {
+        if (nread < 0) {
+            debug("recvmsg: %s (%d)", strerror(errno), errno);
+        }
+        return nread;
+    }
+
+    for (c = CMSG_FIRSTHDR( & mh); c != NULL; c = CMSG_NXTHDR( & mh, c) ) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS
+            && c->cmsg_len >= CMSG_LEN(sizeof(int) ) ) {
+            memcpy(pfd, CMSG_DATA(c), sizeof(int) );
+#ifndef MSG_CMSG_CLOEXEC
+            fcntl(* pfd, F_SETFD, FD_CLOEXEC);
+#endif
+        }
+    }
+
+    if (nread < n) {
+        more = readn(sock, (char *) buf + nread, n - nread);
+        if (more > 0) {
+            nread += more;
+        }
+    }
+    return nread;
+}
+
 /* RETURN:
  *   NULL: error
  *    ptr: The whole received message.
  */
 ttlv_t *
 msg_recv(int fd)
+{
+    int passed;
+    ttlv_t * msg;
+
+    msg = msg_recv_fd(fd, & passed);
+    if (passed >= 0) {
+        debug("closing the fd (%d) not asked for", passed);
+        close(passed);
+    }
+    return msg;
+}
+
+/*
+ * msg_recv() for a message which may come with an fd (see msg_send_fd()).
+ * `*pfd' is -1 if there's none.
+ */
+ttlv_t *
+msg_recv_fd(int fd, int * pfd)
 {
     const int bufsize = PASS_MAX_MSG;
-    static unsigned char * buf = NULL;
+    uint32_t hdr[TAG_HDR_SIZE / 4];
     uint32_t taglen; /* not including the header */
     uint32_t magic;
     int ret;
+    uint8_t * buf;
+    ttlv_arena_t * arena;
     ttlv_t * msg = NULL;
 
-    if (buf == NULL) {
-        buf = malloc(bufsize);
-        if (buf == NULL) {
-            fatal_sys("malloc(%d) returned NULL", bufsize);
-        }
-    }
-
-    /* the magic number */
-    ret = readn(fd, & magic, 4);
+    /* the magic number, and the fd which comes with it */
+    ret = readn_fd(fd, & magic, 4, pfd);
     if (ret < 4) {
         debug("MAGIC number is 4 bytes but got %d", ret);
         return NULL;
@@ -907,26 +1089,37 @@ msg_recv(int fd)
         return NULL;
     }
 
-    ret = readn(fd, buf, TAG_HDR_SIZE);
+    ret = readn(fd, hdr, TAG_HDR_SIZE);
     if (ret < TAG_HDR_SIZE) {
         error("header expected to be %d bytes but got %d", TAG_HDR_SIZE, ret);
         return NULL;
     }
 
-    taglen = ROUND8(net_get32(buf + TAG_HDR_LEN_OFFSET) );
+    taglen = ROUND8(net_get32( (uint8_t *) hdr + TAG_HDR_LEN_OFFSET) );
     if (taglen + TAG_HDR_SIZE > bufsize) {
         error("message too big: %u > %d",
               taglen + TAG_HDR_SIZE, bufsize);
         return NULL;
     }
 
+    /* The message is read right into the arena it's decoded in so its nodes
+     * need no malloc() and its text/raw values are mostly not copied. */
+    arena = ttlv_arena_new(TAG_HDR_SIZE + taglen);
+    if (arena == NULL
+        || (buf = ttlv_arena_alloc(arena, TAG_HDR_SIZE + taglen) ) == NULL) {
+        fatal_sys("malloc");
+    }
+    memcpy(buf, hdr, TAG_HDR_SIZE);
+
     ret = readn(fd, buf + TAG_HDR_SIZE, taglen);
     if (ret < taglen) {
         error("tag.length is %d but got %d bytes", taglen, ret);
+        ttlv_arena_free( & arena);
         return NULL;
     }
 
-    ret = ttlv_decode(buf, TAG_HDR_SIZE + taglen, & msg);
+    ret = ttlv_decode_arena(buf, TAG_HDR_SIZE + taglen, & msg, arena,
+                            TTLV_DECODE_NOCOPY);
     if (ret < TAG_HDR_SIZE + taglen) {
         error("message is %d bytes but only decoded %d",
             TAG_HDR_SIZE + taglen, ret);
@@ -937,22 +1130,81 @@ msg_recv(int fd)
     return msg;
 }
 
+/*
+ * writen() for a unix socket, passing `passfd' along with the data.
+ */
+static ssize_t
+writen_fd(int sock, const void * buf, size_t n, int passfd)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) )];
+    } cmsg;
+    struct cmsghdr * c;
+    struct msghdr mh;
+    struct iovec iov;
+    ssize_t nwritten, more;
+
+    memset( & mh, 0, sizeof(mh) );
+    memset( & cmsg, 0, sizeof(cmsg) );
+    iov.iov_base = (void *) buf;
+    iov.iov_len = n;
+    mh.msg_iov = & iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cmsg.buf;
+    mh.msg_controllen = sizeof(cmsg.buf);
+
+    c = CMSG_FIRSTHDR( & mh);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) );
+    memcpy(CMSG_DATA(c), & passfd, sizeof(int) );
+
+    do {
+        nwritten = sendmsg(sock, & mh, 0);
+    } while (nwritten < 0 && errno == EINTR);
+    if (nwritten < 0) {
+        debug("sendmsg: %s (%d)", strerror(errno), errno);
+        return -1;
+    }
+
+    if (nwritten < n) {
+        more = writen(sock, (const char *) buf + nwritten, n - nwritten);
+        if (more > 0) {
+            nwritten += more;
+        }
+    }
+    return nwritten;
+}
+
 /* RETURN:
  *  -1: error
  *  >0: The whole message has been sent.
  */
 ssize_t
 msg_send(int fd, ttlv_t *msg)
+{
+    return msg_send_fd(fd, msg, -1);
+}
+
+/*
+ * msg_send() with `passfd' (if >= 0) passed along (SCM_RIGHTS). It's the
+ * receiver's from then on, see msg_recv_fd().
+ */
+ssize_t
+msg_send_fd(int fd, ttlv_t *msg, int passfd)
 {
     const int bufsize = PASS_MAX_MSG;
-    static unsigned char * buf = NULL;
-    uint32_t magic;
+    static __thread unsigned char * buf = NULL;
+    unsigned char * out;
     int ret, size;
 
+    /* 8 bytes ahead for the magic number so the message is still 8-byte
+     * aligned (for ttlv_encode) and it all goes out with one write */
     if (buf == NULL) {
-        buf = malloc(bufsize);
+        buf = malloc(8 + bufsize);
         if (buf == NULL) {
-            fatal_sys("malloc(%d) returned NULL", bufsize);
+            fatal_sys("malloc(%d) returned NULL", 8 + bufsize);
             return -1;
         }
     }
@@ -963,23 +1215,95 @@ msg_send(int fd, ttlv_t *msg)
         return -1;
     }
 
-    ret = ttlv_encode(msg, buf, bufsize);
+    ret = ttlv_encode(msg, buf + 8, bufsize);
     if (size != ret) {
         error("message is %d bytes but only encoded %d", size, ret);
         return -1;
     }
 
-    /* the magic number */
-    net_put32(PASS_MAGIC, & magic);
-    ret = writen(fd, & magic, 4);
-    if (ret < 4) {
-        debug("write(MAGIC) returned %d", ret);
+    /* the magic number, and the fd with it */
+    out = buf + 4;
+    net_put32(PASS_MAGIC, out);
+    size += 4;
+    if (passfd >= 0) {
+        ret = writen_fd(fd, out, size, passfd);
+    } else {
+        ret = writen(fd, out, size);
+    }
+    if (ret < size) {
+        debug("writen(%d) returned %d", size, ret);
         return -1;
+    } else {
+        return ret;
     }
+}
+
+/*
+ * writen() for an iovec (which is modified).
+ */
+static ssize_t
+writevn(int fd, struct iovec * iov, int iovcnt)
+{
+    ssize_t nwritten, total = 0;
 
-    ret = writen(fd, buf, size);
+    while (iovcnt > 0) {
+        if ((nwritten = writev(fd, iov, iovcnt)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else {
+                debug("writev: %s (%d)", strerror(errno), errno);
+                return -1;
+            }
+        }
+        total += nwritten;
+
+        for ( ; iovcnt > 0 && (size_t) nwritten >= iov->iov_len; ++iov, --iovcnt) {
+            nwritten -= iov->iov_len;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+    return total;
+}
+
+/*
+ * Send a message which is a single TTYPE_RAW tag (e.g. TAG_OUTPUT) right
+ * from `data'. The magic number and the tag header are built on the stack
+ * and go out with `data' in one writev(), without a ttlv_t or encoding.
+ *
+ * RETURN: Same as msg_send().
+ */
+ssize_t
+msg_send_raw(int fd, uint32_t tag, const void * data, uint32_t len)
+{
+    static const uint8_t zeros[8] = { 0 };
+    uint32_t hdr[3];
+    struct iovec iov[3];
+    ssize_t ret, size;
+
+    size = TAG_HDR_SIZE + ROUND8(len);
+    if (size > PASS_MAX_MSG) {
+        error("message too large (%d bytes)", (int) size);
+        return -1;
+    }
+    size += 4;
+
+    net_put32(PASS_MAGIC, & hdr[0]);
+    net_put32( (tag << 8) | TTYPE_RAW, & hdr[1]);
+    net_put32(len, & hdr[2]);
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = len;
+    iov[2].iov_base = (void *) zeros;
+    iov[2].iov_len = ROUND8(len) - len;
+
+    ret = writevn(fd, iov, 3);
     if (ret < size) {
-        debug("writen(%d) returned %d", size, ret);
+        debug("writev(%d) returned %d", (int) size, (int) ret);
         return -1;
     } else {
         return ret;
@@ -27,11 +27,17 @@ extern char * const VERSION_;
 
 #define MAX_EXPBUF_PEEK 4096
 #define MAX_SUBST       10
+#define MAX_BRANCH      32
 #define PASS_MAGIC      0x4a55575a /* JUWZ */
 #define PASS_MAX_MSG    (64 * 1024)
-#define PASS_MAX_SEND   1024
+#define PASS_SEND_CHUNK (32 * 1024)     // `send' is streamed in chunks of this
 #define PASS_DEF_TMOUT  -1
 #define PASS_DEF_ZOMBIE_TTL  (24 * 60 * 60)  // 24 hours
+#define PASS_DEF_BUFSIZE     (16 * 1024)
+#define PASS_DEF_HISTORY     ( 8 * 1024)
+#define PASS_MIN_HISTORY     ( 1 * 1024)
+#define PASS_MIN_BUFFREE     ( 4 * 1024)        // bufsize - history
+#define PASS_MAX_BUFSIZE     (256 * 1024 * 1024)
 
 #define CMD_CHKERR    "chkerr"
 #define CMD_CLOSE     "close"
@@ -39,6 +45,7 @@ extern char * const VERSION_;
 #define CMD_EXPOUT    "expect_out"
 #define CMD_GET       "get"
 #define CMD_HELP      "help"
+#define CMD_HUB       "hub"
 #define CMD_INTERACT  "interact"
 #define CMD_KILL      "kill"
 #define CMD_SEND      "send"
@@ -127,6 +134,29 @@ enum {
     TAG_LOOKBACK,
     TAG_PASS_SUBCMD,    /* expect, interact, wait */
     TAG_VERSION,        /* for TAG_HELLO */
+    TAG_BUFSIZE,        /* spawn -bufsize <N> */
+    TAG_HISTORY,        /* spawn -history <N> */
+    TAG_BRANCH,         /* one of expect's patterns */
+    TAG_EXPOUT_BRANCH,  /* expect_out -branch */
+    TAG_EXPOUT_NAME,    /* expect_out -name <NAME> */
+    TAG_LOOKBACK_UNIT,  /* -lookback N{b,s} */
+    TAG_EXP_FROM,       /* expect -from <OFFSET> */
+    TAG_EXP_SINCE,      /* expect -since <OFFSET> */
+    TAG_EXPOUT_OFFSET,  /* expect_out -offset */
+    TAG_OUTPUT_OFFSET,  /* # of bytes output so far, with TAG_SEND's ACK */
+    TAG_RANGE_OFF,      /* get -range <OFF> <LEN> */
+    TAG_RANGE_LEN,
+    TAG_SPAWN,          /* spawn in a hub */
+    TAG_SESSION,        /* -session <NAME>, for TAG_HELLO and TAG_SPAWN */
+    TAG_ARGV,           /* one for each of the program and its args */
+    TAG_ENV,            /* NAME=VALUE */
+    TAG_CWD,
+    TAG_CLOEXIT,        /* spawn -cloexit */
+    TAG_SCROLLBACK,     /* spawn -scrollback SIZE */
+    TAG_SCROLLBACK_FILE,    /* spawn -scrollback FILE */
+    TAG_SENDQ,          /* spawn -sendq SIZE */
+    TAG_SEND_MORE,      /* a chunk of `send', a TAG_SEND comes last */
+    TAG_SEND_FD,        /* `send -file', the fd is passed with SCM_RIGHTS */
 
     /* THE END */
     TAG_END__,
@@ -141,6 +171,9 @@ enum {
     PASS_EXPECT_ICASE = 0x20,   /* expect -nocase */
     PASS_EXPECT_NOSUB = 0x40,
     PASS_EXPECT_NEWLINE = 0x80, /* REG_NEWLINE */
+    PASS_EXPECT_DFA   = 0x100,  /* expect -engine dfa */
+    PASS_EXPECT_PCRE  = 0x200,  /* expect -pcre */
+    PASS_EXPECT_RAW   = 0x400,  /* expect -raw */
 };
 
 enum {
@@ -149,6 +182,13 @@ enum {
     PASS_SUBCMD_WAIT,
 };
 
+/* -lookback N | Nb | Ns */
+enum {
+    LOOKBACK_LINES = 0,
+    LOOKBACK_BYTES,
+    LOOKBACK_SECS,
+};
+
 enum {
     PASS_EXPOUT_MATCHED = 1,
     PASS_EXPOUT_EOF,
@@ -170,6 +210,13 @@ struct st_spawn {
     int     ttl;
     int     idle;
     int     zombie_idle;
+    int     bufsize;    /* max # of bytes buffered from the child */
+    int     history;    /* max # of old (already seen) bytes to keep */
+    char  * scrollback_file;    /* -scrollback FILE */
+    int64_t scrollback; /* -scrollback SIZE */
+    int     sendq;      /* max # of bytes `send' may leave queued */
+    char ** envp;       /* hub mode: the client's environment */
+    char  * cwd;        /* hub mode: the client's cwd */
     struct timespec startime;
     struct timespec exittime;
 };
@@ -179,6 +226,7 @@ struct st_send {
     bool   has_fd;
     bool   strip;
     bool   enter;
+    bool   offset;    // send -offset
 
     char * envvar;    // send -env VAR
     char * filename;  // send -file FILE
@@ -193,6 +241,9 @@ struct st_send {
 
 struct st_expout {
     int  index;
+    bool branch;
+    bool offset;
+    char * name;
 };
 
 struct st_chkerr {
@@ -211,6 +262,10 @@ struct st_set {
     int  ttl;
     bool set_idle;
     int  idle;
+    bool set_bufsize;
+    int  bufsize;
+    bool set_history;
+    int  history;
 };
 
 struct st_get {
@@ -223,13 +278,25 @@ struct st_get {
     bool get_autowait;
     bool get_ttl;
     bool get_idle;
+    bool get_bufsize;
+    bool get_history;
     int  n_expbuf;
+    bool get_range;
+    int64_t range_off;  /* negative: from the end */
+    int64_t range_len;
 };
 
 struct st_kill {
     int signal;
 };
 
+/* one pattern of `expect -exact P1 -re P2 ...' */
+struct st_branch {
+    int    type;        /* PASS_EXPECT_{EXACT,GLOB,ERE,PCRE} */
+    char * pattern;
+    int    patlen;      /* -raw -exact patterns may include NUL bytes */
+};
+
 /* expect, interact, wait */
 struct st_pass {
     int    subcmd;      /* expect, interact, wait */
@@ -238,9 +305,14 @@ struct st_pass {
     bool   no_detach;   /* interact: disable <ctrl-]> */
     int    timeout;     /* negative value means infinite */
     int    expflags;
-    char * pattern;
+    int    nbranches;   /* # of patterns */
+    struct st_branch branches[MAX_BRANCH];
     bool   cstring;
-    int    lookback;    /* expect, interact */
+    int    lookback;    /* expect, interact, wait */
+    int    lookback_unit;   /* LOOKBACK_LINES, ... */
+    bool   has_from;
+    bool   has_since;
+    int64_t from;       /* expect -from, -since */
 
     /*
      * interact -subst PATTERN::REPLACE
@@ -249,8 +321,14 @@ struct st_pass {
     char * subs[MAX_SUBST];
 };
 
+struct st_hub {
+    int workers;    /* # of worker threads, 0 for one per CPU */
+    int idle;       /* exit after idle for N seconds without sessions */
+};
+
 struct st_cmdopts {
     char * sockpath;
+    char * session;     /* -session NAME, for a hub */
     char * cmd;
     bool   debug;
     bool   passing;
@@ -264,6 +342,7 @@ struct st_cmdopts {
         struct st_kill   kill;
         struct st_get    get;
         struct st_set    set;
+        struct st_hub    hub;
     };
 };
 
@@ -278,11 +357,15 @@ char * strunesc(const char * in, char ** out_, int * len_);
 char * str_rstrip(char * s);
 char * glob2re(const char * in, char ** out_, int * len_);
 int    name2sig(const char * signame);
+char * bufsize_check(int bufsize, int history);
 void   common_init(void);
 
 int  Clock_gettime(struct timespec * spec);
 double Clock_diff(struct timespec * t1, struct timespec * t2);
+double Clock_remain(const struct timespec * when);
+void Clock_add(struct timespec * to, const struct timespec * from, double secs);
 int  count1bits(unsigned n);
+void * index_push(void * arr, int * start, int * end, int * cap, size_t size);
 bool str1of(const char *s, ... /* , NULL */);
 bool strmatch(const char *s, const char *ere);
 bool strmatch_ex(const char *s, const char *ere, bool icase);
@@ -308,7 +391,10 @@ int  sock_connect(char * sockpath);
 size_t   msg_size(ttlv_t *msg);
 void     msg_free(ttlv_t **msg);
 ttlv_t * msg_recv(int fd);
+ttlv_t * msg_recv_fd(int fd, int * pfd);
 ssize_t  msg_send(int fd, ttlv_t *msg);
+ssize_t  msg_send_fd(int fd, ttlv_t *msg, int passfd);
+ssize_t  msg_send_raw(int fd, uint32_t tag, const void * data, uint32_t len);
 ssize_t  msg_hello(int fd);
 ssize_t  msg_disconn(int fd);
 
@@ -319,5 +405,6 @@ void *  Realloc(void ** ptr, size_t size);
 
 void cli_main(struct st_cmdopts * cmdopts);
 void serv_main(struct st_cmdopts * cmdopts);
+void hub_main(struct st_cmdopts * cmdopts);
 
 #endif
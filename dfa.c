@@ -0,0 +1,617 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "dfa.h"
+
+#define DFA_MAX_NODES   20000   /* NFA nodes, with {m,n} expanded */
+#define DFA_MAX_STATES  2048    /* cached states before flushing */
+#define DFA_TABLE_SIZE  (DFA_MAX_STATES * 2)
+
+enum {
+    NFA_EMPTY = 1,  /* -> out */
+    NFA_SPLIT,      /* -> out, out1 */
+    NFA_SET,        /* one byte out of `set' -> out */
+    NFA_ASSERT,     /* ERE_BOL, ERE_EOL, ... -> out */
+    NFA_MATCH,
+};
+
+struct nfa_node {
+    int type;
+    int out, out1;
+    int assert;
+    uint8_t set[256 / 8];
+};
+
+/* a piece of the NFA, `end' is an NFA_EMPTY whose `out' is to be set */
+struct nfa_frag {
+    int start, end;
+};
+
+/* what's on the other side of a position */
+#define CTX_EDGE        0x01    /* nothing: start or end of the data */
+#define CTX_NL          0x02
+#define CTX_WORD        0x04
+
+struct dfa_state {
+    int    ctx;         /* the byte before (after, if reverse) the state */
+    int    nnodes;
+    int  * nodes;       /* sorted NFA_SET, NFA_ASSERT and NFA_MATCH nodes */
+    unsigned hash;
+    int    at_end;      /* matches at the end of the data? -1 if unknown */
+    int    next[256];   /* next state << 1 | 1 if matched before the byte,
+                         * -1 if unknown */
+};
+
+struct dfa {
+    struct nfa_node * nodes;
+    int    nnodes, maxnodes;
+    int    start;
+    bool   reverse;     /* built from the reversed pattern, not searching */
+    bool   newline;     /* ERE_NEWLINE */
+    bool   toobig;
+
+    struct dfa_state ** states;
+    int    nstates;
+    int    table[DFA_TABLE_SIZE];   /* hash table of states, -1 if empty */
+
+    /* scratch */
+    int  * stack;
+    int  * list, * list2;
+    unsigned * mark;
+    unsigned gen;
+};
+
+static void *
+dfa_realloc(void * ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fatal_sys("realloc");
+    }
+
+    return ptr;
+}
+
+static int
+nfa_new(dfa_t * dfa, int type)
+{
+    struct nfa_node * node;
+
+    if (dfa->nnodes >= DFA_MAX_NODES) {
+        /* keep going, the caller checks `toobig' in the end */
+        dfa->toobig = true;
+        return 0;
+    }
+    if (dfa->nnodes == dfa->maxnodes) {
+        dfa->maxnodes = dfa->maxnodes * 2 + 16;
+        dfa->nodes = dfa_realloc(dfa->nodes,
+                                 dfa->maxnodes * sizeof(dfa->nodes[0]) );
+    }
+
+    node = & dfa->nodes[dfa->nnodes];
+    memset(node, 0, sizeof(* node) );
+    node->type = type;
+    node->out = node->out1 = -1;
+
+    return dfa->nnodes++;
+}
+
+static bool
+nfa_build(dfa_t * dfa, const ere_node_t * node, struct nfa_frag * frag)
+{
+    struct nfa_frag f1, f2;
+    const ere_node_t * first, * second;
+    int i, n, end;
+
+    switch (node->type) {
+    case ERE_EMPTY:
+        frag->start = frag->end = nfa_new(dfa, NFA_EMPTY);
+        break;
+
+    case ERE_SET:
+        n = nfa_new(dfa, NFA_SET);
+        memcpy(dfa->nodes[n].set, node->set, sizeof(node->set) );
+        frag->start = n;
+        frag->end = nfa_new(dfa, NFA_EMPTY);
+        dfa->nodes[n].out = frag->end;
+        break;
+
+    case ERE_BOL:
+    case ERE_EOL:
+    case ERE_WORDB:
+    case ERE_NWORDB:
+    case ERE_WORD_BEG:
+    case ERE_WORD_END:
+    case ERE_BUF_BEG:
+    case ERE_BUF_END:
+        n = nfa_new(dfa, NFA_ASSERT);
+        dfa->nodes[n].assert = node->type;
+        frag->start = n;
+        frag->end = nfa_new(dfa, NFA_EMPTY);
+        dfa->nodes[n].out = frag->end;
+        break;
+
+    case ERE_CAT:
+        first  = dfa->reverse ? node->right : node->left;
+        second = dfa->reverse ? node->left : node->right;
+        if ( ! nfa_build(dfa, first, & f1) || ! nfa_build(dfa, second, & f2) ) {
+            return false;
+        }
+        dfa->nodes[f1.end].out = f2.start;
+        frag->start = f1.start;
+        frag->end = f2.end;
+        break;
+
+    case ERE_ALT:
+        if ( ! nfa_build(dfa, node->left, & f1)
+             || ! nfa_build(dfa, node->right, & f2) ) {
+            return false;
+        }
+        n = nfa_new(dfa, NFA_SPLIT);
+        end = nfa_new(dfa, NFA_EMPTY);
+        dfa->nodes[n].out = f1.start;
+        dfa->nodes[n].out1 = f2.start;
+        dfa->nodes[f1.end].out = end;
+        dfa->nodes[f2.end].out = end;
+        frag->start = n;
+        frag->end = end;
+        break;
+
+    case ERE_GROUP:
+        return nfa_build(dfa, node->left, frag);
+
+    case ERE_REPEAT:
+        frag->start = frag->end = nfa_new(dfa, NFA_EMPTY);
+        for (i = 0; i < node->min && ! dfa->toobig; ++i) {
+            if ( ! nfa_build(dfa, node->left, & f1) ) {
+                return false;
+            }
+            dfa->nodes[frag->end].out = f1.start;
+            frag->end = f1.end;
+        }
+        if (node->max == ERE_INF) {
+            /* x* */
+            n = nfa_new(dfa, NFA_SPLIT);
+            end = nfa_new(dfa, NFA_EMPTY);
+            if ( ! nfa_build(dfa, node->left, & f1) ) {
+                return false;
+            }
+            dfa->nodes[n].out = f1.start;
+            dfa->nodes[n].out1 = end;
+            dfa->nodes[f1.end].out = n;
+            dfa->nodes[frag->end].out = n;
+            frag->end = end;
+        } else {
+            /* x{0,n} as (x(x...)?)? */
+            end = nfa_new(dfa, NFA_EMPTY);
+            for (i = node->min; i < node->max && ! dfa->toobig; ++i) {
+                n = nfa_new(dfa, NFA_SPLIT);
+                dfa->nodes[frag->end].out = n;
+                if ( ! nfa_build(dfa, node->left, & f1) ) {
+                    return false;
+                }
+                dfa->nodes[n].out = f1.start;
+                dfa->nodes[n].out1 = end;
+                frag->end = f1.end;
+            }
+            dfa->nodes[frag->end].out = end;
+            frag->end = end;
+        }
+        break;
+
+    default:
+        /* ERE_BACKREF */
+        return false;
+    }
+
+    return ! dfa->toobig;
+}
+
+static int
+dfa_ctx(int c)
+{
+    int ctx = 0;
+
+    if (c < 0) {
+        return CTX_EDGE;
+    }
+    if (c == '\n') {
+        ctx |= CTX_NL;
+    }
+    if (isalnum(c) || c == '_') {
+        ctx |= CTX_WORD;
+    }
+
+    return ctx;
+}
+
+/*
+ * Does the assertion hold between `left' and `right' (CTX_*)?
+ */
+static bool
+dfa_assert_ok(const dfa_t * dfa, int assert, int left, int right)
+{
+    bool lword = (left & CTX_WORD) != 0;
+    bool rword = (right & CTX_WORD) != 0;
+
+    switch (assert) {
+    case ERE_BOL:
+        return (left & CTX_EDGE) != 0 || (dfa->newline && (left & CTX_NL) != 0);
+    case ERE_EOL:
+        return (right & CTX_EDGE) != 0 || (dfa->newline && (right & CTX_NL) != 0);
+    case ERE_WORDB:
+        return lword != rword;
+    case ERE_NWORDB:
+        return lword == rword;
+    case ERE_WORD_BEG:
+        return ! lword && rword;
+    case ERE_WORD_END:
+        return lword && ! rword;
+    case ERE_BUF_BEG:
+        return (left & CTX_EDGE) != 0;
+    case ERE_BUF_END:
+        return (right & CTX_EDGE) != 0;
+    }
+
+    bug("unknown assertion %d", assert);
+    return false;
+}
+
+static void
+dfa_new_gen(dfa_t * dfa)
+{
+    if (++dfa->gen == 0) {
+        memset(dfa->mark, 0, dfa->nnodes * sizeof(dfa->mark[0]) );
+        dfa->gen = 1;
+    }
+}
+
+/*
+ * Add NFA node `n' and whatever it leads to without consuming a byte to
+ * `list' (unless already added in this generation). Assertions are kept
+ * in the list as they are, or followed if they hold between `left' and
+ * `right' when `resolve'.
+ */
+static void
+dfa_closure(dfa_t * dfa, int n, bool resolve, int left, int right,
+            int * list, int * count)
+{
+    struct nfa_node * node;
+    int sp = 0;
+
+    dfa->stack[sp++] = n;
+    while (sp > 0) {
+        n = dfa->stack[--sp];
+        if (dfa->mark[n] == dfa->gen) {
+            continue;
+        }
+        dfa->mark[n] = dfa->gen;
+
+        node = & dfa->nodes[n];
+        switch (node->type) {
+        case NFA_EMPTY:
+            dfa->stack[sp++] = node->out;
+            break;
+        case NFA_SPLIT:
+            dfa->stack[sp++] = node->out1;
+            dfa->stack[sp++] = node->out;
+            break;
+        case NFA_ASSERT:
+            if ( ! resolve) {
+                list[(* count)++] = n;
+            } else if (dfa_assert_ok(dfa, node->assert, left, right) ) {
+                dfa->stack[sp++] = node->out;
+            }
+            break;
+        default:
+            list[(* count)++] = n;
+            break;
+        }
+    }
+}
+
+static int
+dfa_cmp_int(const void * a, const void * b)
+{
+    return * (const int *) a - * (const int *) b;
+}
+
+static void
+dfa_flush(dfa_t * dfa)
+{
+    int i;
+
+    for (i = 0; i < dfa->nstates; ++i) {
+        free(dfa->states[i]->nodes);
+        free(dfa->states[i]);
+    }
+    dfa->nstates = 0;
+    memset(dfa->table, -1, sizeof(dfa->table) );
+}
+
+/*
+ * Find or add the state for the NFA nodes in `list'. If the cache has to be
+ * flushed, `* keep' (if not NULL) is added again and updated.
+ */
+static int
+dfa_add_state(dfa_t * dfa, int * list, int count, int ctx, int * keep)
+{
+    struct dfa_state * st;
+    unsigned hash = ctx;
+    int i, s, slot, kctx, kcount;
+    int * knodes;
+
+    qsort(list, count, sizeof(int), dfa_cmp_int);
+    for (i = 0; i < count; ++i) {
+        hash = hash * 31 + list[i];
+    }
+
+    slot = hash % DFA_TABLE_SIZE;
+    for ( ; (s = dfa->table[slot]) >= 0; slot = (slot + 1) % DFA_TABLE_SIZE) {
+        st = dfa->states[s];
+        if (st->hash == hash && st->ctx == ctx && st->nnodes == count
+            && memcmp(st->nodes, list, count * sizeof(int) ) == 0) {
+            return s;
+        }
+    }
+
+    if (dfa->nstates >= DFA_MAX_STATES) {
+        debug("DFA cache full, flushing");
+
+        knodes = NULL;
+        kcount = kctx = 0;
+        if (keep != NULL) {
+            st = dfa->states[* keep];
+            kctx = st->ctx;
+            kcount = st->nnodes;
+            knodes = dfa_realloc(NULL, (kcount + 1) * sizeof(int) );
+            memcpy(knodes, st->nodes, kcount * sizeof(int) );
+        }
+
+        dfa_flush(dfa);
+        if (keep != NULL) {
+            * keep = dfa_add_state(dfa, knodes, kcount, kctx, NULL);
+            free(knodes);
+        }
+        return dfa_add_state(dfa, list, count, ctx, NULL);
+    }
+
+    st = dfa_realloc(NULL, sizeof(* st) );
+    st->ctx = ctx;
+    st->nnodes = count;
+    st->nodes = dfa_realloc(NULL, (count + 1) * sizeof(int) );
+    memcpy(st->nodes, list, count * sizeof(int) );
+    st->hash = hash;
+    st->at_end = -1;
+    memset(st->next, -1, sizeof(st->next) );
+
+    s = dfa->nstates++;
+    dfa->states[s] = st;
+    dfa->table[slot] = s;
+
+    return s;
+}
+
+/*
+ * Consume byte `c' in state `* ps' (which may change if the cache is
+ * flushed) and fill in the transition.
+ */
+static int
+dfa_step(dfa_t * dfa, int * ps, int c)
+{
+    struct dfa_state * st = dfa->states[* ps];
+    struct nfa_node * node;
+    int left, right, i, n1 = 0, n2 = 0, t;
+    bool matched = false;
+
+    if (dfa->reverse) {
+        left = dfa_ctx(c);
+        right = st->ctx;
+    } else {
+        left = st->ctx;
+        right = dfa_ctx(c);
+    }
+
+    /* the assertions pending in the state can be decided now */
+    dfa_new_gen(dfa);
+    for (i = 0; i < st->nnodes; ++i) {
+        dfa_closure(dfa, st->nodes[i], true, left, right, dfa->list, & n1);
+    }
+
+    dfa_new_gen(dfa);
+    for (i = 0; i < n1; ++i) {
+        node = & dfa->nodes[dfa->list[i]];
+        if (node->type == NFA_MATCH) {
+            matched = true;
+        } else if (node->type == NFA_SET && ERE_SET_HAS(node->set, c) ) {
+            dfa_closure(dfa, node->out, false, 0, 0, dfa->list2, & n2);
+        }
+    }
+    if ( ! dfa->reverse) {
+        /* a match can also start after `c' */
+        dfa_closure(dfa, dfa->start, false, 0, 0, dfa->list2, & n2);
+    }
+
+    t = dfa_add_state(dfa, dfa->list2, n2, dfa_ctx(c), ps);
+    dfa->states[* ps]->next[c] = t << 1 | matched;
+
+    return dfa->states[* ps]->next[c];
+}
+
+dfa_t *
+dfa_new(const ere_t * re, bool reverse)
+{
+    struct nfa_frag frag;
+    dfa_t * dfa;
+    int match;
+
+    dfa = calloc(1, sizeof(* dfa) );
+    if (dfa == NULL) {
+        fatal_sys("calloc");
+    }
+    dfa->reverse = reverse;
+    dfa->newline = (re->flags & ERE_NEWLINE) != 0;
+    memset(dfa->table, -1, sizeof(dfa->table) );
+
+    if ( ! nfa_build(dfa, re->root, & frag) ) {
+        if (dfa->toobig) {
+            debug("pattern too big for the DFA");
+        }
+        dfa_free(dfa);
+        return NULL;
+    }
+    match = nfa_new(dfa, NFA_MATCH);
+    if (dfa->toobig) {
+        dfa_free(dfa);
+        return NULL;
+    }
+    dfa->nodes[frag.end].out = match;
+    dfa->start = frag.start;
+
+    dfa->states = dfa_realloc(NULL, DFA_MAX_STATES * sizeof(dfa->states[0]) );
+    dfa->stack = dfa_realloc(NULL, (dfa->nnodes * 2 + 2) * sizeof(int) );
+    dfa->list  = dfa_realloc(NULL, dfa->nnodes * sizeof(int) );
+    dfa->list2 = dfa_realloc(NULL, dfa->nnodes * sizeof(int) );
+    dfa->mark  = calloc(dfa->nnodes, sizeof(dfa->mark[0]) );
+    if (dfa->mark == NULL) {
+        fatal_sys("calloc");
+    }
+
+    return dfa;
+}
+
+void
+dfa_free(dfa_t * dfa)
+{
+    if (dfa == NULL) {
+        return;
+    }
+
+    if (dfa->states != NULL) {
+        dfa_flush(dfa);
+        free(dfa->states);
+    }
+    free(dfa->nodes);
+    free(dfa->stack);
+    free(dfa->list);
+    free(dfa->list2);
+    free(dfa->mark);
+    free(dfa);
+}
+
+/*
+ * The state to start with. `prev' is the byte before the data (after, if
+ * reverse), or -1 if none.
+ */
+int
+dfa_start(dfa_t * dfa, int prev)
+{
+    int n = 0;
+
+    dfa_new_gen(dfa);
+    dfa_closure(dfa, dfa->start, false, 0, 0, dfa->list2, & n);
+
+    return dfa_add_state(dfa, dfa->list2, n, dfa_ctx(prev), NULL);
+}
+
+/*
+ * Feed `len' bytes in `buf' to the forward automaton.
+ *
+ * RETURN: where in `buf' the earliest match ends (`* state' is then the state
+ *         at that point), or -1 if no match ends before `buf + len'.
+ */
+int
+dfa_feed(dfa_t * dfa, int * state, const char * buf, int len)
+{
+    int s = * state;
+    int i, t;
+
+    for (i = 0; i < len; ++i) {
+        t = dfa->states[s]->next[(uint8_t) buf[i]];
+        if (t < 0) {
+            t = dfa_step(dfa, & s, (uint8_t) buf[i]);
+        }
+        if ( (t & 1) != 0) {
+            * state = s;
+            return i;
+        }
+        s = t >> 1;
+    }
+
+    * state = s;
+    return -1;
+}
+
+/*
+ * Would there be a match (ending here) if the data ended now?
+ */
+bool
+dfa_at_end(dfa_t * dfa, int state)
+{
+    struct dfa_state * st = dfa->states[state];
+    int i, n = 0;
+
+    if (st->at_end < 0) {
+        st->at_end = 0;
+
+        dfa_new_gen(dfa);
+        for (i = 0; i < st->nnodes; ++i) {
+            if (dfa->reverse) {
+                dfa_closure(dfa, st->nodes[i], true, CTX_EDGE, st->ctx,
+                            dfa->list, & n);
+            } else {
+                dfa_closure(dfa, st->nodes[i], true, st->ctx, CTX_EDGE,
+                            dfa->list, & n);
+            }
+        }
+        for (i = 0; i < n; ++i) {
+            if (dfa->nodes[dfa->list[i]].type == NFA_MATCH) {
+                st->at_end = 1;
+                break;
+            }
+        }
+    }
+
+    return st->at_end != 0;
+}
+
+/*
+ * Find the leftmost start of the matches which end at `buf + len' with the
+ * reverse automaton. `next' is the byte after the match, or -1 if none.
+ *
+ * RETURN: the offset in `buf', or -1 if there's no such match.
+ */
+int
+dfa_rfind(dfa_t * dfa, const char * buf, int len, int next)
+{
+    int s, i, t, found = -1;
+
+    if ( ! dfa->reverse) {
+        bug("not a reverse DFA");
+    }
+
+    s = dfa_start(dfa, next);
+    for (i = len - 1; i >= 0; --i) {
+        if (dfa->states[s]->nnodes == 0) {
+            /* dead */
+            return found;
+        }
+
+        t = dfa->states[s]->next[(uint8_t) buf[i]];
+        if (t < 0) {
+            t = dfa_step(dfa, & s, (uint8_t) buf[i]);
+        }
+        if ( (t & 1) != 0) {
+            found = i + 1;
+        }
+        s = t >> 1;
+    }
+    if (dfa_at_end(dfa, s) ) {
+        found = 0;
+    }
+
+    return found;
+}
@@ -0,0 +1,32 @@
+#ifndef DFA_H__
+#define DFA_H__
+
+#include <stdbool.h>
+
+#include "ere.h"
+
+/*
+ * A lazily built DFA for the syntax trees from ere.c (everything but back
+ * references). The states are sets of Thompson NFA nodes and are only built
+ * when the input gets there, and the cache is flushed if it grows too big.
+ *
+ * The forward automaton finds where the earliest match ends, one table
+ * lookup per byte. Scanning can be stopped and resumed anywhere by keeping
+ * the state, so the input may come in pieces, and it's just bytes (NUL
+ * included) so no terminator is needed. Where that match starts is then
+ * found by running the reverse automaton backwards from the end.
+ *
+ * Assertions (^, $, \b, ...) are checked with one byte of lookahead: a state
+ * knows what kind of byte is before it and the pending assertions are
+ * resolved when the next byte (or the end of the data) comes.
+ */
+typedef struct dfa dfa_t;
+
+dfa_t * dfa_new(const ere_t * re, bool reverse);
+void    dfa_free(dfa_t * dfa);
+int     dfa_start(dfa_t * dfa, int prev);
+int     dfa_feed(dfa_t * dfa, int * state, const char * buf, int len);
+bool    dfa_at_end(dfa_t * dfa, int state);
+int     dfa_rfind(dfa_t * dfa, const char * buf, int len, int next);
+
+#endif
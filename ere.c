@@ -0,0 +1,810 @@
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "ere.h"
+
+/* same as glibc's RE_DUP_MAX */
+#define ERE_DUP_MAX     0x7fff
+
+/* lengths are saturated at this so they never overflow */
+#define ERE_LEN_MAX     (INT_MAX / 2)
+
+struct ere_parser {
+    const char * p;
+    int flags;
+    int ngroups;
+};
+
+static ere_node_t * ere_parse_alt(struct ere_parser * ps);
+
+static ere_node_t *
+ere_node_new(int type, ere_node_t * left, ere_node_t * right)
+{
+    ere_node_t * node;
+
+    node = calloc(1, sizeof(* node) );
+    if (node == NULL) {
+        fatal_sys("calloc");
+    }
+    node->type = type;
+    node->left = left;
+    node->right = right;
+
+    return node;
+}
+
+static void
+ere_node_free(ere_node_t * node)
+{
+    if (node == NULL) {
+        return;
+    }
+
+    ere_node_free(node->left);
+    ere_node_free(node->right);
+    free(node);
+}
+
+static void
+set_add(uint8_t * set, int c)
+{
+    set[(uint8_t) c / 8] |= 1 << ((uint8_t) c % 8);
+}
+
+static void
+set_del(uint8_t * set, int c)
+{
+    set[(uint8_t) c / 8] &= ~(1 << ((uint8_t) c % 8) );
+}
+
+static void
+set_invert(uint8_t * set)
+{
+    int i;
+
+    for (i = 0; i < 256 / 8; ++i) {
+        set[i] = ~set[i];
+    }
+}
+
+static void
+set_add_ctype(uint8_t * set, int (* isfunc)(int) )
+{
+    int c;
+
+    for (c = 0; c < 256; ++c) {
+        if (isfunc(c) ) {
+            set_add(set, c);
+        }
+    }
+}
+
+static int
+isword(int c)
+{
+    return isalnum(c) || c == '_';
+}
+
+/*
+ * Fix up a SET node for the flags.
+ */
+static ere_node_t *
+ere_set_done(struct ere_parser * ps, ere_node_t * node, bool negated)
+{
+    int c;
+
+    if ( (ps->flags & ERE_ICASE) != 0) {
+        for (c = 0; c < 256; ++c) {
+            if (ERE_SET_HAS(node->set, c) ) {
+                set_add(node->set, tolower(c) );
+                set_add(node->set, toupper(c) );
+            }
+        }
+    }
+    if (negated) {
+        set_invert(node->set);
+        /* REG_NEWLINE: non-matching lists never match a newline */
+        if ( (ps->flags & ERE_NEWLINE) != 0) {
+            set_del(node->set, '\n');
+        }
+    }
+
+    return node;
+}
+
+static ere_node_t *
+ere_new_char(struct ere_parser * ps, int c)
+{
+    ere_node_t * node = ere_node_new(ERE_SET, NULL, NULL);
+
+    set_add(node->set, c);
+    return ere_set_done(ps, node, false);
+}
+
+/*
+ * [:class:]
+ */
+static bool
+ere_parse_class(const char * name, int len, uint8_t * set)
+{
+    static const struct {
+        const char * name;
+        int (* isfunc)(int);
+    } classes[] = {
+        { "alnum",  isalnum },
+        { "alpha",  isalpha },
+        { "blank",  isblank },
+        { "cntrl",  iscntrl },
+        { "digit",  isdigit },
+        { "graph",  isgraph },
+        { "lower",  islower },
+        { "print",  isprint },
+        { "punct",  ispunct },
+        { "space",  isspace },
+        { "upper",  isupper },
+        { "xdigit", isxdigit },
+    };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(classes); ++i) {
+        if (strlen(classes[i].name) == len
+            && strncmp(classes[i].name, name, len) == 0) {
+            set_add_ctype(set, classes[i].isfunc);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * One char of a bracket expression, either `c' or `[.c.]' or `[=c=]'.
+ *
+ * RETURN: the char, or -1.
+ */
+static int
+ere_bracket_char(struct ere_parser * ps)
+{
+    int c;
+
+    if (ps->p[0] == '[' && (ps->p[1] == '.' || ps->p[1] == '=') ) {
+        int delim = ps->p[1];
+
+        /* only single-char collating elements */
+        if (ps->p[2] == '\0' || ps->p[3] != delim || ps->p[4] != ']') {
+            return -1;
+        }
+        c = (uint8_t) ps->p[2];
+        ps->p += 5;
+    } else {
+        c = (uint8_t) ps->p[0];
+        ++ps->p;
+    }
+
+    return c;
+}
+
+static ere_node_t *
+ere_parse_bracket(struct ere_parser * ps)
+{
+    ere_node_t * node = ere_node_new(ERE_SET, NULL, NULL);
+    bool negated = false, first = true;
+    int lo, hi, c;
+
+    /* skip '[' */
+    ++ps->p;
+    if (ps->p[0] == '^') {
+        negated = true;
+        ++ps->p;
+    }
+
+    while (true) {
+        if (ps->p[0] == '\0') {
+            goto fail;
+        } else if (ps->p[0] == ']' && ! first) {
+            ++ps->p;
+            break;
+        }
+        first = false;
+
+        /* [:class:] */
+        if (ps->p[0] == '[' && ps->p[1] == ':') {
+            const char * end = strstr(ps->p + 2, ":]");
+
+            if (end == NULL
+                || ! ere_parse_class(ps->p + 2, end - (ps->p + 2), node->set) ) {
+                goto fail;
+            }
+            ps->p = end + 2;
+            continue;
+        }
+
+        lo = ere_bracket_char(ps);
+        if (lo < 0) {
+            goto fail;
+        }
+
+        /* a range, unless `-' is the last one */
+        if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+            ++ps->p;
+            if (ps->p[0] == '[' && ps->p[1] == ':') {
+                goto fail;
+            }
+            hi = ere_bracket_char(ps);
+            if (hi < 0 || hi < lo) {
+                goto fail;
+            }
+        } else {
+            hi = lo;
+        }
+
+        for (c = lo; c <= hi; ++c) {
+            set_add(node->set, c);
+        }
+    }
+
+    return ere_set_done(ps, node, negated);
+
+fail:
+    ere_node_free(node);
+    return NULL;
+}
+
+static ere_node_t *
+ere_parse_escape(struct ere_parser * ps)
+{
+    ere_node_t * node;
+    int c = (uint8_t) ps->p[1];
+
+    if (c == '\0') {
+        return NULL;
+    }
+    ps->p += 2;
+
+    switch (c) {
+    case '1': case '2': case '3': case '4': case '5':
+    case '6': case '7': case '8': case '9':
+        if (c - '0' > ps->ngroups) {
+            return NULL;
+        }
+        node = ere_node_new(ERE_BACKREF, NULL, NULL);
+        node->index = c - '0';
+        return node;
+
+    case 'w':
+    case 'W':
+        node = ere_node_new(ERE_SET, NULL, NULL);
+        set_add_ctype(node->set, isword);
+        return ere_set_done(ps, node, c == 'W');
+
+    case 's':
+    case 'S':
+        node = ere_node_new(ERE_SET, NULL, NULL);
+        set_add_ctype(node->set, isspace);
+        return ere_set_done(ps, node, c == 'S');
+
+    case 'b':  return ere_node_new(ERE_WORDB,    NULL, NULL);
+    case 'B':  return ere_node_new(ERE_NWORDB,   NULL, NULL);
+    case '<':  return ere_node_new(ERE_WORD_BEG, NULL, NULL);
+    case '>':  return ere_node_new(ERE_WORD_END, NULL, NULL);
+    case '`':  return ere_node_new(ERE_BUF_BEG,  NULL, NULL);
+    case '\'': return ere_node_new(ERE_BUF_END,  NULL, NULL);
+
+    default:
+        return ere_new_char(ps, c);
+    }
+}
+
+static ere_node_t *
+ere_parse_atom(struct ere_parser * ps)
+{
+    ere_node_t * node;
+    int index;
+
+    switch (ps->p[0]) {
+    case '(':
+        ++ps->p;
+        index = ++ps->ngroups;
+        if (ps->p[0] == ')') {
+            node = ere_node_new(ERE_EMPTY, NULL, NULL);
+        } else {
+            node = ere_parse_alt(ps);
+            if (node == NULL) {
+                return NULL;
+            }
+        }
+        if (ps->p[0] != ')') {
+            ere_node_free(node);
+            return NULL;
+        }
+        ++ps->p;
+
+        node = ere_node_new(ERE_GROUP, node, NULL);
+        node->index = index;
+        return node;
+
+    case '.':
+        ++ps->p;
+        node = ere_node_new(ERE_SET, NULL, NULL);
+        set_invert(node->set);
+        if ( (ps->flags & ERE_NEWLINE) != 0) {
+            set_del(node->set, '\n');
+        }
+        /* as with regexec(), `.' never matches a NUL byte (expect -raw) */
+        set_del(node->set, '\0');
+        return ere_set_done(ps, node, false);
+
+    case '^':
+        ++ps->p;
+        return ere_node_new(ERE_BOL, NULL, NULL);
+
+    case '$':
+        ++ps->p;
+        return ere_node_new(ERE_EOL, NULL, NULL);
+
+    case '[':
+        return ere_parse_bracket(ps);
+
+    case '\\':
+        return ere_parse_escape(ps);
+
+    /* Undefined by POSIX and implementations differ. Not worth it. */
+    case '*': case '+': case '?': case '{': case ')': case '\0':
+        return NULL;
+
+    default:
+        return ere_new_char(ps, (uint8_t) * ps->p++);
+    }
+}
+
+static int
+ere_parse_num(struct ere_parser * ps)
+{
+    int n = 0;
+
+    if ( ! isdigit( (uint8_t) ps->p[0]) ) {
+        return -1;
+    }
+    while (isdigit( (uint8_t) ps->p[0]) ) {
+        n = n * 10 + (* ps->p++ - '0');
+        if (n > ERE_DUP_MAX) {
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+static ere_node_t *
+ere_parse_repeat(struct ere_parser * ps)
+{
+    ere_node_t * node;
+    int min, max;
+
+    node = ere_parse_atom(ps);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    while (true) {
+        switch (ps->p[0]) {
+        case '*':  min = 0; max = ERE_INF; ++ps->p; break;
+        case '+':  min = 1; max = ERE_INF; ++ps->p; break;
+        case '?':  min = 0; max = 1;       ++ps->p; break;
+        case '{':
+            ++ps->p;
+            /* {,n} is a GNU extension */
+            min = (ps->p[0] == ',') ? 0 : ere_parse_num(ps);
+            max = min;
+            if (min >= 0 && ps->p[0] == ',') {
+                ++ps->p;
+                max = (ps->p[0] == '}') ? ERE_INF : ere_parse_num(ps);
+                if (max == -1 && ps->p[0] != '}') {
+                    min = -1;
+                }
+            }
+            if (min < 0 || ps->p[0] != '}' || (max != ERE_INF && max < min) ) {
+                ere_node_free(node);
+                return NULL;
+            }
+            ++ps->p;
+            break;
+        default:
+            return node;
+        }
+
+        node = ere_node_new(ERE_REPEAT, node, NULL);
+        node->min = min;
+        node->max = max;
+    }
+}
+
+static ere_node_t *
+ere_parse_cat(struct ere_parser * ps)
+{
+    ere_node_t * node = NULL, * atom;
+
+    while (ps->p[0] != '\0' && ps->p[0] != '|' && ps->p[0] != ')') {
+        atom = ere_parse_repeat(ps);
+        if (atom == NULL) {
+            ere_node_free(node);
+            return NULL;
+        }
+        node = (node == NULL) ? atom : ere_node_new(ERE_CAT, node, atom);
+    }
+
+    return (node == NULL) ? ere_node_new(ERE_EMPTY, NULL, NULL) : node;
+}
+
+static ere_node_t *
+ere_parse_alt(struct ere_parser * ps)
+{
+    ere_node_t * node, * right;
+
+    node = ere_parse_cat(ps);
+    while (node != NULL && ps->p[0] == '|') {
+        ++ps->p;
+        right = ere_parse_cat(ps);
+        if (right == NULL) {
+            ere_node_free(node);
+            return NULL;
+        }
+        node = ere_node_new(ERE_ALT, node, right);
+    }
+
+    return node;
+}
+
+/*
+ * `flags' is ERE_ICASE and/or ERE_NEWLINE.
+ *
+ * RETURN: NULL if the pattern is invalid or uses some feature which is not
+ *         supported (the caller should then assume the worst).
+ */
+ere_t *
+ere_parse(const char * pattern, int flags)
+{
+    struct ere_parser ps = { pattern, flags, 0 };
+    ere_node_t * root;
+    ere_t * re;
+
+    root = ere_parse_alt( & ps);
+    if (root == NULL) {
+        return NULL;
+    } else if (ps.p[0] != '\0') {
+        /* unmatched `)' */
+        ere_node_free(root);
+        return NULL;
+    }
+
+    re = calloc(1, sizeof(* re) );
+    if (re == NULL) {
+        fatal_sys("calloc");
+    }
+    re->root = root;
+    re->flags = flags;
+    re->ngroups = ps.ngroups;
+
+    return re;
+}
+
+void
+ere_free(ere_t * re)
+{
+    if (re == NULL) {
+        return;
+    }
+
+    ere_node_free(re->root);
+    free(re);
+}
+
+static int
+ere_node_maxlen(const ere_node_t * node)
+{
+    int l, r;
+
+    switch (node->type) {
+    case ERE_SET:
+        return 1;
+
+    case ERE_CAT:
+        l = ere_node_maxlen(node->left);
+        r = ere_node_maxlen(node->right);
+        if (l == ERE_INF || r == ERE_INF || l + r > ERE_LEN_MAX) {
+            return ERE_INF;
+        }
+        return l + r;
+
+    case ERE_ALT:
+        l = ere_node_maxlen(node->left);
+        r = ere_node_maxlen(node->right);
+        if (l == ERE_INF || r == ERE_INF) {
+            return ERE_INF;
+        }
+        return MAX(l, r);
+
+    case ERE_REPEAT:
+        l = ere_node_maxlen(node->left);
+        if (l == 0) {
+            return 0;
+        } else if (l == ERE_INF || node->max == ERE_INF
+                   || (long) l * node->max > ERE_LEN_MAX) {
+            return ERE_INF;
+        }
+        return l * node->max;
+
+    case ERE_GROUP:
+        return ere_node_maxlen(node->left);
+
+    case ERE_BACKREF:
+        /* could be bounded by the group but who cares */
+        return ERE_INF;
+
+    default:
+        /* EMPTY and the assertions */
+        return 0;
+    }
+}
+
+/*
+ * RETURN: the max length of a match, or ERE_INF.
+ */
+int
+ere_maxlen(const ere_t * re)
+{
+    return ere_node_maxlen(re->root);
+}
+
+static bool
+ere_node_can_match(const ere_node_t * node, int c)
+{
+    if (node == NULL) {
+        return false;
+    }
+
+    switch (node->type) {
+    case ERE_SET:
+        return ERE_SET_HAS(node->set, c);
+    case ERE_BACKREF:
+        /* it can only repeat what the group matched */
+        return false;
+    default:
+        return ere_node_can_match(node->left, c)
+            || ere_node_can_match(node->right, c);
+    }
+}
+
+/*
+ * Whether a match may include the char `c'.
+ */
+bool
+ere_can_match(const ere_t * re, int c)
+{
+    return ere_node_can_match(re->root, c);
+}
+
+/* a{n} is not expanded to more than this for required literals */
+#define ERE_LIT_MAX     256
+
+/*
+ * What's known about the literal strings in the matches of a node.
+ */
+struct ere_lit {
+    bool   exact;       /* every match is `req' */
+    char * pre;         /* every match starts with this */
+    char * suf;         /* every match ends with this */
+    char * req;         /* every match includes this */
+};
+
+static char *
+lit_cat(const char * a, const char * b)
+{
+    size_t la = strlen(a), lb = strlen(b);
+    char * s;
+
+    s = malloc(la + lb + 1);
+    if (s == NULL) {
+        fatal_sys("malloc");
+    }
+    memcpy(s, a, la);
+    memcpy(s + la, b, lb);
+    s[la + lb] = '\0';
+
+    return s;
+}
+
+static void
+lit_init(struct ere_lit * lit, bool exact, const char * str)
+{
+    lit->exact = exact;
+    lit->pre = lit_cat(str, "");
+    lit->suf = lit_cat(str, "");
+    lit->req = lit_cat(str, "");
+}
+
+static void
+lit_free(struct ere_lit * lit)
+{
+    free(lit->pre);
+    free(lit->suf);
+    free(lit->req);
+}
+
+/* the longest of the strings, the others are freed */
+static char *
+lit_longest(char * a, char * b, char * c)
+{
+    char * s = a;
+
+    if (strlen(b) > strlen(s) ) {
+        s = b;
+    }
+    if (strlen(c) > strlen(s) ) {
+        s = c;
+    }
+    if (s != a) {
+        free(a);
+    }
+    if (s != b) {
+        free(b);
+    }
+    if (s != c) {
+        free(c);
+    }
+
+    return s;
+}
+
+/*
+ * The char a SET stands for (lower case for a case-insensitive letter), or
+ * -1 if it's not a single char.
+ */
+static int
+ere_set_char(const ere_node_t * node, int flags)
+{
+    int c, n = 0, first = -1;
+
+    for (c = 1; c < 256; ++c) {
+        if (ERE_SET_HAS(node->set, c) ) {
+            if (n++ == 0) {
+                first = c;
+            }
+        }
+    }
+
+    if (n == 1) {
+        return first;
+    } else if (n == 2 && (flags & ERE_ICASE) != 0 && tolower(first) != first
+               && ERE_SET_HAS(node->set, tolower(first) ) ) {
+        return tolower(first);
+    }
+
+    return -1;
+}
+
+static void
+ere_node_lit(const ere_node_t * node, int flags, struct ere_lit * lit)
+{
+    struct ere_lit a, b;
+    char str[2] = "";
+    char * s, * t;
+    int c, i, n;
+
+    switch (node->type) {
+    case ERE_SET:
+        c = ere_set_char(node, flags);
+        if (c < 0) {
+            lit_init(lit, false, "");
+        } else {
+            str[0] = c;
+            lit_init(lit, true, str);
+        }
+        break;
+
+    case ERE_CAT:
+        ere_node_lit(node->left, flags, & a);
+        ere_node_lit(node->right, flags, & b);
+        if (a.exact && b.exact) {
+            s = lit_cat(a.req, b.req);
+            lit_init(lit, true, s);
+            free(s);
+        } else {
+            lit->exact = false;
+            lit->pre = a.exact ? lit_cat(a.req, b.pre) : lit_cat(a.pre, "");
+            lit->suf = b.exact ? lit_cat(a.suf, b.req) : lit_cat(b.suf, "");
+            lit->req = lit_longest(lit_cat(a.req, ""), lit_cat(b.req, ""),
+                                   lit_cat(a.suf, b.pre) );
+        }
+        lit_free( & a);
+        lit_free( & b);
+        break;
+
+    case ERE_ALT:
+        ere_node_lit(node->left, flags, & a);
+        ere_node_lit(node->right, flags, & b);
+        if (a.exact && b.exact && streq(a.req, b.req) ) {
+            lit_init(lit, true, a.req);
+        } else {
+            /* the common prefix and suffix */
+            lit->exact = false;
+            for (n = 0; a.pre[n] != '\0' && a.pre[n] == b.pre[n]; ++n) {
+            }
+            lit->pre = lit_cat(a.pre, "");
+            lit->pre[n] = '\0';
+            for (i = strlen(a.suf), n = strlen(b.suf);
+                 i > 0 && n > 0 && a.suf[i - 1] == b.suf[n - 1]; --i, --n) {
+            }
+            lit->suf = lit_cat(a.suf + i, "");
+            lit->req = lit_longest(lit_cat(lit->pre, ""), lit_cat(lit->suf, ""),
+                                   lit_cat("", "") );
+        }
+        lit_free( & a);
+        lit_free( & b);
+        break;
+
+    case ERE_REPEAT:
+        ere_node_lit(node->left, flags, & a);
+        if (node->min == 0) {
+            lit_init(lit, false, "");
+        } else if (a.exact) {
+            /* a{n} is `aaa...' and a{n,} starts and ends with it */
+            s = lit_cat("", "");
+            for (i = 0; i < node->min
+                        && strlen(s) + strlen(a.req) <= ERE_LIT_MAX; ++i) {
+                t = lit_cat(s, a.req);
+                free(s);
+                s = t;
+            }
+            lit_init(lit, i == node->min && node->min == node->max, s);
+            free(s);
+        } else {
+            lit->exact = false;
+            lit->pre = lit_cat(a.pre, "");
+            lit->suf = lit_cat(a.suf, "");
+            lit->req = lit_cat(a.req, "");
+        }
+        lit_free( & a);
+        break;
+
+    case ERE_GROUP:
+        ere_node_lit(node->left, flags, lit);
+        break;
+
+    case ERE_BACKREF:
+        lit_init(lit, false, "");
+        break;
+
+    default:
+        /* EMPTY and the assertions */
+        lit_init(lit, true, "");
+        break;
+    }
+}
+
+/*
+ * RETURN: the longest string (malloc'ed) every match includes, or NULL if
+ *         there's none. Case-insensitive letters are in lower case.
+ */
+char *
+ere_required(const ere_t * re)
+{
+    struct ere_lit lit;
+    char * req;
+
+    ere_node_lit(re->root, re->flags, & lit);
+    req = lit.req;
+    lit.req = NULL;
+    lit_free( & lit);
+
+    if (req[0] == '\0') {
+        free(req);
+        return NULL;
+    }
+
+    return req;
+}
@@ -0,0 +1,65 @@
+
+#ifndef ERE_H__
+#define ERE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A parser for POSIX extended regular expressions (plus the GNU extensions
+ * glibc supports in EREs) which builds a syntax tree so the server can
+ * reason about a pattern, e.g. how long a match can be or what literal
+ * string it must include. The matching itself is done by regexec() (or the
+ * DFA in dfa.c).
+ *
+ * Only the C locale is supported (one char is one byte).
+ */
+
+/* flags */
+#define ERE_ICASE       0x01    /* REG_ICASE */
+#define ERE_NEWLINE     0x02    /* REG_NEWLINE */
+
+enum {
+    ERE_EMPTY = 1,      /* matches the empty string */
+    ERE_SET,            /* one byte out of `set' */
+    ERE_BOL,            /* ^ */
+    ERE_EOL,            /* $ */
+    ERE_WORDB,          /* \b */
+    ERE_NWORDB,         /* \B */
+    ERE_WORD_BEG,       /* \< */
+    ERE_WORD_END,       /* \> */
+    ERE_BUF_BEG,        /* \` */
+    ERE_BUF_END,        /* \' */
+    ERE_CAT,
+    ERE_ALT,
+    ERE_REPEAT,
+    ERE_GROUP,
+    ERE_BACKREF,
+};
+
+#define ERE_INF         (-1)    /* REPEAT max, or length */
+
+typedef struct ere_node {
+    int type;
+    struct ere_node * left;     /* CAT, ALT, REPEAT, GROUP */
+    struct ere_node * right;    /* CAT, ALT */
+    int min, max;               /* REPEAT */
+    int index;                  /* GROUP, BACKREF */
+    uint8_t set[256 / 8];       /* SET */
+} ere_node_t;
+
+typedef struct ere {
+    ere_node_t * root;
+    int flags;
+    int ngroups;
+} ere_t;
+
+#define ERE_SET_HAS(set, c)     ( ( (set)[(uint8_t) (c) / 8] >> ((uint8_t) (c) % 8) ) & 1)
+
+ere_t * ere_parse(const char * pattern, int flags);
+void    ere_free(ere_t * re);
+int     ere_maxlen(const ere_t * re);
+bool    ere_can_match(const ere_t * re, int c);
+char *  ere_required(const ere_t * re);
+
+#endif
@@ -0,0 +1,458 @@
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "common.h"
+#include "evloop.h"
+
+/*
+ * A tiny event loop for the server.
+ *
+ * On Linux it's backed by epoll(7) with signals delivered through
+ * signalfd(2) and the (single) deadline armed on a timerfd(2), so the
+ * server sleeps until something really happens.
+ *
+ * Elsewhere it falls back to select(2) (N.B.: poll(2) does not work with
+ * ptys on macOS) with the timeout computed from the deadline and signals
+ * delivered through a self-pipe.
+ */
+struct evloop {
+    int nfds, cap;
+    struct {
+        int fd;
+        int events;
+    } * fds;
+
+    bool has_deadline;
+    struct timespec deadline;
+
+#ifdef HAVE_EPOLL
+    int epfd;
+    int sigfd;
+    int timerfd;
+    sigset_t sigmask;
+#endif
+};
+
+#ifndef HAVE_EPOLL
+static int g_sigpipe[2] = { -1, -1 };
+
+static void
+ev_sig_handler(int signo)
+{
+    int save_errno = errno;
+    unsigned char c = signo;
+
+    /* the pipe is non-blocking so it's fine to lose signals when it's full
+     * as they would be merged anyway */
+    write(g_sigpipe[1], & c, 1);
+
+    errno = save_errno;
+}
+#endif
+
+static int
+ev_find(evloop_t * ev, int fd)
+{
+    int i;
+
+    for (i = 0; i < ev->nfds; ++i) {
+        if (ev->fds[i].fd == fd) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+evloop_t *
+ev_new(void)
+{
+    evloop_t * ev;
+
+    ev = calloc(1, sizeof(* ev) );
+    if (ev == NULL) {
+        return NULL;
+    }
+
+#ifdef HAVE_EPOLL
+    ev->sigfd = -1;
+    sigemptyset( & ev->sigmask);
+
+    ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev->epfd < 0) {
+        free(ev);
+        return NULL;
+    }
+
+    ev->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ev->timerfd < 0) {
+        close(ev->epfd);
+        free(ev);
+        return NULL;
+    } else {
+        struct epoll_event e = { 0 };
+
+        e.events = EPOLLIN;
+        e.data.fd = ev->timerfd;
+        epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->timerfd, & e);
+    }
+#endif
+
+    return ev;
+}
+
+void
+ev_free(evloop_t * ev)
+{
+    if (ev == NULL) {
+        return;
+    }
+
+#ifdef HAVE_EPOLL
+    close(ev->epfd);
+    close(ev->timerfd);
+    if (ev->sigfd >= 0) {
+        close(ev->sigfd);
+    }
+#endif
+
+    free(ev->fds);
+    free(ev);
+}
+
+/*
+ * Set the interests of `fd'. `events' being 0 means to stop watching it.
+ */
+int
+ev_watch(evloop_t * ev, int fd, int events)
+{
+    int i;
+
+    events &= (EV_READ | EV_WRITE);
+
+    i = ev_find(ev, fd);
+    if (i >= 0 && ev->fds[i].events == events) {
+        return 0;
+    }
+    if (i < 0 && events == 0) {
+        return 0;
+    }
+    if (i < 0 && ev->nfds == ev->cap) {
+        if (Realloc( (void **) & ev->fds,
+                    MAX(16, ev->cap * 2) * sizeof(ev->fds[0]) ) == NULL) {
+            return -1;
+        }
+        ev->cap = MAX(16, ev->cap * 2);
+    }
+
+#ifdef HAVE_EPOLL
+    {
+        struct epoll_event e = { 0 };
+        int op;
+
+        e.data.fd = fd;
+        e.events  = ( (events & EV_READ)  ? EPOLLIN  : 0)
+                  | ( (events & EV_WRITE) ? EPOLLOUT : 0);
+
+        if (events == 0) {
+            op = EPOLL_CTL_DEL;
+        } else if (i < 0) {
+            op = EPOLL_CTL_ADD;
+        } else {
+            op = EPOLL_CTL_MOD;
+        }
+        /* closing an fd removes it from the epoll set automatically so
+         * ignore errors for EPOLL_CTL_DEL */
+        if (epoll_ctl(ev->epfd, op, fd, & e) < 0 && op != EPOLL_CTL_DEL) {
+            return -1;
+        }
+    }
+#endif
+
+    if (events == 0) {
+        ev->fds[i] = ev->fds[--ev->nfds];
+    } else if (i < 0) {
+        ev->fds[ev->nfds].fd = fd;
+        ev->fds[ev->nfds].events = events;
+        ++ev->nfds;
+    } else {
+        ev->fds[i].events = events;
+    }
+
+    return 0;
+}
+
+/*
+ * N.B.: The caller should have blocked `signo' (before fork()'ing any
+ *       children for SIGCHLD) or signals may get lost.
+ */
+int
+ev_watch_signal(evloop_t * ev, int signo)
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event e = { 0 };
+    int fd;
+
+    sigaddset( & ev->sigmask, signo);
+    if (sigprocmask(SIG_BLOCK, & ev->sigmask, NULL) < 0) {
+        return -1;
+    }
+
+    fd = signalfd(ev->sigfd, & ev->sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ev->sigfd < 0) {
+        ev->sigfd = fd;
+
+        e.events = EPOLLIN;
+        e.data.fd = ev->sigfd;
+        if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->sigfd, & e) < 0) {
+            return -1;
+        }
+    }
+#else
+    sigset_t set;
+
+    if (g_sigpipe[0] < 0) {
+        if (pipe(g_sigpipe) < 0) {
+            return -1;
+        }
+        fcntl(g_sigpipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(g_sigpipe[1], F_SETFL, O_NONBLOCK);
+        fcntl(g_sigpipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(g_sigpipe[1], F_SETFD, FD_CLOEXEC);
+    }
+
+    sig_handle(signo, ev_sig_handler);
+
+    sigemptyset( & set);
+    sigaddset( & set, signo);
+    if (sigprocmask(SIG_UNBLOCK, & set, NULL) < 0) {
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Wake up ev_wait() with an EV_TIMER event at `when' (see Clock_gettime()).
+ * NULL means no deadline at all so ev_wait() may sleep forever.
+ */
+void
+ev_set_deadline(evloop_t * ev, const struct timespec * when)
+{
+    if (when == NULL) {
+        if ( ! ev->has_deadline) {
+            return;
+        }
+        ev->has_deadline = false;
+    } else {
+        if (ev->has_deadline && ev->deadline.tv_sec == when->tv_sec
+            && ev->deadline.tv_nsec == when->tv_nsec) {
+            return;
+        }
+        ev->has_deadline = true;
+        ev->deadline = * when;
+    }
+
+#ifdef HAVE_EPOLL
+    {
+        struct itimerspec its = { { 0 } };
+        double diff;
+
+        if (ev->has_deadline) {
+            /* Clock_gettime() may not be using CLOCK_MONOTONIC so always arm
+             * a relative timer. */
+            diff = Clock_remain( & ev->deadline);
+            if (diff < 0.001) {
+                /* An all-zero it_value would disarm the timer. */
+                diff = 0.001;
+            }
+            its.it_value.tv_sec  = (time_t) diff;
+            its.it_value.tv_nsec = (diff - its.it_value.tv_sec) * 1e9;
+        }
+        timerfd_settime(ev->timerfd, 0, & its, NULL);
+    }
+#endif
+}
+
+/*
+ * An fd which becomes readable when there are events for ev_poll(), so
+ * the loop can be nested in another one. -1 if not supported.
+ */
+int
+ev_fd(evloop_t * ev)
+{
+#ifdef HAVE_EPOLL
+    return ev->epfd;
+#else
+    return -1;
+#endif
+}
+
+static int
+ev_collect(evloop_t * ev, struct ev_event * evs, int nevs, bool block)
+{
+    int i, n, nret = 0;
+
+#ifdef HAVE_EPOLL
+    struct epoll_event out[EV_MAX_FDS + 2];
+
+    n = epoll_wait(ev->epfd, out, MIN(nevs, ARRAY_SIZE(out) ), block ? -1 : 0);
+    if (n < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (i = 0; i < n && nret < nevs; ++i) {
+        int fd = out[i].data.fd;
+
+        if (fd == ev->timerfd) {
+            uint64_t expirations;
+
+            read(ev->timerfd, & expirations, sizeof(expirations) );
+            ev->has_deadline = false;
+
+            evs[nret].fd = -1;
+            evs[nret].events = EV_TIMER;
+            ++nret;
+        } else if (fd == ev->sigfd) {
+            struct signalfd_siginfo si;
+
+            while (nret < nevs && read(ev->sigfd, & si, sizeof(si) ) == sizeof(si) ) {
+                evs[nret].fd = -1;
+                evs[nret].events = EV_SIGNAL;
+                evs[nret].signo = si.ssi_signo;
+                ++nret;
+            }
+        } else {
+            evs[nret].fd = fd;
+            evs[nret].events = 0;
+            /* report errors and hangups as readable so the owner would find
+             * out by read() */
+            if (out[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP) ) {
+                evs[nret].events |= EV_READ;
+            }
+            if (out[i].events & (EPOLLOUT | EPOLLERR) ) {
+                evs[nret].events |= EV_WRITE;
+            }
+            ++nret;
+        }
+    }
+#else
+    fd_set readfds, writefds;
+    struct timeval timeout, * ptimeout = NULL;
+    int fd_max = -1, fd;
+
+    FD_ZERO( & readfds);
+    FD_ZERO( & writefds);
+
+    for (i = 0; i < ev->nfds; ++i) {
+        fd = ev->fds[i].fd;
+        if (ev->fds[i].events & EV_READ) {
+            FD_SET(fd, & readfds);
+        }
+        if (ev->fds[i].events & EV_WRITE) {
+            FD_SET(fd, & writefds);
+        }
+        fd_max = MAX(fd_max, fd);
+    }
+    if (g_sigpipe[0] >= 0) {
+        FD_SET(g_sigpipe[0], & readfds);
+        fd_max = MAX(fd_max, g_sigpipe[0]);
+    }
+
+    if ( ! block) {
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = 0;
+        ptimeout = & timeout;
+    } else if (ev->has_deadline) {
+        double diff = Clock_remain( & ev->deadline);
+
+        if (diff < 0) {
+            diff = 0;
+        }
+        timeout.tv_sec  = (time_t) diff;
+        /* round up or we may wake up a bit too early */
+        timeout.tv_usec = (diff - timeout.tv_sec) * 1e6 + 1;
+        ptimeout = & timeout;
+    }
+
+    /* FIXME: [??] On macOS, select returns -1 (EBADF) after pts is closed */
+    n = select(fd_max + 1, & readfds, & writefds, NULL, ptimeout);
+    if (n < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    if (g_sigpipe[0] >= 0 && FD_ISSET(g_sigpipe[0], & readfds) ) {
+        unsigned char c;
+
+        while (nret < nevs && read(g_sigpipe[0], & c, 1) == 1) {
+            evs[nret].fd = -1;
+            evs[nret].events = EV_SIGNAL;
+            evs[nret].signo = c;
+            ++nret;
+        }
+    }
+
+    for (i = 0; i < ev->nfds && nret < nevs; ++i) {
+        fd = ev->fds[i].fd;
+        evs[nret].fd = fd;
+        evs[nret].events = 0;
+        if (FD_ISSET(fd, & readfds) ) {
+            evs[nret].events |= EV_READ;
+        }
+        if (FD_ISSET(fd, & writefds) ) {
+            evs[nret].events |= EV_WRITE;
+        }
+        if (evs[nret].events != 0) {
+            ++nret;
+        }
+    }
+
+    if (ev->has_deadline && nret < nevs && Clock_remain( & ev->deadline) <= 0) {
+        ev->has_deadline = false;
+
+        evs[nret].fd = -1;
+        evs[nret].events = EV_TIMER;
+        ++nret;
+    }
+#endif
+
+    return nret;
+}
+
+/*
+ * RETURN:
+ *  -1: Error
+ *  >=0: # of events stored in `evs' (0 when interrupted)
+ */
+int
+ev_wait(evloop_t * ev, struct ev_event * evs, int nevs)
+{
+    return ev_collect(ev, evs, nevs, true);
+}
+
+/*
+ * Same as ev_wait() but never blocks.
+ */
+int
+ev_poll(evloop_t * ev, struct ev_event * evs, int nevs)
+{
+    return ev_collect(ev, evs, nevs, false);
+}
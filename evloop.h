@@ -0,0 +1,34 @@
+
+#ifndef EVLOOP_H__
+#define EVLOOP_H__
+
+#include <stdbool.h>
+#include <time.h>
+
+/* interests / events */
+#define EV_READ     0x01
+#define EV_WRITE    0x02
+#define EV_SIGNAL   0x04    /* pseudo event, `fd' is -1 */
+#define EV_TIMER    0x08    /* pseudo event, `fd' is -1 */
+
+/* max # of events returned by one ev_wait() */
+#define EV_MAX_FDS  64
+
+struct ev_event {
+    int fd;
+    int events;
+    int signo;              /* for EV_SIGNAL */
+};
+
+typedef struct evloop evloop_t;
+
+evloop_t * ev_new(void);
+void       ev_free(evloop_t * ev);
+int        ev_watch(evloop_t * ev, int fd, int events);
+int        ev_watch_signal(evloop_t * ev, int signo);
+void       ev_set_deadline(evloop_t * ev, const struct timespec * when);
+int        ev_wait(evloop_t * ev, struct ev_event * evs, int nevs);
+int        ev_poll(evloop_t * ev, struct ev_event * evs, int nevs);
+int        ev_fd(evloop_t * ev);
+
+#endif
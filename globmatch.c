@@ -0,0 +1,397 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "globmatch.h"
+
+#define GM_SET_ADD(set, c)  ( (set)[(uint8_t) (c) / 8] |= 1 << ((uint8_t) (c) % 8) )
+#define GM_SET_HAS(set, c)  ( ( (set)[(uint8_t) (c) / 8] >> ((uint8_t) (c) % 8) ) & 1)
+
+/* the char an atom matches, or -1 if it's not a literal */
+static int
+gm_atom_lit(const uint8_t * set, bool icase)
+{
+    int c, n = 0, lit = -1;
+
+    for (c = 0; c < 256; ++c) {
+        if (GM_SET_HAS(set, c) ) {
+            if (++n > 2) {
+                return -1;
+            }
+            if (lit < 0) {
+                lit = c;
+            }
+        }
+    }
+    if (n == 1 && ! (icase && isalpha(lit) ) ) {
+        return lit;
+    } else if (n == 2 && icase && isupper(lit) && GM_SET_HAS(set, tolower(lit) ) ) {
+        return tolower(lit);
+    } else {
+        return -1;
+    }
+}
+
+static uint8_t *
+gm_new_atom(struct gm_seg * seg)
+{
+    seg->sets = realloc(seg->sets, (seg->len + 1) * sizeof(seg->sets[0]) );
+    if (seg->sets == NULL) {
+        fatal_sys("realloc");
+    }
+    memset(seg->sets[seg->len], 0, sizeof(seg->sets[0]) );
+
+    return seg->sets[seg->len++];
+}
+
+static struct gm_seg *
+gm_new_seg(globmatch_t * gm)
+{
+    gm->segs = realloc(gm->segs, (gm->nsegs + 1) * sizeof(gm->segs[0]) );
+    if (gm->segs == NULL) {
+        fatal_sys("realloc");
+    }
+    memset( & gm->segs[gm->nsegs], 0, sizeof(gm->segs[0]) );
+
+    return & gm->segs[gm->nsegs++];
+}
+
+/*
+ * [...] with the leading `[' already skipped, the same way glob2re() passes
+ * it to regcomp().
+ *
+ * RETURN: where the bracket ends, or NULL if it's invalid.
+ */
+static const char *
+gm_bracket(const char * in, uint8_t * set, bool icase)
+{
+    const char * end;
+    bool negate = false;
+    int i, c, lo, hi;
+
+    if (in[0] == '!' || in[0] == '^') {
+        negate = true;
+        ++in;
+    }
+    if (in[0] == '\0') {
+        return NULL;
+    }
+
+    /* the first char can be `]' */
+    end = strchr(in + 1, ']');
+    if (end == NULL) {
+        return NULL;
+    }
+    for (i = 0; in + i < end; ++i) {
+        if (in[i] == '[' && strchr(":.=", in[i + 1]) != NULL) {
+            return NULL;
+        }
+    }
+
+    while (in < end) {
+        lo = hi = (uint8_t) in[0];
+        if (in[1] == '-' && in + 2 < end) {
+            hi = (uint8_t) in[2];
+            if (hi < lo) {
+                return NULL;
+            }
+            in += 3;
+        } else {
+            in += 1;
+        }
+        for (c = lo; c <= hi; ++c) {
+            GM_SET_ADD(set, c);
+            if (icase && isalpha(c) ) {
+                GM_SET_ADD(set, tolower(c) );
+                GM_SET_ADD(set, toupper(c) );
+            }
+        }
+    }
+    if (negate) {
+        for (i = 0; i < 256 / 8; ++i) {
+            set[i] = ~set[i];
+        }
+    }
+
+    return end + 1;
+}
+
+/* pick the longest literal run of the segment for memsearch */
+static void
+gm_seg_prepare(struct gm_seg * seg, bool icase)
+{
+    char * lits;
+    int i, c, run = 0, best = 0, bestoff = 0;
+
+    lits = malloc(seg->len + 1);
+    if (lits == NULL) {
+        fatal_sys("malloc");
+    }
+    for (i = 0; i < seg->len; ++i) {
+        c = gm_atom_lit(seg->sets[i], icase);
+        if (c < 0) {
+            run = 0;
+            continue;
+        }
+        lits[i] = c;
+        if (++run > best) {
+            best = run;
+            bestoff = i + 1 - run;
+        }
+    }
+
+    if (best > 0) {
+        ms_init( & seg->ms, lits + bestoff, best, icase);
+        seg->msoff = bestoff;
+        seg->has_ms = true;
+    }
+    free(lits);
+}
+
+globmatch_t *
+gm_compile(const char * glob, bool icase)
+{
+    globmatch_t * gm;
+    struct gm_seg * seg;
+    uint8_t * set;
+    int i, c;
+
+    gm = calloc(1, sizeof(* gm) );
+    if (gm == NULL) {
+        fatal_sys("calloc");
+    }
+    seg = gm_new_seg(gm);
+
+    if (glob[0] == '^') {
+        gm->bol = true;
+        ++glob;
+    }
+    while (glob[0] != '\0') {
+        c = (uint8_t) glob[0];
+
+        if (c == '*') {
+            /* `**' is just `*' */
+            if (seg->len > 0 || gm->nsegs == 1) {
+                seg = gm_new_seg(gm);
+            }
+            ++glob;
+            continue;
+        } else if (c == '$' && glob[1] == '\0') {
+            gm->eol = true;
+            ++glob;
+            continue;
+        }
+
+        set = gm_new_atom(seg);
+        if (c == '?') {
+            memset(set, 0xff, sizeof(seg->sets[0]) );
+            ++glob;
+            continue;
+        } else if (c == '[') {
+            glob = gm_bracket(glob + 1, set, icase);
+            if (glob == NULL) {
+                gm_free(gm);
+                return NULL;
+            }
+            continue;
+        } else if (c == '\\') {
+            if (glob[1] == '\0' || strchr("\\*?[]", glob[1]) == NULL) {
+                gm_free(gm);
+                return NULL;
+            }
+            c = (uint8_t) glob[1];
+            glob += 2;
+        } else {
+            ++glob;
+        }
+
+        GM_SET_ADD(set, c);
+        if (icase && isalpha(c) ) {
+            GM_SET_ADD(set, tolower(c) );
+            GM_SET_ADD(set, toupper(c) );
+        }
+    }
+
+    for (i = 0; i < gm->nsegs; ++i) {
+        gm_seg_prepare( & gm->segs[i], icase);
+    }
+
+    return gm;
+}
+
+void
+gm_free(globmatch_t * gm)
+{
+    int i;
+
+    if (gm == NULL) {
+        return;
+    }
+    for (i = 0; i < gm->nsegs; ++i) {
+        free(gm->segs[i].sets);
+        if (gm->segs[i].has_ms) {
+            ms_free( & gm->segs[i].ms);
+        }
+    }
+    free(gm->segs);
+    free(gm);
+}
+
+void
+gm_reset(gm_state_t * st)
+{
+    st->start = -1;
+    st->seg = 0;
+    st->pos = 0;
+}
+
+static bool
+gm_seg_at(const struct gm_seg * seg, const char * buf)
+{
+    int i;
+
+    for (i = 0; i < seg->len; ++i) {
+        if ( ! GM_SET_HAS(seg->sets[i], buf[i]) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* RETURN: where the segment first is in buf[from, len), or -1 */
+static int
+gm_seg_find(const struct gm_seg * seg, const char * buf, int from, int len)
+{
+    int p, n;
+
+    if (seg->has_ms) {
+        /* the literal run is at `msoff' in the segment */
+        for (p = from; p + seg->len <= len; ++p) {
+            n = ms_find( & seg->ms, buf + p + seg->msoff,
+                         len - seg->len - p + seg->ms.len);
+            if (n < 0) {
+                return -1;
+            }
+            p += n;
+            if (gm_seg_at(seg, buf + p) ) {
+                return p;
+            }
+        }
+    } else {
+        for (p = from; p + seg->len <= len; ++p) {
+            if (gm_seg_at(seg, buf + p) ) {
+                return p;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/* the segment can't be in buf[pos, len) so skip all but its length - 1 */
+static void
+gm_seg_miss(const struct gm_seg * seg, gm_state_t * st, int len)
+{
+    st->pos = MAX(st->pos, len - seg->len + 1);
+}
+
+/*
+ * Continue matching buf[0, len) with what's known from the last time (the
+ * data may only have grown since then).
+ *
+ * RETURN: true and the leftmost-longest match in [so, eo), or false.
+ */
+bool
+gm_match(const globmatch_t * gm, gm_state_t * st, const char * buf, int len,
+         int * so, int * eo)
+{
+    const struct gm_seg * seg = & gm->segs[0];
+    int p;
+
+    /* no `*' */
+    if (gm->nsegs == 1) {
+        if (gm->bol) {
+            p = 0;
+            if (seg->len > len || (gm->eol && seg->len != len) ) {
+                return false;
+            }
+        } else if (gm->eol) {
+            p = len - seg->len;
+            if (p < 0) {
+                return false;
+            }
+        } else {
+            p = gm_seg_find(seg, buf, st->pos, len);
+            if (p < 0) {
+                gm_seg_miss(seg, st, len);
+                return false;
+            }
+        }
+        if ( ! gm_seg_at(seg, buf + p) ) {
+            return false;
+        }
+        * so = p;
+        * eo = p + seg->len;
+        return true;
+    }
+
+    /* where the match starts */
+    if (st->start < 0) {
+        if (gm->bol || seg->len == 0) {
+            if (seg->len > len || ! gm_seg_at(seg, buf) ) {
+                return false;
+            }
+            st->start = 0;
+        } else {
+            st->start = gm_seg_find(seg, buf, st->pos, len);
+            if (st->start < 0) {
+                gm_seg_miss(seg, st, len);
+                return false;
+            }
+        }
+        st->pos = st->start + seg->len;
+        st->seg = 1;
+    }
+
+    /* the ones in the middle are taken as early as possible */
+    while (st->seg < gm->nsegs - 1) {
+        seg = & gm->segs[st->seg];
+        p = gm_seg_find(seg, buf, st->pos, len);
+        if (p < 0) {
+            gm_seg_miss(seg, st, len);
+            return false;
+        }
+        st->pos = p + seg->len;
+        st->seg += 1;
+    }
+
+    /* and the last one as late as possible */
+    seg = & gm->segs[gm->nsegs - 1];
+    if (seg->len == 0) {
+        p = len;
+    } else if (gm->eol) {
+        p = len - seg->len;
+        if (p < st->pos || ! gm_seg_at(seg, buf + p) ) {
+            return false;
+        }
+        p = len;
+    } else {
+        int next;
+
+        p = gm_seg_find(seg, buf, st->pos, len);
+        if (p < 0) {
+            gm_seg_miss(seg, st, len);
+            return false;
+        }
+        while ( (next = gm_seg_find(seg, buf, p + 1, len) ) >= 0) {
+            p = next;
+        }
+        p += seg->len;
+    }
+
+    * so = st->start;
+    * eo = p;
+    return true;
+}
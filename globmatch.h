@@ -0,0 +1,48 @@
+#ifndef GLOBMATCH_H__
+#define GLOBMATCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memsearch.h"
+
+/*
+ * Glob matcher for expect -glob, with the same syntax and results as
+ * matching glob2re()'s ERE with regexec() (leftmost-longest, `^' and `$'
+ * anchor at the start and end of the data).
+ *
+ * The glob is split at the `*'s into segments of fixed-width atoms (a char,
+ * `?' or `[...]'). Segments are found with memsearch on their longest
+ * literal run and the first one which fits is taken, except the last one
+ * which is the last one in the data (longest match). How far the matching
+ * got is kept in a gm_state_t so it can be resumed when more data comes.
+ */
+
+struct gm_seg {
+    int     len;                /* # of atoms */
+    uint8_t (* sets)[256 / 8];  /* what each atom matches */
+    memsearch_t ms;             /* the longest literal run ... */
+    int     msoff;              /* ... and where it is in the segment */
+    bool    has_ms;
+};
+
+typedef struct globmatch {
+    int     nsegs;
+    struct gm_seg * segs;       /* separated by `*'s, first/last may be empty */
+    bool    bol, eol;           /* `^' and `$' */
+} globmatch_t;
+
+/* offsets are relative to the start of the data */
+typedef struct gm_state {
+    int     start;      /* where the match starts, -1 if not known yet */
+    int     seg;        /* # of segments found */
+    int     pos;        /* where to look for the next segment */
+} gm_state_t;
+
+globmatch_t * gm_compile(const char * glob, bool icase);
+void          gm_free(globmatch_t * gm);
+void          gm_reset(gm_state_t * st);
+bool          gm_match(const globmatch_t * gm, gm_state_t * st,
+                       const char * buf, int len, int * so, int * eo);
+
+#endif
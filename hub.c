@@ -0,0 +1,921 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "evloop.h"
+#include "proto.h"
+#include "server.h"
+
+/*
+ * Hub mode: `sexpect hub' hosts many spawned children (sessions) in one
+ * daemon, each addressed by its name (`-session NAME') over the same socket.
+ *
+ *  - The main thread accepts the connections, spawns the new sessions (it's
+ *    the only thread which ever forks) and reaps the children of the sessions
+ *    which are over.
+ *  - Each session is served by one worker thread till it's over. A worker
+ *    runs one event loop for all its sessions, which watches each session's
+ *    own event loop (sess_fd()), and it reads at most HUB_READ_BUDGET bytes
+ *    from a child each time so a chatty child would not starve the others.
+ */
+
+#ifdef HAVE_HUB
+
+#define HUB_MAX_WORKERS     64
+#define HUB_READ_BUDGET     (64 * 1024)
+#define HUB_NBUCKETS        1024
+#define HUB_MAX_PENDING     256     /* connections not handed over yet */
+
+struct hub_worker;
+
+struct hub_entry {
+    char * name;
+    session_t * sess;
+    struct st_cmdopts * cmdopts;
+    struct hub_worker * worker;
+    struct hub_entry * next;        /* in the same bucket */
+};
+
+/* from the main thread to a worker: a new session, or a client for one */
+struct hub_job {
+    struct hub_entry * entry;
+    char * name;
+    int sock;
+    struct hub_job * next;
+};
+
+struct hub_worker {
+    pthread_t tid;
+    evloop_t * ev;
+    int wake[2];
+
+    struct hub_job * jobs;          /* g.lock */
+    struct hub_job ** jobs_tail;    /* g.lock */
+    int nsessions;                  /* g.lock */
+
+    /* only used by the worker itself */
+    int nbyfd;
+    struct hub_entry ** byfd;       /* sess_fd() --> entry */
+};
+
+static struct {
+    struct st_cmdopts * cmdopts;
+    evloop_t * ev;
+    int fd_listen;
+    int wake[2];                    /* a worker has ended a session */
+    sigset_t childmask;
+    bool quit;
+
+    int nworkers;
+    struct hub_worker * workers;
+
+    /* connections which have not said which session they're for */
+    int npending;
+    int pending[HUB_MAX_PENDING];
+
+    /* shared by all threads */
+    pthread_mutex_t lock;
+    struct hub_entry * buckets[HUB_NBUCKETS];
+    int nsessions;
+    struct timespec emptysince;
+    int norphans, orphcap;
+    pid_t * orphans;                /* children not reaped by the sessions */
+} g;
+
+static unsigned
+hub_hash(const char * name)
+{
+    unsigned h = 5381;
+
+    while ( * name) {
+        h = h * 33 + (unsigned char) * name++;
+    }
+
+    return h % HUB_NBUCKETS;
+}
+
+/* N.B.: with g.lock held */
+static struct hub_entry *
+hub_lookup(const char * name)
+{
+    struct hub_entry * e;
+
+    for (e = g.buckets[hub_hash(name)]; e != NULL; e = e->next) {
+        if (streq(e->name, name) ) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+hub_wake(int fd)
+{
+    ssize_t ret;
+
+    ret = write(fd, "", 1);
+    (void) ret;
+}
+
+static void
+hub_drain(int fd)
+{
+    char buf[64];
+
+    while (read(fd, buf, sizeof(buf) ) > 0) {
+    }
+}
+
+static void
+hub_error(int sock, int code, const char * fmt, ...)
+{
+    va_list ap;
+    char errmsg[256];
+    ttlv_t * msg;
+
+    va_start(ap, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, ap);
+    va_end(ap);
+
+    debug("%s", errmsg);
+
+    msg = ttlv_new_struct(TAG_ERROR);
+    ttlv_append_child(msg,
+        ttlv_new_int(TAG_ERROR_CODE, code),
+        ttlv_new_text(TAG_ERROR_MSG, strlen(errmsg), errmsg),
+        NULL);
+    msg_send(sock, msg);
+    msg_free( & msg);
+}
+
+static void
+hub_free_cmdopts(struct st_cmdopts * cmdopts)
+{
+    struct st_spawn * spawn = & cmdopts->spawn;
+    char ** pp;
+
+    if (spawn->argv != NULL) {
+        for (pp = spawn->argv; * pp != NULL; ++pp) {
+            free( * pp);
+        }
+        free(spawn->argv);
+    }
+    if (spawn->envp != NULL) {
+        for (pp = spawn->envp; * pp != NULL; ++pp) {
+            free( * pp);
+        }
+        free(spawn->envp);
+    }
+    free(spawn->cwd);
+    free(spawn->logfile);
+    free(spawn->scrollback_file);
+    free(cmdopts->session);
+    free(cmdopts);
+}
+
+/*
+ * Session is over. Called by its worker.
+ */
+static void
+hub_end(struct hub_worker * w, struct hub_entry * entry)
+{
+    struct hub_entry ** pp;
+    int fd;
+    pid_t child;
+
+    debug("session %s is over", entry->name);
+
+    fd = sess_fd(entry->sess);
+    ev_watch(w->ev, fd, 0);
+    w->byfd[fd] = NULL;
+
+    child = sess_free(entry->sess);
+
+    pthread_mutex_lock( & g.lock);
+    for (pp = & g.buckets[hub_hash(entry->name)]; * pp != entry;
+         pp = & (* pp)->next) {
+    }
+    * pp = entry->next;
+    --w->nsessions;
+    if (--g.nsessions == 0) {
+        Clock_gettime( & g.emptysince);
+    }
+    if (child > 0) {
+        if (g.norphans == g.orphcap) {
+            g.orphcap = g.orphcap ? g.orphcap * 2 : 16;
+            if (Realloc( (void **) & g.orphans,
+                         g.orphcap * sizeof(pid_t) ) == NULL) {
+                fatal_sys("realloc");
+            }
+        }
+        g.orphans[g.norphans++] = child;
+    }
+    pthread_mutex_unlock( & g.lock);
+
+    hub_wake(g.wake[1]);
+
+    free(entry->name);
+    hub_free_cmdopts(entry->cmdopts);
+    free(entry);
+}
+
+/*
+ * The jobs from the main thread.
+ */
+static void
+hub_take_jobs(struct hub_worker * w)
+{
+    struct hub_job * job, * next;
+    struct hub_entry * entry;
+    int fd;
+
+    pthread_mutex_lock( & g.lock);
+    job = w->jobs;
+    w->jobs = NULL;
+    w->jobs_tail = & w->jobs;
+    pthread_mutex_unlock( & g.lock);
+
+    for ( ; job != NULL; job = next) {
+        next = job->next;
+
+        if (job->entry != NULL) {
+            /* a new session */
+            entry = job->entry;
+            fd = sess_fd(entry->sess);
+            if (fd >= w->nbyfd) {
+                int n = w->nbyfd;
+
+                w->nbyfd = MAX(fd + 1, w->nbyfd * 2);
+                if (Realloc( (void **) & w->byfd,
+                             w->nbyfd * sizeof(w->byfd[0]) ) == NULL) {
+                    fatal_sys("realloc");
+                }
+                memset(w->byfd + n, 0, (w->nbyfd - n) * sizeof(w->byfd[0]) );
+            }
+            w->byfd[fd] = entry;
+            ev_watch(w->ev, fd, EV_READ);
+        } else {
+            /* a client, the session may have been over (or replaced by one
+             * of the same name on another worker, which may free its entry
+             * any time, so only ours is usable after unlocking) */
+            pthread_mutex_lock( & g.lock);
+            entry = hub_lookup(job->name);
+            if (entry != NULL && entry->worker != w) {
+                entry = NULL;
+            }
+            pthread_mutex_unlock( & g.lock);
+
+            if (entry == NULL) {
+                hub_error(job->sock, ERROR_GENERAL,
+                          "no such session: %s", job->name);
+                close(job->sock);
+            } else if ( ! sess_add_conn(entry->sess, job->sock) ) {
+                hub_error(job->sock, ERROR_GENERAL,
+                          "too many clients for session %s", job->name);
+                close(job->sock);
+            }
+            free(job->name);
+        }
+
+        free(job);
+    }
+}
+
+static void *
+hub_worker(void * arg)
+{
+    struct hub_worker * w = arg;
+    struct ev_event evs[EV_MAX_FDS];
+    struct hub_entry * entry;
+    int i, nevs;
+
+    ev_watch(w->ev, w->wake[0], EV_READ);
+
+    /* [<] The session fds are level triggered and epoll reports the ready
+     *     ones round robin, together with the read budget each session gets
+     *     its fair share. */
+    while (true) {
+        nevs = ev_wait(w->ev, evs, ARRAY_SIZE(evs) );
+        if (nevs < 0) {
+            fatal_sys("ev_wait");
+        }
+        for (i = 0; i < nevs; ++i) {
+            if (evs[i].fd == w->wake[0]) {
+                hub_drain(w->wake[0]);
+                hub_take_jobs(w);
+            } else if (evs[i].fd >= 0 && evs[i].fd < w->nbyfd
+                       && (entry = w->byfd[evs[i].fd]) != NULL) {
+                if ( ! sess_run(entry->sess) ) {
+                    hub_end(w, entry);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* N.B.: with g.lock held */
+static void
+hub_post(struct hub_worker * w, struct hub_job * job)
+{
+    job->next = NULL;
+    * w->jobs_tail = job;
+    w->jobs_tail = & job->next;
+
+    hub_wake(w->wake[1]);
+}
+
+static char *
+hub_strdup(ttlv_t * t)
+{
+    char * s;
+
+    s = strndup( (char *) t->v_text, t->length);
+    if (s == NULL) {
+        fatal_sys("strndup");
+    }
+
+    return s;
+}
+
+/*
+ * TAG_SPAWN --> cmdopts, as `sexpect spawn' would have got from the command
+ * line.
+ */
+static struct st_cmdopts *
+hub_decode_spawn(ttlv_t * msg, struct winsize * ws, bool * has_ws)
+{
+    struct st_cmdopts * cmdopts;
+    struct st_spawn * spawn;
+    int nargs = 0, nenvs = 0;
+    ttlv_t * t;
+
+    for (t = msg->child; t != NULL; t = t->next) {
+        if (t->tag == TAG_ARGV) {
+            ++nargs;
+        } else if (t->tag == TAG_ENV) {
+            ++nenvs;
+        }
+    }
+
+    cmdopts = calloc(1, sizeof( * cmdopts) );
+    if (cmdopts == NULL) {
+        fatal_sys("calloc");
+    }
+    cmdopts->cmd = CMD_SPAWN;
+    cmdopts->sockpath = g.cmdopts->sockpath;
+    cmdopts->debug = g.cmdopts->debug;
+
+    spawn = & cmdopts->spawn;
+    spawn->def_timeout = PASS_DEF_TMOUT;
+    spawn->zombie_idle = PASS_DEF_ZOMBIE_TTL;
+    spawn->bufsize = PASS_DEF_BUFSIZE;
+    spawn->history = PASS_DEF_HISTORY;
+    spawn->logfd = -1;
+    spawn->argv = calloc(nargs + 1, sizeof(char *) );
+    spawn->envp = calloc(nenvs + 1, sizeof(char *) );
+    if (spawn->argv == NULL || spawn->envp == NULL) {
+        fatal_sys("calloc");
+    }
+
+    nargs = nenvs = 0;
+    * has_ws = false;
+    for (t = msg->child; t != NULL; t = t->next) {
+        switch (t->tag) {
+        case TAG_SESSION:
+            free(cmdopts->session);
+            cmdopts->session = hub_strdup(t);
+            break;
+        case TAG_ARGV:
+            spawn->argv[nargs++] = hub_strdup(t);
+            break;
+        case TAG_ENV:
+            spawn->envp[nenvs++] = hub_strdup(t);
+            break;
+        case TAG_CWD:
+            free(spawn->cwd);
+            spawn->cwd = hub_strdup(t);
+            break;
+        case TAG_LOGFILE:
+            free(spawn->logfile);
+            spawn->logfile = hub_strdup(t);
+            break;
+        case TAG_SCROLLBACK_FILE:
+            free(spawn->scrollback_file);
+            spawn->scrollback_file = hub_strdup(t);
+            break;
+        case TAG_LOGFILE_APPEND:
+            spawn->append = t->v_bool;
+            break;
+        case TAG_NOHUP:
+            spawn->nohup = t->v_bool;
+            break;
+        case TAG_NONBLOCK:
+            spawn->nonblock = t->v_bool;
+            break;
+        case TAG_AUTOWAIT:
+            spawn->autowait = t->v_bool;
+            break;
+        case TAG_CLOEXIT:
+            spawn->cloexit = t->v_bool;
+            break;
+        case TAG_EXP_TIMEOUT:
+            spawn->def_timeout = t->v_int;
+            break;
+        case TAG_TTL:
+            spawn->ttl = t->v_int;
+            break;
+        case TAG_IDLETIME:
+            spawn->idle = t->v_int;
+            break;
+        case TAG_ZOMBIE_TTL:
+            spawn->zombie_idle = t->v_int;
+            break;
+        case TAG_BUFSIZE:
+            spawn->bufsize = t->v_int;
+            break;
+        case TAG_HISTORY:
+            spawn->history = t->v_int;
+            break;
+        case TAG_SCROLLBACK:
+            spawn->scrollback = t->v_long;
+            break;
+        case TAG_SENDQ:
+            spawn->sendq = t->v_int;
+            break;
+        case TAG_WINSIZE_ROW:
+            ws->ws_row = t->v_int;
+            * has_ws = true;
+            break;
+        case TAG_WINSIZE_COL:
+            ws->ws_col = t->v_int;
+            * has_ws = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return cmdopts;
+}
+
+static void
+hub_spawn(int sock, ttlv_t * msg)
+{
+    struct st_cmdopts * cmdopts;
+    struct hub_entry * entry;
+    struct hub_worker * w;
+    struct hub_job * job;
+    struct winsize ws = { 0 };
+    bool has_ws;
+    char errbuf[256];
+    char * errmsg;
+    session_t * sess;
+    ttlv_t * ack;
+    int i;
+
+    cmdopts = hub_decode_spawn(msg, & ws, & has_ws);
+
+    errmsg = bufsize_check(cmdopts->spawn.bufsize, cmdopts->spawn.history);
+    if (cmdopts->session == NULL || cmdopts->session[0] == '\0') {
+        hub_error(sock, ERROR_USAGE, "-session not specified");
+        hub_free_cmdopts(cmdopts);
+        return;
+    } else if (cmdopts->spawn.argv[0] == NULL) {
+        hub_error(sock, ERROR_USAGE, "spawn requires more arguments");
+        hub_free_cmdopts(cmdopts);
+        return;
+    } else if (errmsg != NULL) {
+        hub_error(sock, ERROR_USAGE, "%s", errmsg);
+        hub_free_cmdopts(cmdopts);
+        return;
+    }
+
+    pthread_mutex_lock( & g.lock);
+    entry = hub_lookup(cmdopts->session);
+    pthread_mutex_unlock( & g.lock);
+    if (entry != NULL) {
+        hub_error(sock, ERROR_GENERAL, "session exists: %s", cmdopts->session);
+        hub_free_cmdopts(cmdopts);
+        return;
+    }
+
+    sess = sess_spawn(cmdopts, has_ws ? & ws : NULL, & g.childmask,
+                      HUB_READ_BUDGET, errbuf, sizeof(errbuf) );
+    if (sess == NULL) {
+        hub_error(sock, ERROR_SYS, "%s", errbuf);
+        hub_free_cmdopts(cmdopts);
+        return;
+    }
+
+    entry = calloc(1, sizeof( * entry) );
+    job = calloc(1, sizeof( * job) );
+    if (entry == NULL || job == NULL) {
+        fatal_sys("calloc");
+    }
+    entry->name = strdup(cmdopts->session);
+    entry->sess = sess;
+    entry->cmdopts = cmdopts;
+    job->entry = entry;
+    job->sock = -1;
+
+    debug("session %s spawned (pid %d)", entry->name, (int) sess_pid(sess) );
+
+    /* the least busy worker */
+    pthread_mutex_lock( & g.lock);
+    w = & g.workers[0];
+    for (i = 1; i < g.nworkers; ++i) {
+        if (g.workers[i].nsessions < w->nsessions) {
+            w = & g.workers[i];
+        }
+    }
+    entry->worker = w;
+    ++w->nsessions;
+    ++g.nsessions;
+    entry->next = g.buckets[hub_hash(entry->name)];
+    g.buckets[hub_hash(entry->name)] = entry;
+    hub_post(w, job);
+    pthread_mutex_unlock( & g.lock);
+
+    ack = ttlv_new_struct(TAG_ACK);
+    ttlv_append_child(ack, ttlv_new_int(TAG_PID, sess_pid(sess) ), NULL);
+    msg_send(sock, ack);
+    msg_free( & ack);
+}
+
+/*
+ * A client for a session, hand it over to the session's worker.
+ */
+static void
+hub_attach(int sock, const char * name)
+{
+    struct hub_entry * entry;
+    struct hub_job * job;
+
+    pthread_mutex_lock( & g.lock);
+    entry = hub_lookup(name);
+    if (entry != NULL) {
+        /* [<] Say HELLO before the handover, the socket is the worker's
+         *     from then on (and may be closed by it at any time). */
+        if (msg_hello(sock) < 0) {
+            debug("msg_hello failed (client dead?), closing the socket");
+            pthread_mutex_unlock( & g.lock);
+            close(sock);
+            return;
+        }
+
+        job = calloc(1, sizeof( * job) );
+        if (job == NULL) {
+            fatal_sys("calloc");
+        }
+        job->name = strdup(name);
+        job->sock = sock;
+        hub_post(entry->worker, job);
+    }
+    pthread_mutex_unlock( & g.lock);
+
+    if (entry == NULL) {
+        hub_error(sock, ERROR_GENERAL, "no such session: %s", name);
+        close(sock);
+    }
+}
+
+/*
+ * A message from a connection not handed over yet.
+ *
+ * RETURN:
+ *   true: The connection is still ours.
+ */
+static bool
+hub_conn_msg(int sock)
+{
+    ttlv_t * msg;
+    ttlv_t * ver, * name;
+    bool keep = false;
+
+    msg = msg_recv(sock);
+    if (msg == NULL) {
+        debug("msg_recv failed (client dead?), closing the socket");
+        close(sock);
+        return false;
+    }
+
+    if (msg->tag == TAG_HELLO) {
+        ver = ttlv_find_child(msg, TAG_VERSION);
+        name = ttlv_find_child(msg, TAG_SESSION);
+        if (ver == NULL) {
+            debug("client version too old");
+            close(sock);
+        } else if ( ! streq(VERSION_, (char *) ver->v_text) ) {
+            hub_error(sock, ERROR_PROTO,
+                      "version mismatch (server: %s, client: %s)",
+                      VERSION_, (char *) ver->v_text);
+            close(sock);
+        } else if (name != NULL) {
+            hub_attach(sock, (char *) name->v_text);
+        } else if (msg_hello(sock) < 0) {
+            close(sock);
+        } else {
+            /* for the hub itself */
+            keep = true;
+        }
+    } else if (msg->tag == TAG_SPAWN) {
+        hub_spawn(sock, msg);
+        keep = true;
+    } else if (msg->tag == TAG_DISCONN) {
+        msg_disconn(sock);
+        close(sock);
+    } else {
+        hub_error(sock, ERROR_USAGE, "-session not specified");
+        close(sock);
+    }
+
+    msg_free( & msg);
+
+    return keep;
+}
+
+static void
+hub_reap(void)
+{
+    int i, n;
+
+    pthread_mutex_lock( & g.lock);
+    for (i = n = 0; i < g.norphans; ++i) {
+        if (waitpid(g.orphans[i], NULL, WNOHANG) == 0) {
+            g.orphans[n++] = g.orphans[i];
+        }
+    }
+    g.norphans = n;
+    pthread_mutex_unlock( & g.lock);
+}
+
+static void
+hub_accept(void)
+{
+    int sock;
+
+    sock = accept4(g.fd_listen, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) {
+        if (errno != EINTR && errno != ECONNABORTED) {
+            fatal_sys("accept");
+        }
+    } else if (g.npending == HUB_MAX_PENDING) {
+        /* [<] `fd_listen' is not watched when full */
+        bug("no free slot for the new client");
+        close(sock);
+    } else {
+        g.pending[g.npending++] = sock;
+        ev_watch(g.ev, sock, EV_READ);
+    }
+}
+
+static void
+hub_loop(void)
+{
+    struct ev_event evs[EV_MAX_FDS];
+    struct timespec deadline;
+    bool has_deadline;
+    int i, j, nevs;
+
+    while ( ! g.quit) {
+        /* -idle */
+        has_deadline = false;
+        if (g.cmdopts->hub.idle > 0) {
+            pthread_mutex_lock( & g.lock);
+            if (g.nsessions == 0) {
+                if (Clock_diff( & g.emptysince, NULL) > g.cmdopts->hub.idle) {
+                    debug("no sessions for %d seconds, bye",
+                          g.cmdopts->hub.idle);
+                    g.quit = true;
+                }
+                Clock_add( & deadline, & g.emptysince, g.cmdopts->hub.idle);
+                has_deadline = true;
+            }
+            pthread_mutex_unlock( & g.lock);
+            if (g.quit) {
+                break;
+            }
+        }
+
+        ev_watch(g.ev, g.fd_listen,
+                 g.npending < HUB_MAX_PENDING ? EV_READ : 0);
+        ev_set_deadline(g.ev, has_deadline ? & deadline : NULL);
+
+        nevs = ev_wait(g.ev, evs, ARRAY_SIZE(evs) );
+        if (nevs < 0) {
+            fatal_sys("ev_wait");
+        }
+        for (i = 0; i < nevs; ++i) {
+            if (evs[i].events & EV_SIGNAL) {
+                if (evs[i].signo == SIGCHLD) {
+                    hub_reap();
+                } else {
+                    debug("got signal %d, bye", evs[i].signo);
+                    g.quit = true;
+                }
+            } else if ( (evs[i].events & EV_READ) == 0) {
+                continue;
+            } else if (evs[i].fd == g.fd_listen) {
+                hub_accept();
+            } else if (evs[i].fd == g.wake[0]) {
+                hub_drain(g.wake[0]);
+                hub_reap();
+            } else {
+                for (j = 0; j < g.npending; ++j) {
+                    if (g.pending[j] == evs[i].fd) {
+                        break;
+                    }
+                }
+                if (j == g.npending) {
+                    continue;
+                }
+                ev_watch(g.ev, evs[i].fd, 0);
+                if (hub_conn_msg(evs[i].fd) ) {
+                    ev_watch(g.ev, evs[i].fd, EV_READ);
+                } else {
+                    g.pending[j] = g.pending[--g.npending];
+                }
+            }
+        }
+    }
+}
+
+static void
+hub_listen(void)
+{
+    struct sockaddr_un srv_addr = { 0 };
+    char * fullpath;
+    int fd;
+
+    debug("check if another server is using the sockfile");
+    fd = sock_connect(g.cmdopts->sockpath);
+    if (fd >= 0) {
+        fatal(ERROR_GENERAL, "sockpath in use");
+    }
+
+    g.fd_listen = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g.fd_listen < 0) {
+        fatal_sys("socket");
+    }
+
+    unlink(g.cmdopts->sockpath);
+
+    srv_addr.sun_family = AF_LOCAL;
+    snprintf(srv_addr.sun_path, sizeof(srv_addr.sun_path), "%s",
+             g.cmdopts->sockpath);
+    /* don't let other users connect to my server! */
+    umask(0077);
+    if (bind(g.fd_listen, (struct sockaddr *) & srv_addr, sizeof(srv_addr) ) < 0) {
+        fatal_sys("bind");
+    }
+
+    fullpath = realpath(g.cmdopts->sockpath, NULL);
+    if (fullpath == NULL) {
+        fatal_sys("realpath(%s)", g.cmdopts->sockpath);
+    }
+    g.cmdopts->sockpath = fullpath;
+
+    if (listen(g.fd_listen, SOMAXCONN) < 0) {
+        fatal_sys("listen");
+    }
+}
+
+static void
+hub_start_workers(void)
+{
+    struct hub_worker * w;
+    long ncpus;
+    int i;
+
+    g.nworkers = g.cmdopts->hub.workers;
+    if (g.nworkers <= 0) {
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        g.nworkers = ncpus > 0 ? ncpus : 1;
+    }
+    g.nworkers = MIN(g.nworkers, HUB_MAX_WORKERS);
+
+    g.workers = calloc(g.nworkers, sizeof(g.workers[0]) );
+    if (g.workers == NULL) {
+        fatal_sys("calloc");
+    }
+
+    for (i = 0; i < g.nworkers; ++i) {
+        w = & g.workers[i];
+        w->jobs_tail = & w->jobs;
+        w->ev = ev_new();
+        if (w->ev == NULL) {
+            fatal_sys("ev_new");
+        }
+        if (pipe2(w->wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+            fatal_sys("pipe2");
+        }
+        if ( (errno = pthread_create( & w->tid, NULL, hub_worker, w) ) != 0) {
+            fatal_sys("pthread_create");
+        }
+    }
+    debug("%d workers started", g.nworkers);
+}
+
+void
+hub_main(struct st_cmdopts * cmdopts)
+{
+    struct rlimit rl;
+    sigset_t sigs;
+    int fd;
+
+    g.cmdopts = cmdopts;
+    pthread_mutex_init( & g.lock, NULL);
+    Clock_gettime( & g.emptysince);
+
+    /* each session takes a few fds */
+    if (getrlimit(RLIMIT_NOFILE, & rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, & rl);
+    }
+
+    hub_listen();
+
+    /* be an evil daemon */
+    if ( ! cmdopts->debug) {
+        if ( (fd = fork() ) < 0) {
+            fatal_sys("fork");
+        } else if (fd > 0) {
+            exit(0);
+        }
+        setsid();
+
+        fd = open("/dev/null", O_RDWR);
+        dup2(fd, 0);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        if (fd > 2) {
+            close(fd);
+        }
+    }
+    chdir("/");
+
+    sig_handle(SIGPIPE, SIG_IGN);
+
+    /* Before any threads are created so they would all have the signals
+     * blocked, or signalfd() would miss them. */
+    sigemptyset( & sigs);
+    sigaddset( & sigs, SIGCHLD);
+    sigaddset( & sigs, SIGTERM);
+    sigaddset( & sigs, SIGINT);
+    sigaddset( & sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, & sigs, & g.childmask);
+
+    g.ev = ev_new();
+    if (g.ev == NULL) {
+        fatal_sys("ev_new");
+    }
+    if (ev_watch_signal(g.ev, SIGCHLD) < 0 || ev_watch_signal(g.ev, SIGTERM) < 0
+        || ev_watch_signal(g.ev, SIGINT) < 0
+        || ev_watch_signal(g.ev, SIGHUP) < 0) {
+        fatal_sys("ev_watch_signal");
+    }
+    if (pipe2(g.wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+        fatal_sys("pipe2");
+    }
+    ev_watch(g.ev, g.wake[0], EV_READ);
+
+    hub_start_workers();
+
+    debug("ready to recv requests");
+    hub_loop();
+
+    /* [>] The children would get SIGHUP when we exit */
+    debug("removing %s", cmdopts->sockpath);
+    unlink(cmdopts->sockpath);
+
+    exit(0);
+}
+
+#else
+
+void
+hub_main(struct st_cmdopts * cmdopts)
+{
+    fatal(ERROR_USAGE, "hub is not supported on this platform");
+}
+
+#endif /* HAVE_HUB */
@@ -1,6 +1,7 @@
 
 #define _GNU_SOURCE
 
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <sys/types.h>
@@ -9,6 +10,7 @@
 #include <unistd.h>
 
 #include "common.h"
+#include "globmatch.h"
 #include "pty.h"
 
 #define str_true(s)   str1of(s, "1", "on",  "yes", "y", "true",  NULL)
@@ -37,10 +39,12 @@ Usage:\n\
 Global options:\n\
     -debug | -d\n\
     -help | --help | -h\n\
+    -session NAME | -S NAME\n\
     -sock SOCKFILE | -s SOCKFILE\n\
     -version | --version\n\
 \n\
 Environment variables:\n\
+    SEXPECT_SESSION\n\
     SEXPECT_SOCKFILE\n\
 \n\
 Sub-commands:\n\
@@ -52,11 +56,15 @@ spawn (sp, fork)\n\
     Options:\n\
         -append\n\
         -autowait | -nowait\n\
+        -bufsize SIZE\n\
         -close-on-exit | -cloexit\n\
+        -history SIZE\n\
         -idle-close N | -idle N\n\
         -logfile FILE | -logf FILE | -log FILE\n\
         -nohup\n\
         -nonblock | -nb\n\
+        -scrollback SIZE | -scrollback FILE\n\
+        -sendq SIZE\n\
         -term TERM | -T TERM\n\
         -timeout N | -t N\n\
         -ttl N\n\
@@ -67,14 +75,20 @@ expect (exp, ex, x)\n\
     sexpect expect [OPTION] [-exact] PATTERN\n\
     sexpect expect [OPTION]  -glob   PATTERN\n\
     sexpect expect [OPTION]  -re     PATTERN\n\
+    sexpect expect [OPTION]  -pcre   PATTERN\n\
+    sexpect expect [OPTION] <-exact | -glob | -re | -pcre> PATTERN ...\n\
     sexpect expect [OPTION]  -eof\n\
     sexpect expect [OPTION]\n\
 \n\
     Options:\n\
         -anchor-newline | -anchor\n\
         -cstring | -cstr | -c\n\
-        -lookback N | -lb N\n\
+        -engine posix | -engine dfa\n\
+        -from OFFSET\n\
+        -since OFFSET\n\
+        -lookback N[b|s] | -lb N[b|s]\n\
         -nocase | -icase | -i\n\
+        -raw\n\
         -timeout N | -t N\n\
 \n\
 send (s)\n\
@@ -88,6 +102,7 @@ send (s)\n\
         -file FILE | -f FILE\n\
         -env NAME | -var NAME\n\
         -limit LIMIT\n\
+        -offset\n\
         -strip\n\
 \n\
 interact (i)\n\
@@ -95,12 +110,13 @@ interact (i)\n\
     sexpect interact [OPTION]\n\
 \n\
     Options:\n\
-        -lookback N | -lb N\n\
+        -lookback N[b|s] | -lb N[b|s]\n\
         -nodetach | -nodet\n\
         -cstring | -cstr | -c\n\
         -nocase | -icase | -i\n\
         -anchor-newline | -anchor\n\
         -re PATTERN\n\
+        -pcre PATTERN\n\
         <-subst | -sub> PATTERN::REPLACE\n\
 \n\
 wait (w)\n\
@@ -110,6 +126,9 @@ wait (w)\n\
 expect_out (expout, out)\n\
 ------------------------\n\
     sexpect expect_out [<-index | -i> INDEX]\n\
+    sexpect expect_out <-branch | -b>\n\
+    sexpect expect_out -offset\n\
+    sexpect expect_out -name NAME\n\
 \n\
 chkerr (chk, ck)\n\
 ----------------\n\
@@ -122,6 +141,14 @@ close (c)\n\
 ---------\n\
     sexpect close\n\
 \n\
+hub\n\
+---\n\
+    sexpect hub [OPTION]\n\
+\n\
+    Options:\n\
+        -idle N\n\
+        -workers N\n\
+\n\
 kill (k)\n\
 --------\n\
     sexpect kill [-SIGNAME] [-SIGNUM]\n\
@@ -136,6 +163,8 @@ set\n\
 \n\
     Options:\n\
         -autowait FLAG | -nowait FLAG\n\
+        -bufsize SIZE\n\
+        -history SIZE\n\
         -idle-close N | -idle N\n\
         -nonblock FLAG | -nb FLAG\n\
         -timeout N | -t N\n\
@@ -148,11 +177,14 @@ get\n\
     Options:\n\
         -all | -a\n\
         -autowait | -nowait\n\
+        -bufsize\n\
         <-expect-buf | -expbuf> N\n\
+        -history\n\
         -idle-close | -idle\n\
         -nonblock | -nb\n\
         -pid\n\
         -ppid\n\
+        -range OFFSET LENGTH\n\
         -tty | -pty | -pts\n\
         -timeout | -t\n\
         -ttl\n\
@@ -203,97 +235,171 @@ arg2uint(const char * s)
     return n;
 }
 
-static char *
-nextarg(char ** argv, char * prev_arg, int * cur_idx)
+/*
+ * A size in bytes with an optional K or M suffix (case-insensitive).
+ */
+static int
+arg2size(const char * s)
 {
-    if (argv[*cur_idx + 1] != NULL) {
-        ++(*cur_idx);
-        return argv[*cur_idx];
-    } else {
-        fatal(ERROR_USAGE, "%s requires an argument", prev_arg);
+    long lval;
+    char * pend = NULL;
+
+    if ( * s == '\0') {
+        fatal(ERROR_USAGE, "invalid size: %s", s);
     }
 
-    return NULL;
+    lval = strtol(s, & pend, 10);
+    if (str1of(pend, "k", "K", NULL) ) {
+        lval *= 1024;
+    } else if (str1of(pend, "m", "M", NULL) ) {
+        lval *= 1024 * 1024;
+    } else if (pend[0] != '\0') {
+        fatal(ERROR_USAGE, "invalid size: %s", s);
+    }
+
+    if (lval < 0 || lval > PASS_MAX_BUFSIZE) {
+        fatal(ERROR_USAGE, "out of range: %s", s);
+    }
+
+    return lval;
 }
 
-static char *
-readfd(int fd, int * plen)
+static int64_t
+arg2long(const char * s)
 {
-    int ret, limit;
-    char * buf = NULL;
+    long long llval;
+    char * pend = NULL;
 
-    limit = * plen;
-    if (limit <= 0) {
-        fatal(ERROR_USAGE, "#read must > 0");
+    if ( * s == '\0') {
+        fatal(ERROR_USAGE, "invalid number: %s", s);
     }
 
-    * plen = 0;
-
-    buf = malloc(limit + 1);
-    if (buf == NULL) {
-        fatal_sys("malloc(%d)", limit + 1);
+    errno = 0;
+    llval = strtoll(s, & pend, 10);
+    if (pend[0] != '\0') {
+        fatal(ERROR_USAGE, "invalid number: %s", s);
     }
-
-    ret = read(fd, buf, limit);
-    if (ret < 0) {
-        fatal_sys("read(#=%d)", limit);
-    } else {
-        buf[ret] = 0;
-        * plen = ret;
+    if (errno == ERANGE) {
+        fatal(ERROR_USAGE, "out of range: %s", s);
     }
 
-    return buf;
+    return llval;
 }
 
-static char *
-readfile(const char * fname, int * plen)
+/*
+ * -scrollback SIZE: with an optional K, M or G suffix, not limited by
+ * PASS_MAX_BUFSIZE since it's on disk.
+ */
+static int64_t
+arg2scrollback(const char * s)
 {
-    int fd, ret, limit;
-    char * buf = NULL;
-    struct stat st;
+    long long llval, unit = 1;
+    char * pend = NULL;
 
-    limit = * plen;
+    if ( * s == '\0') {
+        fatal(ERROR_USAGE, "invalid -scrollback: %s", s);
+    }
 
-    // stdin
-    if (limit == 0 && streq(fname, "-") ) {
-        fatal(ERROR_USAGE, "must specify -limit for non-regular file");
+    errno = 0;
+    llval = strtoll(s, & pend, 10);
+    if (str1of(pend, "k", "K", NULL) ) {
+        unit = 1024;
+    } else if (str1of(pend, "m", "M", NULL) ) {
+        unit = 1024 * 1024;
+    } else if (str1of(pend, "g", "G", NULL) ) {
+        unit = 1024 * 1024 * 1024;
+    } else if (pend[0] != '\0') {
+        fatal(ERROR_USAGE, "invalid -scrollback: %s", s);
+    }
 
-        // regular file
-    } else if (limit == 0 && ! streq(fname, "-") ) {
-        ret = stat(fname, & st);
-        if (ret < 0) {
-            fatal_sys("stat(%s)", fname);
-        }
+    if (errno == ERANGE || llval < 0 || llval > LLONG_MAX / unit) {
+        fatal(ERROR_USAGE, "invalid -scrollback: %s (out of range)", s);
+    }
 
-        if ( ! S_ISREG(st.st_mode) ) {
-            fatal(ERROR_USAGE, "must specify -limit for non-regular file");
-        }
+    return llval * unit;
+}
 
-        if (st.st_size > PASS_MAX_SEND) {
-            fatal(ERROR_USAGE,
-                  "file too large (%d > %d)", (int)st.st_size, PASS_MAX_SEND);
-        }
+/*
+ * -lookback N (lines), Nb (bytes) or Ns (seconds).
+ */
+static int
+arg2lookback(const char * s, int * unit)
+{
+    long lval;
+    char * pend = NULL;
 
-        limit = st.st_size;
+    if ( * s == '\0') {
+        fatal(ERROR_USAGE, "invalid lookback: %s", s);
     }
 
-    if (streq(fname, "-") ) {
-        fd = STDIN_FILENO;
+    lval = strtol(s, & pend, 10);
+    if (pend[0] == '\0') {
+        * unit = LOOKBACK_LINES;
+    } else if (str1of(pend, "b", "B", NULL) ) {
+        * unit = LOOKBACK_BYTES;
+    } else if (str1of(pend, "s", "S", NULL) ) {
+        * unit = LOOKBACK_SECS;
     } else {
-        fd = open(fname, O_RDONLY);
-        if (fd < 0) {
-            fatal_sys("open(%s)", fname);
-        }
+        fatal(ERROR_USAGE, "invalid lookback: %s", s);
+    }
+
+    if (lval < 0 || lval > INT_MAX) {
+        fatal(ERROR_USAGE, "out of range: %s", s);
+    }
+
+    return lval;
+}
+
+static char *
+nextarg(char ** argv, char * prev_arg, int * cur_idx)
+{
+    if (argv[*cur_idx + 1] != NULL) {
+        ++(*cur_idx);
+        return argv[*cur_idx];
+    } else {
+        fatal(ERROR_USAGE, "%s requires an argument", prev_arg);
     }
 
-    * plen = limit;
-    buf = readfd(fd, plen);
+    return NULL;
+}
 
-    if ( ! streq(fname, "-") ) {
-        close(fd);
+static void
+add_branch(struct st_pass * st, int type, char * pattern)
+{
+    if (st->nbranches >= MAX_BRANCH) {
+        fatal(ERROR_USAGE, "too many patterns (max %d)", MAX_BRANCH);
+    }
+#ifndef HAVE_PCRE2
+    if (type == PASS_EXPECT_PCRE) {
+        fatal(ERROR_USAGE, "-pcre is not supported (built without PCRE2)");
     }
+#endif
 
-    return buf;
+    st->branches[st->nbranches].type = type;
+    st->branches[st->nbranches].pattern = pattern;
+    st->branches[st->nbranches].patlen = strlen(pattern);
+    st->nbranches++;
+    st->expflags |= type;
+}
+
+/* -cstring. NUL bytes are only allowed if `binary'. */
+static char *
+pattern_unesc(char * in, int * plen, bool binary)
+{
+    char * pattern = NULL;
+    int len = 0;
+
+    strunesc(in, & pattern, & len);
+    if (pattern == NULL) {
+        fatal(ERROR_USAGE, "invalid backslash escapes: %s", in);
+    } else if (strlen(pattern) != len && ! binary) {
+        fatal(ERROR_USAGE, "pattern cannot include NULL bytes (except -raw -exact)");
+    }
+    if (plen != NULL) {
+        * plen = len;
+    }
+
+    return pattern;
 }
 
 static void
@@ -330,6 +436,10 @@ getargs(int argc, char **argv)
                 g.cmdopts.debug = true;
                 debug_on();
 
+                /* -session */
+            } else if (str1of(arg, "-session", "-S", NULL) ) {
+                g.cmdopts.session = nextarg(argv, arg, & i);
+
                 /* -sock */
             } else if (str1of(arg, "-sock", "-s", NULL) ) {
                 g.cmdopts.sockpath = nextarg(argv, arg, & i);
@@ -366,6 +476,10 @@ getargs(int argc, char **argv)
                     g.cmdopts.cmd = CMD_GET;
                     g.cmdopts.get.get_all = true;
 
+                    /* hub */
+                } else if (str1of(arg, "hub", NULL) ) {
+                    g.cmdopts.cmd = CMD_HUB;
+
                     /* interact */
                 } else if (str1of(arg, "interact", "i", NULL) ) {
                     g.cmdopts.cmd = CMD_INTERACT;
@@ -394,6 +508,8 @@ getargs(int argc, char **argv)
                     g.cmdopts.cmd = CMD_SPAWN;
                     g.cmdopts.spawn.def_timeout = PASS_DEF_TMOUT;
                     g.cmdopts.spawn.zombie_idle = PASS_DEF_ZOMBIE_TTL;
+                    g.cmdopts.spawn.bufsize = PASS_DEF_BUFSIZE;
+                    g.cmdopts.spawn.history = PASS_DEF_HISTORY;
                     g.cmdopts.spawn.logfd = -1;
 
                     /* wait */
@@ -431,22 +547,34 @@ getargs(int argc, char **argv)
             /* expect */
         } else if (streq(g.cmdopts.cmd, CMD_EXPECT) ) {
             struct st_pass * st = & g.cmdopts.pass;
-            if (str1of(arg, "-exact", "-ex", "-re", "-glob", "-gl", NULL) ) {
+            if (str1of(arg, "-exact", "-ex", "-re", "-pcre", "-glob", "-gl", NULL) ) {
                 next = nextarg(argv, arg, & i);
-                st->pattern = next;
                 if (str1of(arg, "-exact", "-ex", NULL) ) {
-                    st->expflags |= PASS_EXPECT_EXACT;
+                    add_branch(st, PASS_EXPECT_EXACT, next);
                 } else if (streq(arg, "-re") ) {
-                    st->expflags |= PASS_EXPECT_ERE;
+                    add_branch(st, PASS_EXPECT_ERE, next);
+                } else if (streq(arg, "-pcre") ) {
+                    add_branch(st, PASS_EXPECT_PCRE, next);
                 } else if (str1of(arg, "-glob", "-gl", NULL) ) {
-                    st->expflags |= PASS_EXPECT_GLOB;
+                    add_branch(st, PASS_EXPECT_GLOB, next);
                 }
             } else if (OPT_nocase(arg) ) {
                 st->expflags |= PASS_EXPECT_ICASE;
             } else if (OPT_anchor(arg) ) {
                 st->expflags |= PASS_EXPECT_NEWLINE;
+            } else if (streq(arg, "-engine") ) {
+                next = nextarg(argv, arg, & i);
+                if (streq(next, "dfa") ) {
+                    st->expflags |= PASS_EXPECT_DFA;
+                } else if (streq(next, "posix") ) {
+                    st->expflags &= ~PASS_EXPECT_DFA;
+                } else {
+                    fatal(ERROR_USAGE, "unknown regex engine: %s", next);
+                }
             } else if (OPT_cstring(arg) ) {
                 st->cstring = true;
+            } else if (streq(arg, "-raw") ) {
+                st->expflags |= PASS_EXPECT_RAW;
             } else if (streq(arg, "-eof") ) {
                 st->expflags |= PASS_EXPECT_EOF;
             } else if (str1of(arg, "-timeout", "-t", NULL) ) {
@@ -457,17 +585,24 @@ getargs(int argc, char **argv)
                 }
             } else if (OPT_lookback(arg) ) {
                 next = nextarg(argv, arg, & i);
-                g.cmdopts.pass.lookback = arg2uint(next);
+                g.cmdopts.pass.lookback = arg2lookback(next,
+                                              & g.cmdopts.pass.lookback_unit);
+            } else if (str1of(arg, "-from", "-since", NULL) ) {
+                st->has_from = streq(arg, "-from");
+                st->has_since = ! st->has_from;
+                st->from = arg2long(nextarg(argv, arg, & i) );
+                if (st->from < 0) {
+                    fatal(ERROR_USAGE, "out of range: %lld", (long long) st->from);
+                }
             } else if (arg[0] == '-') {
                 fatal(ERROR_USAGE, "unknown expect option: %s", arg);
             } else if (arg[0] == '\0') {
                 fatal(ERROR_USAGE, "pattern cannot be empty");
-            } else if ( (st->expflags & PASS_EXPECT_EXACT) != 0) {
+            } else if (st->nbranches > 0) {
                 unexpected_arg = true;
                 break;
             } else {
-                st->pattern = arg;
-                st->expflags |= PASS_EXPECT_EXACT;
+                add_branch(st, PASS_EXPECT_EXACT, arg);
             }
 
             /* expect_out */
@@ -475,6 +610,12 @@ getargs(int argc, char **argv)
             if (str1of(arg, "-index", "-i", NULL) ) {
                 next = nextarg(argv, arg, & i);
                 g.cmdopts.expout.index = arg2uint(next);
+            } else if (str1of(arg, "-branch", "-b", NULL) ) {
+                g.cmdopts.expout.branch = true;
+            } else if (streq(arg, "-offset") ) {
+                g.cmdopts.expout.offset = true;
+            } else if (streq(arg, "-name") ) {
+                g.cmdopts.expout.name = nextarg(argv, arg, & i);
             } else {
                 unexpected_arg = true;
                 break;
@@ -513,6 +654,18 @@ getargs(int argc, char **argv)
                     g.cmdopts.get.get_ttl = true;
                 } else if (str1of(arg, "-idle-close", "-idle", NULL) ) {
                     g.cmdopts.get.get_idle = true;
+                } else if (streq(arg, "-bufsize") ) {
+                    g.cmdopts.get.get_bufsize = true;
+                } else if (streq(arg, "-history") ) {
+                    g.cmdopts.get.get_history = true;
+                } else if (streq(arg, "-range") ) {
+                    g.cmdopts.get.get_range = true;
+                    g.cmdopts.get.range_off = arg2long(nextarg(argv, arg, & i) );
+                    g.cmdopts.get.range_len = arg2long(nextarg(argv, arg, & i) );
+                    if (g.cmdopts.get.range_len < 0) {
+                        fatal(ERROR_USAGE, "out of range: %lld",
+                              (long long) g.cmdopts.get.range_len);
+                    }
                 } else if (str1of(arg, "-expect-buf", "-expbuf", NULL) ) {
                     int num;
                     next = nextarg(argv, arg, & i);
@@ -533,13 +686,27 @@ getargs(int argc, char **argv)
             unexpected_arg = true;
             break;
 
+            /* hub */
+        } else if (streq(g.cmdopts.cmd, CMD_HUB) ) {
+            if (streq(arg, "-workers") ) {
+                g.cmdopts.hub.workers = arg2uint(nextarg(argv, arg, & i) );
+            } else if (streq(arg, "-idle") ) {
+                g.cmdopts.hub.idle = arg2uint(nextarg(argv, arg, & i) );
+            } else {
+                unexpected_arg = true;
+                break;
+            }
+
             /* interact */
         } else if (streq(g.cmdopts.cmd, CMD_INTERACT) ) {
             struct st_pass * st = & g.cmdopts.pass;
-            if (str1of(arg, "-re", NULL) ) {
+            if (str1of(arg, "-re", "-pcre", NULL) ) {
                 next = nextarg(argv, arg, & i);
-                st->pattern = next;
-                st->expflags |= PASS_EXPECT_ERE;
+                /* only one pattern for interact */
+                st->nbranches = 0;
+                st->expflags &= ~(PASS_EXPECT_ERE | PASS_EXPECT_PCRE);
+                add_branch(st, streq(arg, "-re") ? PASS_EXPECT_ERE : PASS_EXPECT_PCRE,
+                           next);
             } else if (OPT_nocase(arg) ) {
                 st->expflags |= PASS_EXPECT_ICASE;
             } else if (OPT_anchor(arg) ) {
@@ -548,7 +715,8 @@ getargs(int argc, char **argv)
                 st->cstring = true;
             } else if (OPT_lookback(arg) ) {
                 next = nextarg(argv, arg, & i);
-                g.cmdopts.pass.lookback = arg2uint(next);
+                g.cmdopts.pass.lookback = arg2lookback(next,
+                                              & g.cmdopts.pass.lookback_unit);
             } else if (str1of(arg, "-nodetach", "-nodet", "-nod", NULL) ) {
                 g.cmdopts.pass.no_detach = true;
             } else if (str1of(arg, "-subst", "-sub", NULL) ) {
@@ -583,6 +751,8 @@ getargs(int argc, char **argv)
                 st->enter = true;
             } else if (str1of(arg, "-strip", NULL) ) {
                 st->strip = true;
+            } else if (streq(arg, "-offset") ) {
+                st->offset = true;
             } else if (str1of(arg, "-env", "-var", NULL) ) {
                 st->sources += 1;
                 st->envvar = nextarg(argv, arg, & i);
@@ -597,8 +767,8 @@ getargs(int argc, char **argv)
             } else if (str1of(arg, "-limit", NULL) ) {
                 next = nextarg(argv, arg, & i);
                 st->limit = arg2uint(next);
-                if (st->limit <= 0 || st->limit > PASS_MAX_SEND) {
-                    fatal(ERROR_USAGE, "limit must be in [0, %d]", PASS_MAX_SEND);
+                if (st->limit <= 0) {
+                    fatal(ERROR_USAGE, "limit must be > 0");
                 }
             } else if (streq(arg, "--" ) ) {
                 st->sources += 1;
@@ -683,6 +853,12 @@ getargs(int argc, char **argv)
                 if (st->idle < 0) {
                     st->idle = 0;
                 }
+            } else if (streq(arg, "-bufsize") ) {
+                st->set_bufsize = true;
+                st->bufsize = arg2size(nextarg(argv, arg, & i) );
+            } else if (streq(arg, "-history") ) {
+                st->set_history = true;
+                st->history = arg2size(nextarg(argv, arg, & i) );
             } else {
                 unexpected_arg = true;
                 break;
@@ -730,6 +906,22 @@ getargs(int argc, char **argv)
                               /* DEPRECATED. It really does not mean TTL. */
                               "-zombie-ttl", "-zttl", NULL) ) {
                 st->zombie_idle = arg2int(nextarg(argv, arg, & i) );
+            } else if (streq(arg, "-bufsize") ) {
+                st->bufsize = arg2size(nextarg(argv, arg, & i) );
+            } else if (streq(arg, "-history") ) {
+                st->history = arg2size(nextarg(argv, arg, & i) );
+            } else if (streq(arg, "-sendq") ) {
+                st->sendq = arg2size(nextarg(argv, arg, & i) );
+            } else if (streq(arg, "-scrollback") ) {
+                /* a size, or a file which keeps everything */
+                next = nextarg(argv, arg, & i);
+                if (strmatch(next, "^[0-9]+[kKmMgG]?$") ) {
+                    st->scrollback = arg2scrollback(next);
+                    st->scrollback_file = NULL;
+                } else {
+                    st->scrollback = 0;
+                    st->scrollback_file = next;
+                }
             } else if (arg[0] == '-') {
                 fatal(ERROR_USAGE, "unknown spawn option: %s", arg);
             } else {
@@ -747,7 +939,8 @@ getargs(int argc, char **argv)
         } else if (streq(g.cmdopts.cmd, CMD_WAIT) ) {
             if (OPT_lookback(arg) ) {
                 next = nextarg(argv, arg, & i);
-                g.cmdopts.pass.lookback = arg2uint(next);
+                g.cmdopts.pass.lookback = arg2lookback(next,
+                                              & g.cmdopts.pass.lookback_unit);
             } else {
                 unexpected_arg = true;
                 break;
@@ -766,42 +959,41 @@ getargs(int argc, char **argv)
     /* expect */
     if (streq(g.cmdopts.cmd, CMD_EXPECT) ) {
         struct st_pass * st = & g.cmdopts.pass;
-        int flags = st->expflags & (PASS_EXPECT_EOF | PASS_EXPECT_EXACT
-                                    | PASS_EXPECT_ERE | PASS_EXPECT_GLOB);
-        if (count1bits(flags) > 1) {
-            fatal(ERROR_USAGE, "-eof, -exact, -glob and -re are exclusive");
+        struct st_branch * br;
+        int n;
+
+        if ( (st->expflags & PASS_EXPECT_EOF) && st->nbranches > 0) {
+            fatal(ERROR_USAGE, "-eof cannot be used with patterns");
+        }
+        if ( (st->expflags & PASS_EXPECT_NEWLINE)
+             && ! (st->expflags & (PASS_EXPECT_ERE | PASS_EXPECT_PCRE) ) ) {
+            fatal(ERROR_USAGE, "-anchor-newline is only for -re and -pcre");
+        }
+        if ( (st->expflags & PASS_EXPECT_DFA)
+             && ! (st->expflags & (PASS_EXPECT_ERE | PASS_EXPECT_GLOB) ) ) {
+            fatal(ERROR_USAGE, "-engine is only for -re and -glob");
         }
-        if ( (st->expflags & PASS_EXPECT_NEWLINE) && ! (st->expflags & PASS_EXPECT_ERE) ) {
-            fatal(ERROR_USAGE, "-anchor-newline is only for -re");
+        if ( (st->expflags & PASS_EXPECT_RAW) && st->nbranches == 0) {
+            fatal(ERROR_USAGE, "-raw cannot be used without patterns");
         }
 
-        if (st->pattern != NULL) {
+        for (n = 0; n < st->nbranches; ++n) {
+            br = & st->branches[n];
             if (st->cstring) {
-                char * pattern = NULL;
-                int len = 0;
-                strunesc(st->pattern, & pattern, & len);
-                if (pattern == NULL) {
-                    fatal(ERROR_USAGE, "invalid backslash escapes: %s", st->pattern);
-                } else if (strlen(pattern) != len) {
-                    fatal(ERROR_USAGE, "pattern cannot include NULL bytes");
-                } else {
-                    st->pattern = pattern;
-                }
+                br->pattern = pattern_unesc(br->pattern, & br->patlen,
+                    br->type == PASS_EXPECT_EXACT
+                    && (st->expflags & PASS_EXPECT_RAW) != 0);
             }
-            if (strlen(st->pattern) ==  0) {
+            if (br->patlen ==  0) {
                 fatal(ERROR_USAGE, "pattern cannot be empty");
             }
-            /* glob2re */
-            if ((st->expflags & PASS_EXPECT_GLOB) != 0) {
-                char * re_str = glob2re(st->pattern, & re_str, NULL);
-                if (re_str == NULL) {
-                    fatal(ERROR_USAGE, "invalid glob pattern: `%s'", st->pattern);
+            /* the server matches globs itself, just check the syntax */
+            if (br->type == PASS_EXPECT_GLOB) {
+                globmatch_t * gm = gm_compile(br->pattern, false);
+                if (gm == NULL) {
+                    fatal(ERROR_USAGE, "invalid glob pattern: `%s'", br->pattern);
                 }
-
-                debug("glob2re: ``%s'' --> ``%s''", st->pattern, re_str);
-                st->pattern = re_str;
-                st->expflags &= ~PASS_EXPECT_GLOB;
-                st->expflags |= PASS_EXPECT_ERE;
+                gm_free(gm);
             }
         }
 
@@ -813,20 +1005,13 @@ getargs(int argc, char **argv)
     } else if (streq(g.cmdopts.cmd, CMD_INTERACT) ) {
         struct st_pass * st = & g.cmdopts.pass;
 
-        if (st->pattern != NULL) {
+        if (st->nbranches > 0) {
             if (st->cstring) {
-                char * pattern = NULL;
-                int len = 0;
-                strunesc(st->pattern, & pattern, & len);
-                if (pattern == NULL) {
-                    fatal(ERROR_USAGE, "invalid backslash escapes: %s", st->pattern);
-                } else if (strlen(pattern) != len) {
-                    fatal(ERROR_USAGE, "pattern cannot include NULL bytes");
-                } else {
-                    st->pattern = pattern;
-                }
+                st->branches[0].pattern = pattern_unesc(st->branches[0].pattern,
+                                                        & st->branches[0].patlen,
+                                                        false);
             }
-            if (strlen(st->pattern) ==  0) {
+            if (strlen(st->branches[0].pattern) ==  0) {
                 fatal(ERROR_USAGE, "pattern cannot be empty");
             }
         }
@@ -868,24 +1053,15 @@ getargs(int argc, char **argv)
                 st->len = strlen(st->data);
             }
 
-            // -file FILE [-limit LIMIT]
+            // -file FILE [-limit LIMIT]. The client streams it to the
+            // server, as with -fd.
         } else if (st->filename != NULL) {
-            st->len = st->limit;
-            st->data = readfile(st->filename, & st->len);
-
-            // -file FILE -limit LIMIT
-        } else if (st->has_fd) {
-            if (st->limit <= 0) {
-                fatal(ERROR_USAGE, "-limit must be specified for -fd");
+            if (streq(st->filename, "-") ) {
+                st->fd = STDIN_FILENO;
+            } else if ( (st->fd = open(st->filename, O_RDONLY) ) < 0) {
+                fatal_sys("open(%s)", st->filename);
             }
-            st->len = st->limit;
-            st->data = readfd(st->fd, & st->len);
-        }
-
-        // -strip
-        if ( (st->filename || st->has_fd) && st->strip) {
-            str_rstrip(st->data);
-            st->len = strlen(st->data);
+            st->has_fd = true;
         }
 
         // This is necessary or `send -cr' alone would not work.
@@ -894,13 +1070,17 @@ getargs(int argc, char **argv)
             st->len = 0;
         }
 
-        if (st->len > PASS_MAX_SEND) {
-            fatal(ERROR_USAGE, "send: string length must be < %d", PASS_MAX_SEND);
-        }
-
         /* spawn */
-    } else if (streq(g.cmdopts.cmd, CMD_SPAWN) && g.cmdopts.spawn.argv == NULL) {
-        fatal(ERROR_USAGE, "spawn requires more arguments");
+    } else if (streq(g.cmdopts.cmd, CMD_SPAWN) ) {
+        struct st_spawn * st = & g.cmdopts.spawn;
+        char * errmsg;
+
+        if (st->argv == NULL) {
+            fatal(ERROR_USAGE, "spawn requires more arguments");
+        }
+        if ( (errmsg = bufsize_check(st->bufsize, st->history) ) != NULL) {
+            fatal(ERROR_USAGE, "%s", errmsg);
+        }
 
         /* version */
     } else if (streq(g.cmdopts.cmd, CMD_VERSION) ) {
@@ -912,6 +1092,16 @@ getargs(int argc, char **argv)
     if (g.cmdopts.sockpath == NULL) {
         g.cmdopts.sockpath = getenv("SEXPECT_SOCKFILE");
     }
+    /* $SEXPECT_SESSION */
+    if (g.cmdopts.session == NULL) {
+        g.cmdopts.session = getenv("SEXPECT_SESSION");
+    }
+    if (g.cmdopts.session != NULL && g.cmdopts.session[0] == '\0') {
+        g.cmdopts.session = NULL;
+    }
+    if (g.cmdopts.session != NULL && streq(g.cmdopts.cmd, CMD_HUB) ) {
+        fatal(ERROR_USAGE, "-session cannot be used with hub");
+    }
     /* most commands require ``-sock'' */
     if (g.cmdopts.sockpath == NULL && ! streq(g.cmdopts.cmd, CMD_CHKERR) ) {
         fatal(ERROR_USAGE, "-sock not specified");
@@ -939,7 +1129,9 @@ main(int argc, char *argv[])
 
     getargs(argc, argv);
 
-    if (streq(g.cmdopts.cmd, CMD_SPAWN) ) {
+    if (streq(g.cmdopts.cmd, CMD_HUB) ) {
+        hub_main( & g.cmdopts);
+    } else if (streq(g.cmdopts.cmd, CMD_SPAWN) && g.cmdopts.session == NULL) {
         serv_main( & g.cmdopts);
     } else {
         cli_main( & g.cmdopts);
@@ -0,0 +1,317 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "memsearch.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MS_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define ms_tolower(c)   ( (c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c) )
+#define ms_toupper(c)   ( (c) >= 'a' && (c) <= 'z' ? (c) - ('a' - 'A') : (c) )
+
+int
+ms_best_level(void)
+{
+    static int level = -1;
+
+    if (level >= 0) {
+        return level;
+    }
+
+    level = MS_SCALAR;
+#ifdef MS_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") ) {
+        level = MS_AVX2;
+    } else if (__builtin_cpu_supports("sse2") ) {
+        level = MS_SSE2;
+    }
+#endif
+
+    return level;
+}
+
+/*
+ * A rough guess of how common a byte is in terminal output. The higher the
+ * more common.
+ */
+static int
+ms_rank(int c)
+{
+    if ( (c >= 'a' && c <= 'z') || c == ' ') {
+        return 3;
+    } else if ( (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+               || c == '\n' || c == '\r') {
+        return 2;
+    } else if (strchr("./-_:,=", c) != NULL) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+void
+ms_init(memsearch_t * ms, const char * needle, int len, bool icase)
+{
+    int i, k, c;
+
+    if (len <= 0) {
+        bug("empty needle");
+    }
+
+    memset(ms, 0, sizeof(* ms) );
+    ms->needle = malloc(len + 1);
+    if (ms->needle == NULL) {
+        fatal_sys("malloc");
+    }
+    for (i = 0; i < len; ++i) {
+        ms->needle[i] = icase ? ms_tolower(needle[i]) : needle[i];
+    }
+    ms->needle[len] = '\0';
+    ms->len = len;
+    ms->icase = icase;
+    ms->level = ms_best_level();
+
+    /* the rarest byte, and the rarest of the rest (the later the better
+     * so they are apart) */
+    for (i = 1; i < len; ++i) {
+        if (ms_rank( (uint8_t) ms->needle[i]) < ms_rank( (uint8_t) ms->needle[ms->pos[0]]) ) {
+            ms->pos[0] = i;
+        }
+    }
+    ms->pos[1] = ms->pos[0] == len - 1 ? 0 : len - 1;
+    for (i = len - 1; i >= 0; --i) {
+        if (i != ms->pos[0]
+            && ms_rank( (uint8_t) ms->needle[i]) < ms_rank( (uint8_t) ms->needle[ms->pos[1]]) ) {
+            ms->pos[1] = i;
+        }
+    }
+
+    for (k = 0; k < 2; ++k) {
+        c = (uint8_t) ms->needle[ms->pos[k]];
+        ms->rare[k][0] = c;
+        ms->rare[k][1] = icase ? ms_toupper(c) : c;
+    }
+}
+
+void
+ms_free(memsearch_t * ms)
+{
+    free(ms->needle);
+    ms->needle = NULL;
+}
+
+static inline bool
+ms_verify(const memsearch_t * ms, const char * p)
+{
+    const uint8_t * s = (const uint8_t *) p;
+    int i;
+
+    if ( ! ms->icase) {
+        return memcmp(p, ms->needle, ms->len) == 0;
+    }
+
+    for (i = 0; i < ms->len; ++i) {
+        if (ms_tolower(s[i]) != (uint8_t) ms->needle[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int
+ms_find_scalar(const memsearch_t * ms, const char * hay, int haylen, int start)
+{
+    const uint8_t * s = (const uint8_t *) hay;
+    const char * p;
+    int i, last = haylen - ms->len;
+    int pos0 = ms->pos[0], pos1 = ms->pos[1];
+
+    if ( ! ms->icase) {
+        for (i = start; i <= last; i = p - hay - pos0 + 1) {
+            p = memchr(hay + i + pos0, ms->rare[0][0], last - i + 1);
+            if (p == NULL) {
+                break;
+            }
+            if ( (uint8_t) p[pos1 - pos0] == ms->rare[1][0]
+                 && ms_verify(ms, p - pos0) ) {
+                return p - hay - pos0;
+            }
+        }
+        return -1;
+    }
+
+    for (i = start; i <= last; ++i) {
+        if ( (s[i + pos0] == ms->rare[0][0] || s[i + pos0] == ms->rare[0][1])
+             && (s[i + pos1] == ms->rare[1][0] || s[i + pos1] == ms->rare[1][1])
+             && ms_verify(ms, hay + i) ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+#ifdef MS_HAVE_X86
+/*
+ * Bit N of the result is set if both rare bytes match for a needle at N,
+ * i.e. p0[N] == r0 and p1[N] == r1.
+ */
+__attribute__((target("sse2")))
+static inline uint32_t
+ms_block_sse2(const char * p0, const char * p1, __m128i r0, __m128i r1)
+{
+    __m128i b0 = _mm_loadu_si128( (const __m128i *) p0);
+    __m128i b1 = _mm_loadu_si128( (const __m128i *) p1);
+
+    return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(b0, r0), _mm_cmpeq_epi8(b1, r1) ) );
+}
+
+/* same as above but either case matches */
+__attribute__((target("sse2")))
+static inline uint32_t
+ms_block_sse2_icase(const char * p0, const char * p1,
+                    __m128i r0, __m128i r0x, __m128i r1, __m128i r1x)
+{
+    __m128i b0 = _mm_loadu_si128( (const __m128i *) p0);
+    __m128i b1 = _mm_loadu_si128( (const __m128i *) p1);
+
+    return _mm_movemask_epi8(_mm_and_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(b0, r0), _mm_cmpeq_epi8(b0, r0x) ),
+            _mm_or_si128(_mm_cmpeq_epi8(b1, r1), _mm_cmpeq_epi8(b1, r1x) ) ) );
+}
+
+__attribute__((target("sse2")))
+static int
+ms_find_sse2(const memsearch_t * ms, const char * hay, int haylen)
+{
+    const __m128i r0  = _mm_set1_epi8(ms->rare[0][0]);
+    const __m128i r0x = _mm_set1_epi8(ms->rare[0][1]);
+    const __m128i r1  = _mm_set1_epi8(ms->rare[1][0]);
+    const __m128i r1x = _mm_set1_epi8(ms->rare[1][1]);
+    const char * h0 = hay + ms->pos[0];
+    const char * h1 = hay + ms->pos[1];
+    int i, bit, end = haylen - ms->len + 1;
+    uint32_t mask;
+
+    /* two blocks at a time as candidates are rare */
+    if (ms->icase) {
+        for (i = 0; i + 32 <= end; i += 32) {
+            mask = ms_block_sse2_icase(h0 + i, h1 + i, r0, r0x, r1, r1x)
+                   | ms_block_sse2_icase(h0 + i + 16, h1 + i + 16, r0, r0x, r1, r1x) << 16;
+            for ( ; mask != 0; mask &= mask - 1) {
+                bit = __builtin_ctz(mask);
+                if (ms_verify(ms, hay + i + bit) ) {
+                    return i + bit;
+                }
+            }
+        }
+    } else {
+        for (i = 0; i + 32 <= end; i += 32) {
+            mask = ms_block_sse2(h0 + i, h1 + i, r0, r1)
+                   | ms_block_sse2(h0 + i + 16, h1 + i + 16, r0, r1) << 16;
+            for ( ; mask != 0; mask &= mask - 1) {
+                bit = __builtin_ctz(mask);
+                if (ms_verify(ms, hay + i + bit) ) {
+                    return i + bit;
+                }
+            }
+        }
+    }
+
+    return ms_find_scalar(ms, hay, haylen, i);
+}
+
+/*
+ * Bit N of the result is set if both rare bytes match for a needle at N,
+ * i.e. p0[N] == r0 and p1[N] == r1.
+ */
+__attribute__((target("avx2")))
+static inline uint32_t
+ms_block_avx2(const char * p0, const char * p1, __m256i r0, __m256i r1)
+{
+    __m256i b0 = _mm256_loadu_si256( (const __m256i *) p0);
+    __m256i b1 = _mm256_loadu_si256( (const __m256i *) p1);
+
+    return _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(b0, r0), _mm256_cmpeq_epi8(b1, r1) ) );
+}
+
+/* same as above but either case matches */
+__attribute__((target("avx2")))
+static inline uint32_t
+ms_block_avx2_icase(const char * p0, const char * p1,
+                    __m256i r0, __m256i r0x, __m256i r1, __m256i r1x)
+{
+    __m256i b0 = _mm256_loadu_si256( (const __m256i *) p0);
+    __m256i b1 = _mm256_loadu_si256( (const __m256i *) p1);
+
+    return _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(b0, r0), _mm256_cmpeq_epi8(b0, r0x) ),
+            _mm256_or_si256(_mm256_cmpeq_epi8(b1, r1), _mm256_cmpeq_epi8(b1, r1x) ) ) );
+}
+
+__attribute__((target("avx2")))
+static int
+ms_find_avx2(const memsearch_t * ms, const char * hay, int haylen)
+{
+    const __m256i r0  = _mm256_set1_epi8(ms->rare[0][0]);
+    const __m256i r0x = _mm256_set1_epi8(ms->rare[0][1]);
+    const __m256i r1  = _mm256_set1_epi8(ms->rare[1][0]);
+    const __m256i r1x = _mm256_set1_epi8(ms->rare[1][1]);
+    const char * h0 = hay + ms->pos[0];
+    const char * h1 = hay + ms->pos[1];
+    int i, bit, end = haylen - ms->len + 1;
+    uint64_t mask;
+
+    /* two blocks at a time as candidates are rare */
+    if (ms->icase) {
+        for (i = 0; i + 64 <= end; i += 64) {
+            mask = ms_block_avx2_icase(h0 + i, h1 + i, r0, r0x, r1, r1x)
+                   | (uint64_t) ms_block_avx2_icase(h0 + i + 32, h1 + i + 32, r0, r0x, r1, r1x) << 32;
+            for ( ; mask != 0; mask &= mask - 1) {
+                bit = __builtin_ctzll(mask);
+                if (ms_verify(ms, hay + i + bit) ) {
+                    return i + bit;
+                }
+            }
+        }
+    } else {
+        for (i = 0; i + 64 <= end; i += 64) {
+            mask = ms_block_avx2(h0 + i, h1 + i, r0, r1)
+                   | (uint64_t) ms_block_avx2(h0 + i + 32, h1 + i + 32, r0, r1) << 32;
+            for ( ; mask != 0; mask &= mask - 1) {
+                bit = __builtin_ctzll(mask);
+                if (ms_verify(ms, hay + i + bit) ) {
+                    return i + bit;
+                }
+            }
+        }
+    }
+
+    return ms_find_scalar(ms, hay, haylen, i);
+}
+#endif
+
+/*
+ * RETURN: offset of the first occurrence of the needle in `hay', or -1.
+ */
+int
+ms_find(const memsearch_t * ms, const char * hay, int haylen)
+{
+    switch (ms->level) {
+#ifdef MS_HAVE_X86
+    case MS_AVX2:
+        return ms_find_avx2(ms, hay, haylen);
+    case MS_SSE2:
+        return ms_find_sse2(ms, hay, haylen);
+#endif
+    default:
+        return ms_find_scalar(ms, hay, haylen, 0);
+    }
+}
@@ -0,0 +1,41 @@
+
+#ifndef MEMSEARCH_H__
+#define MEMSEARCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Substring search for expect -exact (with or without -nocase), and for the
+ * literal strings -re patterns require.
+ *
+ * The needle is prepared once and then searched for with SIMD (SSE2 or
+ * AVX2, picked at runtime) where available: two of the needle's bytes
+ * which are (guessed to be) rare in terminal output are compared against
+ * a whole block of the haystack at once and only the candidates are
+ * verified byte by byte.
+ *
+ * Only the C locale is supported, i.e. -nocase folds ASCII letters only.
+ */
+
+enum {
+    MS_SCALAR = 0,
+    MS_SSE2,
+    MS_AVX2,
+};
+
+typedef struct memsearch {
+    char  * needle;
+    int     len;
+    bool    icase;
+    int     level;      /* MS_SCALAR, ... */
+    int     pos[2];     /* where the two rare bytes are in the needle */
+    uint8_t rare[2][2]; /* the rare bytes, and in the other case for -nocase */
+} memsearch_t;
+
+int  ms_best_level(void);
+void ms_init(memsearch_t * ms, const char * needle, int len, bool icase);
+void ms_free(memsearch_t * ms);
+int  ms_find(const memsearch_t * ms, const char * hay, int haylen);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "memsearch.h"
+#include "nulstrip.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NS_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+static int
+ns_strip_scalar(char * dst, const char * src, int len)
+{
+    int i, n = 0;
+
+    for (i = 0; i < len; ++i) {
+        if (src[i] != '\0') {
+            dst[n++] = src[i];
+        }
+    }
+
+    return n;
+}
+
+#ifdef NS_HAVE_X86
+/*
+ * Stores are never ahead of what's been loaded (`n' <= `i') so this works
+ * in place.
+ */
+__attribute__((target("sse2")))
+static int
+ns_strip_sse2(char * dst, const char * src, int len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i b;
+    uint32_t mask;
+    int i, n = 0;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        b = _mm_loadu_si128( (const __m128i *) (src + i) );
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(b, zero) );
+        if (mask == 0) {
+            _mm_storeu_si128( (__m128i *) (dst + n), b);
+            n += 16;
+        } else if (mask != 0xffff) {
+            for (mask = ~mask & 0xffff; mask != 0; mask &= mask - 1) {
+                dst[n++] = src[i + __builtin_ctz(mask)];
+            }
+        }
+    }
+
+    return n + ns_strip_scalar(dst + n, src + i, len - i);
+}
+
+/*
+ * For each 8-bit mask of NULs in 8 bytes, the pshufb indices which move
+ * the other bytes to the front.
+ */
+static uint64_t ns_shuffle[256];
+
+static void
+ns_init_shuffle(void)
+{
+    int m, j, k;
+    uint64_t idx;
+
+    for (m = 0; m < 256; ++m) {
+        idx = ~ (uint64_t) 0;   /* 0x80: zero */
+        for (j = k = 0; j < 8; ++j) {
+            if ( (m & (1 << j) ) == 0) {
+                idx &= ~ ( (uint64_t) 0xff << (8 * k) );
+                idx |= (uint64_t) j << (8 * k);
+                ++k;
+            }
+        }
+        ns_shuffle[m] = idx;
+    }
+}
+
+__attribute__((target("avx2")))
+static int
+ns_strip_avx2(char * dst, const char * src, int len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i b;
+    __m128i lane;
+    uint32_t mask, m8;
+    int i, k, n = 0;
+
+    if (ns_shuffle[255] == 0) {
+        ns_init_shuffle();
+    }
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        b = _mm256_loadu_si256( (const __m256i *) (src + i) );
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, zero) );
+        if (mask == 0) {
+            _mm256_storeu_si256( (__m256i *) (dst + n), b);
+            n += 32;
+        } else if (mask != 0xffffffff) {
+            for (k = 0; k < 4; ++k) {
+                m8 = (mask >> (8 * k) ) & 0xff;
+                lane = _mm_loadl_epi64( (const __m128i *) (src + i + 8 * k) );
+                lane = _mm_shuffle_epi8(lane, _mm_cvtsi64_si128(ns_shuffle[m8]) );
+                _mm_storel_epi64( (__m128i *) (dst + n), lane);
+                n += 8 - __builtin_popcount(m8);
+            }
+        }
+    }
+
+    return n + ns_strip_scalar(dst + n, src + i, len - i);
+}
+#endif
+
+/*
+ * RETURN: # of bytes copied to `dst'.
+ */
+int
+ns_strip_level(char * dst, const char * src, int len, int level)
+{
+    switch (level) {
+#ifdef NS_HAVE_X86
+    case MS_AVX2:
+        return ns_strip_avx2(dst, src, len);
+    case MS_SSE2:
+        return ns_strip_sse2(dst, src, len);
+#endif
+    default:
+        return ns_strip_scalar(dst, src, len);
+    }
+}
+
+int
+ns_strip(char * dst, const char * src, int len)
+{
+    const char * p;
+    int n;
+
+    p = memchr(src, '\0', len);
+    if (p == NULL) {
+        memmove(dst, src, len);
+        return len;
+    }
+
+    n = p - src;
+    memmove(dst, src, n);
+    return n + ns_strip_level(dst + n, p, len - n, ms_best_level() );
+}
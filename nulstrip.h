@@ -0,0 +1,19 @@
+#ifndef NULSTRIP_H__
+#define NULSTRIP_H__
+
+/*
+ * Copy output with the NUL bytes removed, for matching patterns.
+ *
+ * Data without NULs (the usual case) is found with memchr() and just
+ * memcpy()'ed. Otherwise blocks are checked for NULs with SSE2 or AVX2
+ * (picked at runtime, see ms_best_level()): blocks without NULs are
+ * stored as is and, with AVX2, the others are compacted 8 bytes at a time
+ * with a shuffle.
+ *
+ * `dst' must have room for `len' bytes and may be `src' (in place).
+ */
+
+int ns_strip(char * dst, const char * src, int len);
+int ns_strip_level(char * dst, const char * src, int len, int level);
+
+#endif
@@ -12,6 +12,9 @@
 
 #include "proto.h"
 
+/* see ttlv_arena_free() */
+static __thread ttlv_arena_t * g_spare_arena = NULL;
+
 uint64_t
 _htonll(uint64_t n)
 {
@@ -42,15 +45,93 @@ _ntohll(uint64_t n)
     }
 }
 
+ttlv_arena_t *
+ttlv_arena_new(uint32_t size)
+{
+    ttlv_arena_t * arena;
+
+    if (size < TTLV_ARENA_SIZE) {
+        size = TTLV_ARENA_SIZE;
+    }
+
+    if (size == TTLV_ARENA_SIZE && g_spare_arena != NULL) {
+        arena = g_spare_arena;
+        g_spare_arena = NULL;
+    } else {
+        arena = malloc(sizeof(* arena) + size);
+        if (arena == NULL) {
+            return NULL;
+        }
+        arena->size = size;
+    }
+    arena->cur = arena;
+    arena->next = NULL;
+    arena->used = 0;
+
+    return arena;
+}
+
+/*
+ * RETURN:
+ *   NULL: Out of memory.
+ *    ptr: 8-byte aligned, not zeroed.
+ */
+void *
+ttlv_arena_alloc(ttlv_arena_t * arena, uint32_t size)
+{
+    ttlv_arena_t * chunk = arena->cur;
+    void * p;
+
+    size = ROUND8(size);
+    if (chunk->used + size > chunk->size) {
+        chunk = ttlv_arena_new(size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        arena->cur->next = chunk;
+        arena->cur = chunk;
+    }
+    p = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return p;
+}
+
+void
+ttlv_arena_free(ttlv_arena_t ** arena)
+{
+    ttlv_arena_t * chunk, * next;
+
+    for (chunk = * arena; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        if (chunk->size == TTLV_ARENA_SIZE && g_spare_arena == NULL) {
+            g_spare_arena = chunk;
+        } else {
+            free(chunk);
+        }
+    }
+
+    * arena = NULL;
+}
+
 void
 ttlv_free(ttlv_t ** head)
 {
     ttlv_t * cur, * next;
+    ttlv_arena_t * arena;
 
     if (* head == NULL) {
         return;
     }
 
+    /* the whole message is in the arena */
+    if ( (* head)->arena != NULL) {
+        arena = (* head)->arena;
+        ttlv_arena_free( & arena);
+        * head = NULL;
+        return;
+    }
+
     for (cur = * head; cur != NULL; cur = next) {
         next = cur->next;
         if (cur->child != NULL) {
@@ -95,9 +176,11 @@ ttlv_new(uint32_t tag, ttlv_type_t type, uint32_t length)
     ttlv_t * p;
 
     if (type == TTYPE_TEXT || type == TTYPE_RAW) {
-        p = calloc(1, sizeof(ttlv_t) - 8 /* == sizeof(the union) */ + length + 1);
+        /* the value follows the node */
+        p = calloc(1, sizeof(ttlv_t) + length + 1);
+        p->v_raw = (uint8_t *) (p + 1);
     } else {
-        p = calloc(1, sizeof(ttlv_t) - 8 /* == sizeof(the union) */ + length);
+        p = calloc(1, sizeof(ttlv_t) );
     }
     p->tag = tag;
     p->type = type;
@@ -336,7 +419,11 @@ ttlv_value_ntoh(ttlv_t * head, uint8_t * buf, uint32_t buf_len)
         if (buf_len < ROUND8(head->length)) {
             return -1;
         }
-        memcpy(head->v_raw, buf, head->length);
+        /* [<] not if it's left in `buf' (TTLV_DECODE_NOCOPY) where the NUL
+         *     goes into the padding */
+        if (head->v_raw != buf) {
+            memcpy(head->v_raw, buf, head->length);
+        }
         head->v_raw[head->length] = 0;
         return ROUND8(head->length);
     }
@@ -442,12 +529,55 @@ ttlv_encode(ttlv_t * head, uint8_t * buf, uint32_t buf_len)
 }
 
 /*
- * RETURN:
- *  >= 0: # of bytes decoded
- *  <  0: Failed
+ * ttlv_new() for decoding, in the arena if there's one. With
+ * TTLV_DECODE_NOCOPY a text/raw value is left where it is (`value') if its
+ * padding has room for the NUL.
  */
-int
-ttlv_decode(uint8_t * buf, uint32_t buf_len, ttlv_t ** head)
+static ttlv_t *
+ttlv_new_decoded(ttlv_arena_t * arena, int flags, uint32_t tag,
+                 ttlv_type_t type, uint32_t length, uint8_t * value)
+{
+    ttlv_t * p;
+
+    if (arena == NULL) {
+        return ttlv_new(tag, type, length);
+    }
+
+    p = ttlv_arena_alloc(arena, sizeof(ttlv_t) );
+    if (p == NULL) {
+        return NULL;
+    }
+    memset(p, 0, sizeof(ttlv_t) );
+    p->tag = tag;
+    p->type = type;
+    p->length = length;
+
+    if (type == TTYPE_TEXT || type == TTYPE_RAW) {
+        if ( (flags & TTLV_DECODE_NOCOPY) && length % 8 != 0) {
+            p->v_raw = value;
+        } else if ( (p->v_raw = ttlv_arena_alloc(arena, length + 1) ) == NULL) {
+            return NULL;
+        }
+    }
+
+    return p;
+}
+
+/* what's decoded so far is freed along with the arena, if any */
+static int
+ttlv_decode_fail(ttlv_t ** head, ttlv_arena_t * arena)
+{
+    if (arena == NULL) {
+        ttlv_free(head);
+    }
+    * head = NULL;
+
+    return -1;
+}
+
+static int
+ttlv_decode_ex(uint8_t * buf, uint32_t buf_len, ttlv_t ** head,
+               ttlv_arena_t * arena, int flags)
 {
     uint32_t tagtype, tag, type;
     uint32_t length;
@@ -465,8 +595,7 @@ ttlv_decode(uint8_t * buf, uint32_t buf_len, ttlv_t ** head)
     while (next_buf < buf + buf_len) {
         /* tag, type, length */
         if (next_buf + TAG_HDR_SIZE > buf + buf_len) {
-            ttlv_free(head);
-            return -1;
+            return ttlv_decode_fail(head, arena);
         }
 
         /* tag & type */
@@ -477,8 +606,7 @@ ttlv_decode(uint8_t * buf, uint32_t buf_len, ttlv_t ** head)
 
         /* check if type is valid */
         if (type == 0 || type >= TTYPE_END__) {
-            ttlv_free(head);
-            return -1;
+            return ttlv_decode_fail(head, arena);
         }
 
         /* FIXME: check tag types */
@@ -489,40 +617,24 @@ ttlv_decode(uint8_t * buf, uint32_t buf_len, ttlv_t ** head)
 
         /* check if length is valid */
         if (!ttlv_valid_len(tagtype, length)) {
-            ttlv_free(head);
-            return -1;
+            return ttlv_decode_fail(head, arena);
         }
 
         /* value */
         if (next_buf + length > buf + buf_len) {
-            ttlv_free(head);
-            return -1;
+            return ttlv_decode_fail(head, arena);
         }
 
         /* check if padding is valid */
         if (!ttlv_valid_pad(tagtype, length, (void *)next_buf)) {
-            ttlv_free(head);
-            return -1;
+            return ttlv_decode_fail(head, arena);
         }
 
         /* decode */
-        if (type != TTYPE_STRUCT) {
-            /* not structures */
-            new = ttlv_new(tag, type, length);
-            ret = ttlv_value_ntoh(new, next_buf, buf + buf_len - next_buf);
-            if (ret < 0) {
-                return ret;
-            }
-            next_buf += ret;
-        } else {
-            /* structures */
-            new = ttlv_new_struct(tag);
-            ret = ttlv_decode(next_buf, length, & new->child);
-            if (ret < 0) {
-                ttlv_free(head);
-                return ret;
-            }
-            next_buf += ret;
+        new = ttlv_new_decoded(arena, flags, tag, type,
+                               type != TTYPE_STRUCT ? length : 0, next_buf);
+        if (new == NULL) {
+            return ttlv_decode_fail(head, arena);
         }
         if (* head == NULL) {
             * head = new;
@@ -530,12 +642,61 @@ ttlv_decode(uint8_t * buf, uint32_t buf_len, ttlv_t ** head)
             tail->next = new;
         }
         tail = new;
+
+        if (type != TTYPE_STRUCT) {
+            /* not structures */
+            ret = ttlv_value_ntoh(new, next_buf, buf + buf_len - next_buf);
+        } else {
+            /* structures */
+            ret = ttlv_decode_ex(next_buf, length, & new->child, arena, flags);
+        }
+        if (ret < 0) {
+            return ttlv_decode_fail(head, arena);
+        }
+        next_buf += ret;
     }
 
     if (next_buf - buf == buf_len) {
         return buf_len;
     } else {
-        ttlv_free(head);
-        return -1;
+        return ttlv_decode_fail(head, arena);
+    }
+}
+
+/*
+ * RETURN:
+ *  >= 0: # of bytes decoded
+ *  <  0: Failed
+ */
+int
+ttlv_decode(uint8_t * buf, uint32_t buf_len, ttlv_t ** head)
+{
+    return ttlv_decode_ex(buf, buf_len, head, NULL, 0);
+}
+
+/*
+ * ttlv_decode() with the nodes (and the values which are copied) allocated
+ * from `arena'. The arena then belongs to the decoded message and ttlv_free()
+ * frees them all at once. (If nothing's decoded it's freed right away.)
+ *
+ * With TTLV_DECODE_NOCOPY text/raw values may be left in `buf' (which is
+ * written to, in the padding) so `buf' must be from the arena too or outlive
+ * the message.
+ *
+ * RETURN: Same as ttlv_decode().
+ */
+int
+ttlv_decode_arena(uint8_t * buf, uint32_t buf_len, ttlv_t ** head,
+                  ttlv_arena_t * arena, int flags)
+{
+    int ret;
+
+    ret = ttlv_decode_ex(buf, buf_len, head, arena, flags);
+    if (* head == NULL) {
+        ttlv_arena_free( & arena);
+    } else {
+        (* head)->arena = arena;
     }
+
+    return ret;
 }
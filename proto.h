@@ -50,11 +50,36 @@ typedef struct ttlv {
 
         uint32_t        v_bool;
 
-        uint8_t         v_raw[1];
-        uint8_t         v_text[1];
+        /* NUL terminated, for TTYPE_RAW too. The value follows the node
+         * (ttlv_new() ) or it's in the decoded buffer (TTLV_DECODE_NOCOPY). */
+        uint8_t *       v_raw;
+        uint8_t *       v_text;
     };
+
+    /* the head of a message from ttlv_decode_arena(), see ttlv_free() */
+    struct ttlv_arena * arena;
 } ttlv_t;
 
+/*
+ * A bump allocator. ttlv_decode_arena() puts all nodes of a message in one
+ * (and the message itself, see msg_recv() ) which is freed at once along
+ * with the message. A chunk of the default size is kept for reuse (one per
+ * thread) so decoding usually needs no malloc() at all.
+ */
+typedef struct ttlv_arena {
+    struct ttlv_arena * cur;    /* the chunk being allocated from */
+    struct ttlv_arena * next;   /* more chunks, when the first one is full */
+    uint32_t            size;
+    uint32_t            used;
+    uint8_t             data[];
+} ttlv_arena_t;
+
+/* a whole message and its nodes */
+#define TTLV_ARENA_SIZE    (80 * 1024)
+
+/* for ttlv_decode_arena() */
+#define TTLV_DECODE_NOCOPY 0x01
+
 uint64_t _htonll(uint64_t n);
 uint64_t _ntohll(uint64_t n);
 
@@ -63,6 +88,8 @@ bool    ttlv_valid_pad(uint32_t type, uint32_t length, char *data);
 int     ttlv_count_tags(ttlv_t *head, uint32_t tag);
 int     ttlv_encode(ttlv_t * head, uint8_t * buf, uint32_t buf_len);
 int     ttlv_decode(uint8_t * buf, uint32_t buf_len, ttlv_t ** head);
+int     ttlv_decode_arena(uint8_t * buf, uint32_t buf_len, ttlv_t ** head,
+                          ttlv_arena_t * arena, int flags);
 int     ttlv_value_hton(ttlv_t * head, uint8_t * buf, uint32_t buf_len);
 int     ttlv_value_ntoh(ttlv_t * head, uint8_t * buf, uint32_t buf_len);
 ttlv_t  *ttlv_append(ttlv_t * head, ttlv_t * p);
@@ -80,6 +107,10 @@ ttlv_t  *ttlv_new_struct(uint32_t tag);
 
 void    ttlv_free(ttlv_t ** head);
 
+ttlv_arena_t *ttlv_arena_new(uint32_t size);
+void   *ttlv_arena_alloc(ttlv_arena_t * arena, uint32_t size);
+void    ttlv_arena_free(ttlv_arena_t ** arena);
+
 int     ttlv_calc_size_ex(ttlv_t * head, bool cur_tag_only);
 #define ttlv_calc_size(head)            ttlv_calc_size_ex(head, false)
 
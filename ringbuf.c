@@ -0,0 +1,249 @@
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "ringbuf.h"
+
+#define RB_INIT_SIZE    (4 * 1024)
+
+/*
+ * Get an fd of some anonymous shared memory of `size' bytes.
+ */
+static int
+rb_memfd(size_t size)
+{
+    int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("sexpect-ring", MFD_CLOEXEC);
+#else
+    {
+        static int seq = 0;
+        char name[64];
+
+        snprintf(name, sizeof(name), "/sexpect-ring-%d-%d", (int) getpid(),
+                 ++seq);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            shm_unlink(name);
+        }
+    }
+#endif
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Map the same pages twice back-to-back so data wrapping around the end
+ * of the ring is still contiguous.
+ */
+static int
+rb_map_mirrored(ringbuf_t * rb, size_t size)
+{
+    char * addr;
+    int fd;
+
+    fd = rb_memfd(size);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* reserve the address range first */
+    addr = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+        == MAP_FAILED
+        || mmap(addr + size, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(addr, size * 2);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    rb->base = addr;
+    rb->size = size;
+    rb->mirrored = true;
+
+    return 0;
+}
+
+static size_t
+rb_pagesize(void)
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Switch to (or grow) the linear storage, moving the window to the start
+ * of it. `size' is twice as big as the window it's for so data only needs
+ * to be moved (at most one window) after at least one window of new data
+ * has been appended.
+ */
+static int
+rb_relocate_linear(ringbuf_t * rb, int64_t head, int64_t tail, size_t size)
+{
+    char * base;
+    size_t used = tail - head;
+
+    base = malloc(size);
+    if (base == NULL) {
+        return -1;
+    }
+    if (rb->base != NULL) {
+        memcpy(base, rb_at(rb, head), used);
+        rb_free(rb);
+    }
+
+    rb->base = base;
+    rb->size = size;
+    rb->mirrored = false;
+    rb->origin = head;
+
+    return 0;
+}
+
+int
+rb_init(ringbuf_t * rb, size_t cap)
+{
+    size_t size;
+
+    memset(rb, 0, sizeof(* rb) );
+    rb->cap = cap;
+
+    /* start small, it'll grow when necessary */
+    size = MIN(cap + 1, RB_INIT_SIZE);
+    size = (size + rb_pagesize() - 1) / rb_pagesize() * rb_pagesize();
+    if (rb_map_mirrored(rb, size) == 0) {
+        return 0;
+    }
+
+    debug("cannot map a mirrored ring (%s), falling back to compaction",
+          strerror(errno) );
+
+    return rb_relocate_linear(rb, 0, 0, MIN(cap, RB_INIT_SIZE) * 2 + 1);
+}
+
+void
+rb_free(ringbuf_t * rb)
+{
+    if (rb->base == NULL) {
+        return;
+    }
+
+    if (rb->mirrored) {
+        munmap(rb->base, rb->size * 2);
+    } else {
+        free(rb->base);
+    }
+    rb->base = NULL;
+}
+
+/*
+ * # of bytes which can be appended at `tail' without growing the storage.
+ */
+size_t
+rb_avail(ringbuf_t * rb, int64_t head, int64_t tail)
+{
+    size_t used = tail - head;
+    size_t room;
+
+    if (used >= rb->cap) {
+        return 0;
+    }
+
+    if (rb->mirrored) {
+        room = rb->size - 1 - used;
+    } else {
+        room = (rb->size - 1) / 2 - used;
+    }
+
+    return MIN(room, rb->cap - used);
+}
+
+static int
+rb_grow(ringbuf_t * rb, int64_t head, int64_t tail, size_t need)
+{
+    ringbuf_t new = * rb;
+    size_t used = tail - head;
+    size_t pagesize = rb_pagesize();
+    size_t size, maxsize;
+
+    if (rb->mirrored) {
+        maxsize = (rb->cap + 1 + pagesize - 1) / pagesize * pagesize;
+        for (size = rb->size; size - 1 < used + need; size *= 2) {
+        }
+        size = MIN(size, maxsize);
+
+        new.base = NULL;
+        if (rb_map_mirrored( & new, size) == 0) {
+            memcpy(rb_at( & new, head), rb_at(rb, head), used);
+            rb_free(rb);
+            * rb = new;
+
+            return 0;
+        }
+
+        debug("cannot grow the mirrored ring (%s), falling back to compaction",
+              strerror(errno) );
+    }
+
+    maxsize = rb->cap * 2 + 1;
+    for (size = rb->mirrored ? RB_INIT_SIZE * 2 + 1 : rb->size;
+         (size - 1) / 2 < used + need; size = size * 2 + 1) {
+    }
+    size = MIN(size, maxsize);
+
+    return rb_relocate_linear(rb, head, tail, size);
+}
+
+/*
+ * Make room for appending `need' bytes (plus the NULL terminator) at `tail'
+ * and return where to write them. Data before `head' may get lost.
+ *
+ * RETURN: NULL if the storage cannot grow.
+ */
+char *
+rb_reserve(ringbuf_t * rb, int64_t head, int64_t tail, size_t need)
+{
+    size_t used = tail - head;
+
+    if (need > 0 && used + need > rb->cap) {
+        bug("ring overflow: %zu + %zu > %zu", used, need, rb->cap);
+    }
+
+    if (need > rb_avail(rb, head, tail) ) {
+        if (rb_grow(rb, head, tail, need) < 0) {
+            return NULL;
+        }
+    }
+
+    if ( ! rb->mirrored && (tail - rb->origin) + need + 1 > rb->size) {
+        memmove(rb->base, rb_at(rb, head), used);
+        rb->origin = head;
+    }
+
+    return rb_at(rb, tail);
+}
@@ -0,0 +1,45 @@
+
+#ifndef RINGBUF_H__
+#define RINGBUF_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A byte ring addressed by absolute (ever increasing) offsets. The owner
+ * keeps track of the live window [head, tail) and the ring only provides
+ * the storage, so dropping old data is just moving `head' forward.
+ *
+ * The data between any two offsets in the window is always contiguous in
+ * memory (mapped twice back-to-back when possible, or compacted once in a
+ * while otherwise) so it can be used with strstr(), regexec(), write(), ...
+ * There's always one spare byte after `tail' for a NULL terminator.
+ *
+ * The storage starts small and grows on demand until the window can hold
+ * `cap' bytes.
+ */
+typedef struct ringbuf {
+    char  * base;
+    size_t  size;       /* size of the storage (the mapping or the allocation) */
+    size_t  cap;        /* max # of bytes in the window */
+    bool    mirrored;
+    int64_t origin;     /* non-mirrored only: the offset of `base[0]' */
+} ringbuf_t;
+
+int    rb_init(ringbuf_t * rb, size_t cap);
+void   rb_free(ringbuf_t * rb);
+size_t rb_avail(ringbuf_t * rb, int64_t head, int64_t tail);
+char * rb_reserve(ringbuf_t * rb, int64_t head, int64_t tail, size_t need);
+
+static inline char *
+rb_at(ringbuf_t * rb, int64_t off)
+{
+    if (rb->mirrored) {
+        return rb->base + (size_t) (off % rb->size);
+    } else {
+        return rb->base + (size_t) (off - rb->origin);
+    }
+}
+
+#endif
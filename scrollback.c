@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "scrollback.h"
+
+/* keep every SB_LINE_STEP-th NL in the index */
+#define SB_LINE_STEP    256
+
+/* at most one time mark per SB_MARK_SECS */
+#define SB_MARK_SECS    1.0
+
+/* without a limit the file is mapped in steps of this size */
+#define SB_MAP_STEP     ( (size_t) 64 * 1024 * 1024)
+
+static bool
+ts_before(const struct timespec * t1, const struct timespec * t2)
+{
+    return t1->tv_sec < t2->tv_sec
+           || (t1->tv_sec == t2->tv_sec && t1->tv_nsec < t2->tv_nsec);
+}
+
+/*
+ * `path' is NULL for an anonymous file (unlinked right away) in $TMPDIR.
+ */
+int
+sb_open(scrollback_t * sb, const char * path, int64_t limit)
+{
+    char * tmpl = NULL;
+    const char * tmpdir;
+    int fd;
+
+    memset(sb, 0, sizeof(* sb) );
+    sb->fd = -1;
+
+    if (path == NULL) {
+        tmpdir = getenv("TMPDIR");
+        if (tmpdir == NULL || tmpdir[0] == '\0') {
+            tmpdir = "/tmp";
+        }
+        if (asprintf( & tmpl, "%s/sexpect-scrollback-XXXXXX", tmpdir) < 0) {
+            return -1;
+        }
+        fd = mkstemp(tmpl);
+        if (fd >= 0) {
+            unlink(tmpl);
+        }
+        free(tmpl);
+    } else {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (limit > 0) {
+        if (ftruncate(fd, limit) < 0) {
+            close(fd);
+            return -1;
+        }
+        sb->map = mmap(NULL, limit, PROT_READ, MAP_SHARED, fd, 0);
+        if (sb->map == MAP_FAILED) {
+            sb->map = NULL;
+            close(fd);
+            return -1;
+        }
+        sb->maplen = limit;
+    }
+
+    sb->fd = fd;
+    sb->limit = limit;
+
+    return 0;
+}
+
+void
+sb_close(scrollback_t * sb)
+{
+    if (sb->map != NULL) {
+        munmap(sb->map, sb->maplen);
+    }
+    if (sb->fd >= 0) {
+        close(sb->fd);
+    }
+    free(sb->lines);
+    free(sb->marks);
+
+    memset(sb, 0, sizeof(* sb) );
+    sb->fd = -1;
+}
+
+static int
+sb_pwrite(scrollback_t * sb, const char * buf, int len, int64_t pos)
+{
+    int n;
+
+    while (len > 0) {
+        n = pwrite(sb->fd, buf, len, pos);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        pos += n;
+    }
+
+    return 0;
+}
+
+/*
+ * Append `len' bytes at `tail'.
+ */
+int
+sb_append(scrollback_t * sb, const char * buf, int len)
+{
+    const char * p = buf, * end = buf + len;
+    struct sb_line * line;
+    int64_t pos;
+    int n;
+
+    /* index the NLs */
+    while ( (p = memchr(p, '\n', end - p) ) != NULL) {
+        if (sb->nlcount % SB_LINE_STEP == 0) {
+            line = index_push( & sb->lines, & sb->line_start, & sb->line_end,
+                              & sb->line_cap, sizeof(sb->lines[0]) );
+            line->pos = sb->tail + (p - buf);
+            line->seq = sb->nlcount;
+        }
+        ++sb->nlcount;
+        ++p;
+    }
+
+    if (sb->limit == 0) {
+        if (sb_pwrite(sb, buf, len, sb->tail) < 0) {
+            return -1;
+        }
+    } else {
+        /* only the last `limit' bytes would be kept anyway */
+        if (len > sb->limit) {
+            sb->tail += len - sb->limit;
+            buf += len - sb->limit;
+            len = sb->limit;
+        }
+        pos = sb->tail % sb->limit;
+        n = MIN(len, sb->limit - pos);
+        if (sb_pwrite(sb, buf, n, pos) < 0
+            || sb_pwrite(sb, buf + n, len - n, 0) < 0) {
+            return -1;
+        }
+    }
+    sb->tail += len;
+
+    /* drop what's been overwritten */
+    if (sb->limit > 0 && sb->tail - sb->head > sb->limit) {
+        sb->head = sb->tail - sb->limit;
+    }
+    while (sb->line_start < sb->line_end
+           && sb->lines[sb->line_start].pos < sb->head) {
+        ++sb->line_start;
+    }
+    while (sb->mark_end - sb->mark_start > 1
+           && sb->marks[sb->mark_start + 1].pos <= sb->head) {
+        ++sb->mark_start;
+    }
+
+    return 0;
+}
+
+/*
+ * Output from `pos' came in at `when' or later.
+ */
+void
+sb_mark(scrollback_t * sb, const struct timespec * when, int64_t pos)
+{
+    struct sb_mark * mark;
+
+    mark = sb->mark_end > sb->mark_start ? & sb->marks[sb->mark_end - 1] : NULL;
+    if (mark != NULL
+        && Clock_diff( & mark->when, (struct timespec *) when) < SB_MARK_SECS) {
+        return;
+    }
+
+    mark = index_push( & sb->marks, & sb->mark_start, & sb->mark_end,
+                      & sb->mark_cap, sizeof(sb->marks[0]) );
+    mark->when = * when;
+    mark->pos = pos;
+}
+
+/*
+ * The data at `off' and how much of it (`* len') is contiguous, or NULL if
+ * `off' is not in [head, tail).
+ */
+const char *
+sb_at(scrollback_t * sb, int64_t off, int * len)
+{
+    size_t need;
+    int64_t pos;
+
+    if (sb->fd < 0 || off < sb->head || off >= sb->tail) {
+        return NULL;
+    }
+
+    if (sb->limit > 0) {
+        pos = off % sb->limit;
+        * len = MIN(sb->tail - off, sb->limit - pos);
+        return sb->map + pos;
+    }
+
+    if (sb->maplen < (size_t) sb->tail) {
+        if (sb->map != NULL) {
+            munmap(sb->map, sb->maplen);
+        }
+        need = (sb->tail + SB_MAP_STEP - 1) / SB_MAP_STEP * SB_MAP_STEP;
+        sb->map = mmap(NULL, need, PROT_READ, MAP_SHARED, sb->fd, 0);
+        if (sb->map == MAP_FAILED) {
+            debug("mmap(scrollback): %s (%d)", strerror(errno), errno);
+            sb->map = NULL;
+            sb->maplen = 0;
+            return NULL;
+        }
+        sb->maplen = need;
+    }
+    * len = MIN(sb->tail - off, INT_MAX);
+
+    return sb->map + off;
+}
+
+/*
+ * The offset of the NL after `seq' others, or -1 if that's unknown (not
+ * kept, or before the first one in the index).
+ */
+int64_t
+sb_find_nl(scrollback_t * sb, int64_t seq)
+{
+    int lo = sb->line_start, hi = sb->line_end, mid, len;
+    int64_t off, cur;
+    const char * data, * p;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (sb->lines[mid].seq <= seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == sb->line_start) {
+        return -1;
+    }
+
+    /* count the NLs from the nearest one in the index */
+    off = sb->lines[lo - 1].pos;
+    for (cur = sb->lines[lo - 1].seq; cur < seq; ++cur) {
+        for (++off; ; off += len) {
+            if ( (data = sb_at(sb, off, & len) ) == NULL) {
+                return -1;
+            }
+            if ( (p = memchr(data, '\n', len) ) != NULL) {
+                off += p - data;
+                break;
+            }
+        }
+    }
+
+    return off;
+}
+
+/*
+ * Where the output which came in at `when' or later starts, or -1 if
+ * there's none.
+ */
+int64_t
+sb_find_time(scrollback_t * sb, const struct timespec * when)
+{
+    int lo = sb->mark_start, hi = sb->mark_end, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ts_before( & sb->marks[mid].when, when) ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == sb->mark_end) {
+        return -1;
+    }
+
+    return MAX(sb->head, sb->marks[lo].pos);
+}
@@ -0,0 +1,45 @@
+#ifndef SCROLLBACK_H__
+#define SCROLLBACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Output which has fallen off the in-memory window (spawn -scrollback),
+ * spilled to a file. Like `rawbuf' it's addressed by absolute offsets and
+ * [head, tail) is kept, `tail' being where the in-memory data starts. With
+ * a limit the file is a ring of `limit' bytes and old data is overwritten.
+ *
+ * Data is read back through a read-only mapping of the file. Every
+ * SB_LINE_STEP-th NL and a time mark per SB_MARK_SECS are kept so lines
+ * and times can be found without reading the whole file.
+ */
+typedef struct scrollback {
+    int     fd;         /* -1: no scrollback */
+    int64_t limit;      /* 0: no limit */
+    int64_t head, tail;
+    int64_t nlcount;    /* # of NLs in [0, tail) */
+    char  * map;
+    size_t  maplen;
+    struct sb_line {
+        int64_t pos;    /* offset of the NL */
+        int64_t seq;    /* # of NLs before it */
+    } * lines;
+    int     line_start, line_end, line_cap;
+    struct sb_mark {
+        struct timespec when;
+        int64_t pos;    /* output from `pos' came in at `when' or later */
+    } * marks;
+    int     mark_start, mark_end, mark_cap;
+} scrollback_t;
+
+int     sb_open(scrollback_t * sb, const char * path, int64_t limit);
+void    sb_close(scrollback_t * sb);
+int     sb_append(scrollback_t * sb, const char * buf, int len);
+void    sb_mark(scrollback_t * sb, const struct timespec * when, int64_t pos);
+const char * sb_at(scrollback_t * sb, int64_t off, int * len);
+int64_t sb_find_nl(scrollback_t * sb, int64_t seq);
+int64_t sb_find_time(scrollback_t * sb, const struct timespec * when);
+
+#endif
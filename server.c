@@ -10,63 +10,212 @@
 #include <signal.h>
 #include <regex.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#ifdef HAVE_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#endif
 
 #include "common.h"
+#include "acmatch.h"
+#include "dfa.h"
+#include "ere.h"
+#include "evloop.h"
+#include "globmatch.h"
+#include "memsearch.h"
+#include "nulstrip.h"
 #include "proto.h"
 #include "pty.h"
+#include "ringbuf.h"
+#include "scrollback.h"
+#include "server.h"
 
-#define SIZE_RAW_BUF    (16 * 1024)
-#define MAX_OLD_DATA    ( 8 * 1024)
-#define EXPECT_OUT_NUM  (9 + 1)
+#define EXPECT_OUT_NUM  (99 + 1)
 
 #define NONBLOCK_DROP_SIZE (1 * 1024)
 
-#if (SIZE_RAW_BUF + 1024) > PASS_MAX_MSG
-#error "SIZE_RAW_BUF too large compared to PASS_MAX_MSG"
+/* only grow the raw buffer when there's less free space than this */
+#define PTM_READ_MIN       (4 * 1024)
+
+/* max # of bytes read from ptm in one go (see serv_read_ptm()) */
+#define PTM_DRAIN_MAX      (256 * 1024)
+
+/* the canonical-mode line limit, see serv_write_ptm() */
+#ifndef MAX_CANON
+#define MAX_CANON          255
+#endif
+
+/* a streaming `send' is not read on while more input than this (or -sendq)
+ * is still queued for the ptm, see serv_watch() */
+#define SEND_STREAM_HIGH   (64 * 1024)
+
+/* TAG_OUTPUT is split into chunks of at most this size */
+#define MAX_OUTPUT_CHUNK   (PASS_MAX_MSG - 1024)
+
+/* -cloexit: give the ptm a chance to drain before closing it */
+#define CLOEXIT_GRACE      0.1
+
+/* -lookback Ns: how precise the times of output are */
+#define LOOKBACK_MARK_SECS 0.1
+
+/* clients served at the same time, the rest wait in the listen backlog */
+#define MAX_CONNS          32
+
+#if PASS_MIN_BUFFREE < 2 * NONBLOCK_DROP_SIZE
+#error "PASS_MIN_BUFFREE too small"
 #endif
 
-#if SIZE_RAW_BUF < MAX_OLD_DATA + 2 * NONBLOCK_DROP_SIZE
-#error "SIZE_RAW_BUF too small"
+/* one pattern of the current expect (or interact -re) */
+struct pass_branch {
+    int    type;        /* PASS_EXPECT_{EXACT,GLOB,ERE,PCRE} */
+    char * pattern;
+    int    patlen;
+    memsearch_t ms;     /* prepared `pattern' for -exact */
+    regex_t re;         /* compiled `pattern' for -re */
+    bool   has_re;
+    /*
+     * For scanning only new data. No match can start before `scanned' (in
+     * MATCH_TOTAL bytes). After a failed scan the last `overlap' bytes must
+     * be scanned again (-1 for all), or only the last line if `oneline' (a
+     * match cannot include NLs).
+     */
+    int64_t scanned;
+    int    overlap;
+    bool   oneline;
+    /*
+     * -re: a string every match includes. regexec() is only run when it's
+     * found in the new data, and only from where a match which includes it
+     * can start (`maxlen' is ere_maxlen()).
+     */
+    memsearch_t lit;
+    bool   has_lit;
+    int    maxlen;
+    int    lit_hits, lit_misses;
+    /*
+     * -engine dfa: `dfa' finds where a match ends and `rdfa' where it
+     * starts. `dfa' has been fed [dfa_head, dfa_pos) and is in `dfa_state'.
+     */
+    dfa_t * dfa;
+    dfa_t * rdfa;
+    int    dfa_state;
+    int64_t dfa_head;
+    int64_t dfa_pos;
+    /*
+     * -glob: `glob_state' is how far matching from `glob_head' got.
+     */
+    globmatch_t * glob;
+    gm_state_t glob_state;
+    int64_t glob_head;
+#ifdef HAVE_PCRE2
+    pcre2_code * pcre;  /* compiled `pattern' for -pcre */
+    pcre2_match_data * pcre_md;
 #endif
+};
+
+/* conn specific data, needs to be memset'ed for new conn */
+struct serv_conn {
+    int  sock;
+    bool passing;
+    bool ready;         /* there's a request to read */
+    struct {
+        int    subcmd;      /* expect, interact, wait */
+        int    expflags;
+        int    nbranches;
+        struct pass_branch * branches;  /* [nbranches] */
+        /*
+         * All the -exact patterns when there are more than one. The
+         * automaton has consumed the data up to `acm_pos' (in
+         * MATCH_TOTAL bytes) and is in `acm_state'.
+         */
+        acm_t * acm;
+        int    acm_state;
+        int64_t acm_pos;
+        /*
+         * What the patterns are matched against, [mhead, mtotal) at
+         * `mbase'. See serv_match_view().
+         */
+        char * mbase;
+        int64_t mhead;
+        int64_t mtotal;
+        int    timeout;
+        int    lookback;
+        int    lookback_unit;   /* LOOKBACK_LINES, ... */
+        struct timespec startime;
+        /*
+         * Each expect has its own cursor so concurrent ones don't steal
+         * each other's data: matching starts at `head' (`exphead' or
+         * -from/-since) and the output up to `sent' has been sent.
+         */
+        int64_t head;
+        int64_t sent;
+    } pass;
+    /* `send' is acked after the input up to `send_until' has been written
+     * (or, with -sendq, queued) */
+    bool    sending;
+    int64_t send_until;
+    int64_t send_offset;    /* TAG_OUTPUT_OFFSET for the ack */
+    /* in the middle of a streamed `send' (TAG_SEND_MORE) */
+    bool    streaming;
+    /* `send -file': the client's file is read from here (TAG_SEND_FD) */
+    int     send_fd;
+    int64_t send_left;      /* -limit, or -1 */
+};
 
 /* N.B.:
  *  - Remember to update `serv_init()' accordingly when adding new fields
  *    to the struct.
+ *  - There's one session per spawned child. In hub mode a process has many
+ *    of them and `g' is the one being served by the current thread.
  */
-static struct {
+struct session {
     struct st_cmdopts * cmdopts;
+    char * name;        /* hub mode */
 
     pid_t child;
     char  ptsname[32];
     int   fd_ptm, fd_listen;
+    int   fd_pid;       /* hub mode: pidfd of the child instead of SIGCHLD */
+    int   read_budget;  /* max # of bytes per serv_read_ptm(), 0: default */
+    evloop_t * ev;
+    bool  ptm_ready, listen_ready;  /* from the last ev_wait() */
+    bool  ptm_writable;
+    /*
+     * Input (send, interact) not written to ptm yet, [head, len) in `buf'.
+     * `total' bytes have been queued and `written' of them written.
+     */
+    struct {
+        char  * buf;
+        int     head, len, cap;
+        int64_t total, written;
+    } inq;
 
     bool SIGCHLDed;
     bool waited;        /* client has called wait */
+    int  exitstatus;    /* for all the clients waiting */
 #if 0
     int  lasterr;       /* last errno */
 #endif
 
-    /* conn specific data, needs to be memset'ed for new conn */
-    struct {
-        int  sock;
-        bool passing;
-        struct {
-            int    subcmd;      /* expect, interact, wait */
-            int    expflags;
-            char * pattern;
-            int    timeout;
-            int    lookback;
-            struct timespec startime;
-        } pass;
-    } conn;
+    /*
+     * The connections, each with its own pass state, allocated when the
+     * client connects. `conn' is the one being served (`noconn' if none),
+     * everything which talks to a client goes through it. A closed one is
+     * only freed at the end of serv_run() so `conn' is always valid.
+     */
+    struct serv_conn ** conns;  /* [nconns] */
+    int    nconns;
+    int    maxconns;            /* size of `conns' */
+    struct serv_conn * conn;
+    struct serv_conn noconn;
 
     /*
      * This will be updated when
@@ -77,30 +226,83 @@ static struct {
      */
     struct timespec lastactive;
 
+    /*
+     * All the output is kept once, in a ring addressed by absolute offsets
+     * so dropping old data or consuming matched data is only moving the
+     * offsets forward.
+     */
     int64_t ntotal;     /* total # of bytes from ptm */
-    int64_t rawoffset;  /* the offset (in `ntotal' bytes) of `rawbuf' */
-    int64_t expoffset;  /* offset of next byte which needs to be copied
-                         * to `expbuf' */
-    char * rawbuf;      /* raw output from pts */
-    int    rawbufsize;
-    char * rawnew;      /* data not sent to client yet */
-    int    newcnt;
-    char * expbuf;      /* NULL bytes removed */
-    int    expbufsize;
-    int    expcnt;      /* current data in `expbuf' */
+    int64_t rawoffset;  /* the offset (in `ntotal' bytes) of the oldest
+                         * byte in `rawbuf' */
+    int64_t rawnew;     /* offset of data not sent to any client yet */
+    int64_t exphead;    /* offset of data not matched by expect yet, where
+                         * the next expect starts */
+    ringbuf_t rawbuf;   /* raw output from pts */
+    /*
+     * Patterns (but -raw ones) are matched with NUL bytes removed, at
+     * "expect offsets" (an offset minus the # of NULs before it). Where the
+     * NULs are is kept as runs, the ones which end before `rawoffset' are
+     * dropped. Most output has no NULs and is matched right in `rawbuf'.
+     */
+    struct nul_run {
+        int64_t pos;
+        int     len;
+        int64_t before; /* # of NULs before `pos' */
+    } * nulruns;
+    int    nul_start, nul_end, nul_cap; /* the live runs */
+    int64_t nultotal;   /* # of NULs from ptm */
+    /*
+     * For -lookback: where the NLs are and when the output came in (one
+     * mark per LOOKBACK_MARK_SECS at most), the ones before `rawoffset'
+     * are dropped.
+     */
+    int64_t * nls;
+    int    nl_start, nl_end, nl_cap;
+    struct read_mark {
+        struct timespec when;
+        int64_t pos;    /* output from `pos' came in at `when' or later */
+    } * marks;
+    int    mark_start, mark_end, mark_cap;
+    scrollback_t sb;    /* spawn -scrollback */
+    /*
+     * When the data not matched yet has NULs, it's copied here without
+     * them: [head, total) (expect offsets) copied from [..., rawend).
+     */
+    struct {
+        char  * buf;
+        int     size;
+        int64_t head, total;
+        int64_t rawend;
+    } strip;
     char * expout[EXPECT_OUT_NUM]; /* $expect_out(N,string) */
-} g;
-#define is_CONNECTED    (g.conn.sock >= 0)
+    int    expoutlen[EXPECT_OUT_NUM];
+    char * expname[EXPECT_OUT_NUM]; /* names of the -pcre groups */
+    int    expbranch;   /* the pattern (from 1) which matched last time */
+    int64_t expend;     /* where the last match ended */
+};
+static __thread struct session * g_sess;
+#define g (* g_sess)
+#define is_CONNECTED    (g.conn->sock >= 0)
 #define not_CONNECTED   ( ! is_CONNECTED)
+#define no_CLIENTS      (g.nconns == 0)
 #define is_PTM_OPEN     (g.fd_ptm    >= 0)
 #define not_PTM_OPEN    ( ! is_PTM_OPEN)
 #define is_CHLD_DEAD    (g.SIGCHLDed)
 #define is_CHLD_WAITED  (g.waited)
-#define is_PASSING      (g.conn.passing)
-#define is_EXPECT       (g.conn.pass.subcmd == PASS_SUBCMD_EXPECT)
-#define is_WAIT         (g.conn.pass.subcmd == PASS_SUBCMD_WAIT)
-#define is_INTERACT     (g.conn.pass.subcmd == PASS_SUBCMD_INTERACT)
-#define has_PATTERN     (g.conn.pass.pattern != NULL)
+#define is_PASSING      (g.conn->passing)
+#define is_EXPECT       (g.conn->pass.subcmd == PASS_SUBCMD_EXPECT)
+#define is_WAIT         (g.conn->pass.subcmd == PASS_SUBCMD_WAIT)
+#define is_INTERACT     (g.conn->pass.subcmd == PASS_SUBCMD_INTERACT)
+#define has_PATTERN     (g.conn->pass.nbranches > 0)
+
+#define RAW_AT(off)     rb_at( & g.rawbuf, off)
+#define NEWCNT          ( (int) (g.ntotal - g.rawnew) )
+#define MATCH_AT(off)   (g.conn->pass.mbase + ( (off) - g.conn->pass.mhead) )
+#define MATCH_HEAD      (g.conn->pass.mhead)
+#define MATCH_TOTAL     (g.conn->pass.mtotal)
+#define MATCHCNT        ( (int) (MATCH_TOTAL - MATCH_HEAD) )
+/* the oldest output still kept, in memory or in the scrollback */
+#define OLDEST_OFF      (g.sb.fd >= 0 ? MIN(g.sb.head, g.rawoffset) : g.rawoffset)
 
 static void
 daemonize(void)
@@ -143,7 +345,12 @@ free_expect_out(void)
     for (i = 0; i < EXPECT_OUT_NUM; ++i) {
         free(g.expout[i]);
         g.expout[i] = NULL;
+        g.expoutlen[i] = 0;
+        free(g.expname[i]);
+        g.expname[i] = NULL;
     }
+    g.expbranch = 0;
+    g.expend = -1;
 }
 
 static void
@@ -156,6 +363,175 @@ serv_sigCHLD(int signo)
     /* Don't close(fd_ptm) here! There may still data from pts for reading. */
 }
 
+static void
+serv_close_ptm(void)
+{
+    ev_watch(g.ev, g.fd_ptm, 0);
+    close(g.fd_ptm);
+    g.fd_ptm = -1;
+
+    /* the input not written yet has nowhere to go */
+    g.inq.head = g.inq.len = 0;
+    g.inq.written = g.inq.total;
+}
+
+/*
+ * Make room for `len' more bytes of input at the end of the queue.
+ */
+static char *
+inq_space(int len)
+{
+    int pending = g.inq.len - g.inq.head;
+
+    if (g.inq.len + len > g.inq.cap) {
+        /* move the pending data to the front first */
+        memmove(g.inq.buf, g.inq.buf + g.inq.head, pending);
+        g.inq.head = 0;
+        g.inq.len = pending;
+    }
+    if (g.inq.len + len > g.inq.cap) {
+        g.inq.cap = MAX(g.inq.len + len, g.inq.cap * 2);
+        if (Realloc( (void **) & g.inq.buf, g.inq.cap) == NULL) {
+            fatal_sys("realloc");
+        }
+    }
+    return g.inq.buf + g.inq.len;
+}
+
+/*
+ * Queue the input for the child. It's written when the ptm is writable.
+ */
+static void
+inq_add(const char * data, int len)
+{
+    memcpy(inq_space(len), data, len);
+    g.inq.len += len;
+    g.inq.total += len;
+}
+
+/*
+ * Write as much of the queued input as the ptm would take. In canonical mode
+ * (the child reads lines) it's written at most MAX_CANON bytes and, if
+ * possible, whole lines at a time so a write() never goes beyond the tty's
+ * line limit. When the tty cannot take more the ptm is not writable (or
+ * write() returns EAGAIN) until the child has read some.
+ */
+static void
+serv_write_ptm(void)
+{
+    struct termios tios;
+    bool canon;
+    char * data;
+    int n, len;
+
+    if (not_PTM_OPEN || g.inq.head == g.inq.len) {
+        return;
+    }
+
+    canon = tcgetattr(g.fd_ptm, & tios) == 0 && (tios.c_lflag & ICANON);
+
+    while (g.inq.head < g.inq.len) {
+        data = g.inq.buf + g.inq.head;
+        len = g.inq.len - g.inq.head;
+        if (canon && len > MAX_CANON) {
+            len = MAX_CANON;
+            for (n = len; n > 0 && data[n - 1] != '\n' && data[n - 1] != '\r'; --n) {
+            }
+            if (n > 0) {
+                len = n;
+            }
+        }
+
+        n = write(g.fd_ptm, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN) {
+                /* [<] e.g. EIO after the pts is closed, reading ptm would
+                 *     find it out */
+                debug("write(ptm): %s (%d)", strerror(errno), errno);
+            }
+            break;
+        }
+        g.inq.head += n;
+        g.inq.written += n;
+    }
+
+    if (g.inq.head == g.inq.len) {
+        g.inq.head = g.inq.len = 0;
+    }
+}
+
+/*
+ * How much input may be queued before a streaming `send' has to wait.
+ */
+static int
+send_high(void)
+{
+    return MAX(SEND_STREAM_HIGH, g.cmdopts->spawn.sendq);
+}
+
+/*
+ * `send -file': read the files passed by clients (TAG_SEND_FD) right into the
+ * input queue, as much as a streaming `send' may queue. A file is closed at
+ * EOF (or -limit) and then the client's final TAG_SEND is read.
+ *
+ * Only regular files are passed so read() never blocks (and epoll cannot
+ * watch them anyway). It's driven by the ptm's writability instead.
+ */
+static void
+serv_read_sendfds(void)
+{
+    struct serv_conn * c;
+    int i, size, n;
+
+    for (i = 0; i < g.nconns; ++i) {
+        c = g.conns[i];
+        while (c->send_fd >= 0 && is_PTM_OPEN
+               && g.inq.len - g.inq.head < send_high() ) {
+            size = PASS_SEND_CHUNK;
+            if (c->send_left >= 0) {
+                size = MIN(size, c->send_left);
+            }
+            n = size > 0 ? read(c->send_fd, inq_space(size), size) : 0;
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                if (n < 0) {
+                    debug("read(send fd): %s (%d)", strerror(errno), errno);
+                }
+                close(c->send_fd);
+                c->send_fd = -1;
+                break;
+            }
+            g.inq.len += n;
+            g.inq.total += n;
+            if (c->send_left >= 0) {
+                c->send_left -= n;
+            }
+            serv_write_ptm();
+        }
+        /* the input not written yet has nowhere to go */
+        if (c->send_fd >= 0 && not_PTM_OPEN) {
+            close(c->send_fd);
+            c->send_fd = -1;
+        }
+    }
+}
+
+static void
+serv_close_conn(void)
+{
+    ev_watch(g.ev, g.conn->sock, 0);
+    close(g.conn->sock);
+    g.conn->sock = -1;
+
+    if (g.conn->send_fd >= 0) {
+        close(g.conn->send_fd);
+        g.conn->send_fd = -1;
+    }
+}
+
 static ttlv_t *
 serv_new_error(int code, char * msg)
 {
@@ -173,13 +549,22 @@ static ttlv_t *
 serv_msg_recv(void)
 {
     ttlv_t *msg;
+    int passed;
 
     if (is_CONNECTED) {
-        msg = msg_recv(g.conn.sock);
+        msg = msg_recv_fd(g.conn->sock, & passed);
+        if (passed >= 0) {
+            /* only `send -file' comes with an fd */
+            if (msg != NULL && msg->tag == TAG_SEND_FD
+                && g.conn->send_fd < 0) {
+                g.conn->send_fd = passed;
+            } else {
+                close(passed);
+            }
+        }
         if (msg == NULL) {
             debug("msg_recv failed (client dead?), closing the socket");
-            close(g.conn.sock);
-            g.conn.sock = -1;
+            serv_close_conn();
             Clock_gettime( & g.lastactive);
             return NULL;
         } else {
@@ -201,11 +586,10 @@ serv_msg_send(ttlv_t **msg, bool free_msg)
         return -1;
     }
 
-    ret = msg_send(g.conn.sock, *msg);
+    ret = msg_send(g.conn->sock, *msg);
     if (ret < 0) {
         debug("msg_send failed (client dead?), closing the socket");
-        close(g.conn.sock);
-        g.conn.sock = -1;
+        serv_close_conn();
         Clock_gettime( & g.lastactive);
     }
 
@@ -216,6 +600,31 @@ serv_msg_send(ttlv_t **msg, bool free_msg)
     return ret;
 }
 
+/*
+ * serv_msg_send() for a single TTYPE_RAW tag, sent right from `data' (e.g.
+ * rawbuf) with one writev().
+ */
+static ssize_t
+serv_msg_send_raw(uint32_t tag, const char * data, int len)
+{
+    int ret;
+
+    if (not_CONNECTED) {
+        bug("msg_send: connection already closed");
+        errno = EBADF;
+        return -1;
+    }
+
+    ret = msg_send_raw(g.conn->sock, tag, data, len);
+    if (ret < 0) {
+        debug("msg_send failed (client dead?), closing the socket");
+        serv_close_conn();
+        Clock_gettime( & g.lastactive);
+    }
+
+    return ret;
+}
+
 static void
 serv_hello(ttlv_t * msg_in)
 {
@@ -232,8 +641,7 @@ serv_hello(ttlv_t * msg_in)
         /* client version too old */
         debug("client version too old");
 
-        close(g.conn.sock);
-        g.conn.sock = -1;
+        serv_close_conn();
         return;
     } else if ( ! streq(VERSION_, (char *)cli_version->v_text) ) {
         /* version mismatch */
@@ -245,16 +653,14 @@ serv_hello(ttlv_t * msg_in)
         msg_out = serv_new_error(ERROR_PROTO, err_msg);
         serv_msg_send( & msg_out, true);
 
-        close(g.conn.sock);
-        g.conn.sock = -1;
+        serv_close_conn();
         return;
     }
 
     debug("sending HELLO");
-    if (msg_hello(g.conn.sock) < 0) {
+    if (msg_hello(g.conn->sock) < 0) {
         debug("msg_hello failed (client dead?)");
-        close(g.conn.sock);
-        g.conn.sock = -1;
+        serv_close_conn();
         Clock_gettime( & g.lastactive);
     }
 }
@@ -267,19 +673,335 @@ serv_disconn(void)
     }
 
     debug("sending DISCONN");
-    if (msg_disconn(g.conn.sock) < 0) {
+    if (msg_disconn(g.conn->sock) < 0) {
         debug("msg_disconn failed (client dead?)");
     }
 
     /* receive no more */
     debug("closing the socket");
-    close(g.conn.sock);
-    g.conn.sock = -1;
+    serv_close_conn();
 
     Clock_gettime( & g.lastactive);
 }
 
-static void buf_raw2expect(void);
+static void
+serv_free_pass(void)
+{
+    struct pass_branch * br;
+    int i;
+
+    for (i = 0; i < g.conn->pass.nbranches; ++i) {
+        br = & g.conn->pass.branches[i];
+        free(br->pattern);
+        if (br->type == PASS_EXPECT_EXACT) {
+            ms_free( & br->ms);
+        }
+        if (br->has_lit) {
+            debug("prefilter ``%s'': %d hits, %d misses", br->lit.needle,
+                  br->lit_hits, br->lit_misses);
+            ms_free( & br->lit);
+        }
+        if (br->has_re) {
+            regfree( & br->re);
+        }
+        dfa_free(br->dfa);
+        dfa_free(br->rdfa);
+        gm_free(br->glob);
+#ifdef HAVE_PCRE2
+        pcre2_match_data_free(br->pcre_md);
+        pcre2_code_free(br->pcre);
+#endif
+    }
+    free(g.conn->pass.branches);
+    g.conn->pass.branches = NULL;
+    g.conn->pass.nbranches = 0;
+
+    acm_free(g.conn->pass.acm);
+    g.conn->pass.acm = NULL;
+}
+
+static int
+serv_ere_flags(void)
+{
+    int expflags = g.conn->pass.expflags;
+
+    return ( (expflags & PASS_EXPECT_ICASE) ? ERE_ICASE : 0)
+           | ( (expflags & PASS_EXPECT_NEWLINE) ? ERE_NEWLINE : 0);
+}
+
+/*
+ * RETURN: an error message if the pattern is invalid, or NULL.
+ */
+static char *
+serv_compile_pcre(struct pass_branch * br)
+{
+#ifdef HAVE_PCRE2
+    static __thread char errmsg[256];
+    uint32_t options = 0;
+    PCRE2_SIZE erroff;
+    int ret, n;
+
+    if ((g.conn->pass.expflags & PASS_EXPECT_ICASE) != 0) {
+        options |= PCRE2_CASELESS;
+    }
+    if ((g.conn->pass.expflags & PASS_EXPECT_NEWLINE) != 0) {
+        options |= PCRE2_MULTILINE;
+    }
+
+    br->pcre = pcre2_compile( (PCRE2_SPTR) br->pattern, br->patlen, options,
+                             & ret, & erroff, NULL);
+    if (br->pcre == NULL) {
+        n = snprintf(errmsg, sizeof(errmsg), "invalid PCRE at offset %d: ",
+                     (int) erroff);
+        pcre2_get_error_message(ret, (PCRE2_UCHAR *) errmsg + n,
+                                sizeof(errmsg) - n);
+        return errmsg;
+    }
+
+    ret = pcre2_jit_compile(br->pcre, PCRE2_JIT_COMPLETE | PCRE2_JIT_PARTIAL_SOFT);
+    if (ret != 0) {
+        debug("pcre2_jit_compile() failed (%d), not using JIT", ret);
+    }
+
+    br->pcre_md = pcre2_match_data_create_from_pattern(br->pcre, NULL);
+    if (br->pcre_md == NULL) {
+        fatal_sys("pcre2_match_data_create_from_pattern");
+    }
+
+    return NULL;
+#else
+    return "-pcre is not supported (built without PCRE2)";
+#endif
+}
+
+/*
+ * RETURN: an error message if the pattern is invalid, or NULL.
+ */
+static char *
+serv_compile_glob(struct pass_branch * br)
+{
+    br->glob = gm_compile(br->pattern,
+                          (g.conn->pass.expflags & PASS_EXPECT_ICASE) != 0);
+    if (br->glob == NULL) {
+        return "invalid glob pattern";
+    }
+    br->glob_head = -1;
+
+    return NULL;
+}
+
+/*
+ * RETURN: an error message if the pattern is invalid, or NULL.
+ */
+static char *
+serv_compile_pattern(struct pass_branch * br)
+{
+    static __thread char errmsg[256];
+    int reflags = REG_EXTENDED;
+    int ret, n;
+    ere_t * re;
+    char * re_str;
+
+    /* the DFA only does EREs */
+    if (br->type == PASS_EXPECT_GLOB
+        && (g.conn->pass.expflags & PASS_EXPECT_DFA) != 0) {
+        if (glob2re(br->pattern, & re_str, NULL) == NULL) {
+            return "invalid glob pattern";
+        }
+        debug("glob2re: ``%s'' --> ``%s''", br->pattern, re_str);
+        free(br->pattern);
+        br->pattern = re_str;
+        br->patlen = strlen(re_str);
+        br->type = PASS_EXPECT_ERE;
+    }
+
+    if (br->type == PASS_EXPECT_PCRE) {
+        return serv_compile_pcre(br);
+    } else if (br->type == PASS_EXPECT_GLOB) {
+        return serv_compile_glob(br);
+    } else if (br->type != PASS_EXPECT_ERE) {
+        return NULL;
+    }
+
+    if ((g.conn->pass.expflags & PASS_EXPECT_ICASE) != 0) {
+        reflags |= REG_ICASE;
+    }
+    if ((g.conn->pass.expflags & PASS_EXPECT_NEWLINE) != 0) {
+        reflags |= REG_NEWLINE;
+    }
+
+    ret = regcomp( & br->re, br->pattern, reflags);
+    if (ret != 0) {
+        n = snprintf(errmsg, sizeof(errmsg), "invalid regex: ");
+        regerror(ret, & br->re, errmsg + n, sizeof(errmsg) - n);
+        return errmsg;
+    }
+    br->has_re = true;
+
+    if ((g.conn->pass.expflags & PASS_EXPECT_DFA) != 0) {
+        re = ere_parse(br->pattern, serv_ere_flags() );
+        if (re != NULL) {
+            br->dfa = dfa_new(re, false);
+            br->rdfa = dfa_new(re, true);
+            ere_free(re);
+        }
+        if (br->dfa == NULL || br->rdfa == NULL) {
+            snprintf(errmsg, sizeof(errmsg),
+                     "regex not supported by -engine dfa: %s", br->pattern);
+            return errmsg;
+        }
+        br->dfa_head = -1;
+    }
+#ifndef REG_STARTEND
+    /* regexec() would stop at the first NUL byte, and there's no NUL after
+     * the data in `rawbuf' */
+    if (br->dfa == NULL && (g.conn->pass.expflags & PASS_EXPECT_RAW) != 0) {
+        return "-raw -re needs REG_STARTEND (try -engine dfa)";
+    }
+#endif
+
+    return NULL;
+}
+
+/*
+ * Find out how much of the already scanned data needs to be scanned again
+ * when new data comes in.
+ */
+static void
+serv_analyze_pattern(struct pass_branch * br)
+{
+    ere_t * re;
+    char * req;
+
+    br->scanned = 0;
+    br->overlap = -1;
+    br->oneline = false;
+
+    if (br->type == PASS_EXPECT_EXACT) {
+        br->overlap = br->patlen - 1;
+        br->oneline = memchr(br->pattern, '\n', br->patlen) == NULL;
+    } else if (br->type == PASS_EXPECT_ERE) {
+        re = ere_parse(br->pattern, serv_ere_flags() );
+        if (re == NULL) {
+            debug("cannot analyze the pattern, always scan from the start");
+            return;
+        }
+
+        /* Not `maxlen - 1' as assertions like `$' and `\B' at the end of a
+         * match depend on the next char. */
+        br->overlap = ere_maxlen(re);
+        br->oneline = ! ere_can_match(re, '\n');
+
+        br->maxlen = ere_maxlen(re);
+        if (br->dfa == NULL && (req = ere_required(re) ) != NULL) {
+            ms_init( & br->lit, req, strlen(req),
+                    (g.conn->pass.expflags & PASS_EXPECT_ICASE) != 0);
+            br->has_lit = true;
+            debug("required literal: ``%s''", req);
+            free(req);
+        }
+        ere_free(re);
+    }
+
+    debug("pattern overlap = %d, oneline = %d", br->overlap, br->oneline);
+}
+
+/*
+ * Add a pattern (TAG_BRANCH) to the current pass.
+ *
+ * RETURN: an error message if the pattern is invalid, or NULL.
+ */
+static char *
+serv_add_branch(ttlv_t * branch)
+{
+    struct pass_branch * br;
+    ttlv_t * t;
+    char * errmsg;
+
+    br = & g.conn->pass.branches[g.conn->pass.nbranches++];
+    memset(br, 0, sizeof(* br) );
+
+    t = ttlv_find_child(branch, TAG_EXP_FLAGS);
+    br->type = t->v_int;
+    /* -raw -exact patterns may include NUL bytes */
+    t = ttlv_find_child(branch, TAG_PATTERN);
+    br->patlen = t->length;
+    br->pattern = malloc(br->patlen + 1);
+    if (br->pattern == NULL) {
+        fatal_sys("malloc");
+    }
+    memcpy(br->pattern, t->v_text, br->patlen + 1);
+
+    if (br->type == PASS_EXPECT_EXACT) {
+        ms_init( & br->ms, br->pattern, br->patlen,
+                (g.conn->pass.expflags & PASS_EXPECT_ICASE) != 0);
+    }
+    if ( (errmsg = serv_compile_pattern(br) ) != NULL) {
+        return errmsg;
+    }
+    serv_analyze_pattern(br);
+
+    return NULL;
+}
+
+/*
+ * Match all the -exact patterns in one go if there are more than one.
+ */
+static void
+serv_build_acm(void)
+{
+    struct pass_branch * br;
+    int i, nexact = 0;
+
+    for (i = 0; i < g.conn->pass.nbranches; ++i) {
+        if (g.conn->pass.branches[i].type == PASS_EXPECT_EXACT) {
+            ++nexact;
+        }
+    }
+    if (nexact < 2) {
+        return;
+    }
+
+    g.conn->pass.acm = acm_new( (g.conn->pass.expflags & PASS_EXPECT_ICASE) != 0);
+    for (i = 0; i < g.conn->pass.nbranches; ++i) {
+        br = & g.conn->pass.branches[i];
+        if (br->type == PASS_EXPECT_EXACT) {
+            acm_add(g.conn->pass.acm, br->pattern, br->patlen, i);
+        }
+    }
+    acm_build(g.conn->pass.acm);
+    g.conn->pass.acm_state = 0;
+    g.conn->pass.acm_pos = 0;
+
+    debug("%d exact patterns, %d states", nexact, g.conn->pass.acm->nstates);
+}
+
+/* $expect_out(N,string) */
+static void
+serv_send_expout(int index)
+{
+    ttlv_t * msg_out;
+    char * text = g.expout[index] != NULL ? g.expout[index] : "";
+    int len = g.expoutlen[index];
+
+    /* a match may be larger than what a message can carry so send the
+     * leading part as TAG_OUTPUT */
+    for ( ; len > MAX_OUTPUT_CHUNK && is_CONNECTED;
+          text += MAX_OUTPUT_CHUNK, len -= MAX_OUTPUT_CHUNK) {
+        serv_msg_send_raw(TAG_OUTPUT, text, MAX_OUTPUT_CHUNK);
+    }
+    if (not_CONNECTED) {
+        return;
+    }
+    msg_out = ttlv_new_text(TAG_EXPOUT_TEXT, len, text);
+    serv_msg_send(&msg_out, true);
+}
+
+static void   nul_index_add(const char * buf, int len);
+static void   nl_index_add(const char * buf, int len);
+static char * exp_view(int64_t from, int64_t * head, int64_t * total);
+static int    serv_send_output(int64_t from, int64_t to);
+
 static void
 serv_process_msg(void)
 {
@@ -313,21 +1035,43 @@ serv_process_msg(void)
 
         break;
 
+    case TAG_SEND_FD:
+        {
+            /* [<] serv_msg_recv() has taken the fd */
+            if (g.conn->send_fd < 0) {
+                msg_out = serv_new_error(ERROR_PROTO, "no fd with TAG_SEND_FD");
+                serv_msg_send(&msg_out, true);
+                break;
+            }
+            if ( ! g.conn->streaming) {
+                g.conn->send_offset = g.ntotal;
+            }
+            g.conn->streaming = true;
+            g.conn->send_left = msg_in->v_long > 0 ? msg_in->v_long : -1;
+
+            /* read in serv_read_sendfds() */
+            break;
+        }
+
     case TAG_SEND:
+    case TAG_SEND_MORE:
     case TAG_INPUT:
         {
             if (is_PTM_OPEN) {
-                int nwritten = write(g.fd_ptm, msg_in->v_raw, msg_in->length);
-                if (nwritten < 0) {
-                    debug("write(ptm): %s (%d)", strerror(errno), errno);
-                } else if (nwritten < msg_in->length) {
-                    debug("write(ptm) returned %d (< %d)", nwritten, msg_in->length);
-                }
+                inq_add( (char *) msg_in->v_raw, msg_in->length);
+                serv_write_ptm();
+            }
+            if (msg_in->tag != TAG_INPUT && ! g.conn->streaming) {
+                /* whatever the input causes comes after this */
+                g.conn->send_offset = g.ntotal;
             }
+            /* flow control, see serv_watch() */
+            g.conn->streaming = (msg_in->tag == TAG_SEND_MORE);
+
             if (msg_in->tag == TAG_SEND) {
-                /* FIXME: send back data which are not written to the ptm */
-                msg_out = ttlv_new_struct(TAG_ACK);
-                serv_msg_send(&msg_out, true);
+                /* acked by serv_ack_sends() */
+                g.conn->sending = true;
+                g.conn->send_until = g.inq.total;
             }
 
             break;
@@ -336,35 +1080,95 @@ serv_process_msg(void)
     case TAG_PASS:
         {
             ttlv_t * t = NULL;
+            char * errmsg;
+            int nbranches = 0;
 
-            g.conn.passing = true;
+            serv_free_pass();
+            g.conn->passing = true;
+            g.conn->pass.head = g.exphead;
+            g.conn->pass.sent = g.rawnew;
 
             t = ttlv_find_child(msg_in, TAG_PASS_SUBCMD);
-            g.conn.pass.subcmd = t->v_int;
+            g.conn->pass.subcmd = t->v_int;
 
             t = ttlv_find_child(msg_in, TAG_EXP_FLAGS);
-            g.conn.pass.expflags = t->v_int;
-
-            /* {expect|interact} with a pattern */
-            if ( (t = ttlv_find_child(msg_in, TAG_PATTERN) ) != NULL) {
-                g.conn.pass.pattern = strdup( (char *) t->v_text);
+            g.conn->pass.expflags = t->v_int;
 
-                free_expect_out();
+            /* {expect|interact} with patterns */
+            errmsg = NULL;
+            for (t = msg_in->child; t != NULL; t = t->next) {
+                if (t->tag == TAG_BRANCH) {
+                    ++nbranches;
+                }
             }
-
-            /* expect -timeout */
-            if ( (t = ttlv_find_child(msg_in, TAG_EXP_TIMEOUT) ) != NULL) {
-                g.conn.pass.timeout = t->v_int;
-            } else {
-                g.conn.pass.timeout = g.cmdopts->spawn.def_timeout;
+            if (nbranches > MAX_BRANCH) {
+                errmsg = "too many patterns";
+            } else if (nbranches > 0) {
+                g.conn->pass.branches = calloc(nbranches,
+                                               sizeof(struct pass_branch) );
+                if (g.conn->pass.branches == NULL) {
+                    fatal_sys("calloc");
+                }
             }
-
+            for (t = msg_in->child; t != NULL && errmsg == NULL; t = t->next) {
+                if (t->tag == TAG_BRANCH) {
+                    errmsg = serv_add_branch(t);
+                }
+            }
+            if (errmsg != NULL) {
+                debug("%s", errmsg);
+                msg_out = serv_new_error(ERROR_USAGE, errmsg);
+                serv_msg_send(&msg_out, true);
+
+                g.conn->passing = false;
+                serv_free_pass();
+
+                break;
+            }
+            if (has_PATTERN) {
+                serv_build_acm();
+
+                free_expect_out();
+            }
+
+            /* expect -timeout */
+            if ( (t = ttlv_find_child(msg_in, TAG_EXP_TIMEOUT) ) != NULL) {
+                g.conn->pass.timeout = t->v_int;
+            } else {
+                g.conn->pass.timeout = g.cmdopts->spawn.def_timeout;
+            }
+
             /* {interact|expect} -lookback */
             if ( (t = ttlv_find_child(msg_in, TAG_LOOKBACK) ) != NULL) {
                 if (t->v_int > 0) {
-                    g.conn.pass.lookback = t->v_int;
+                    g.conn->pass.lookback = t->v_int;
                 }
             }
+            if ( (t = ttlv_find_child(msg_in, TAG_LOOKBACK_UNIT) ) != NULL) {
+                g.conn->pass.lookback_unit = t->v_int;
+            }
+
+            /* expect -since: no earlier than what's still in memory */
+            if ( (t = ttlv_find_child(msg_in, TAG_EXP_SINCE) ) != NULL) {
+                g.conn->pass.head = MIN(MAX(t->v_long, g.rawoffset), g.ntotal);
+            }
+
+            /* expect -from */
+            if ( (t = ttlv_find_child(msg_in, TAG_EXP_FROM) ) != NULL) {
+                if (t->v_long < g.rawoffset) {
+                    snprintf(buf, sizeof(buf),
+                             "offset %lld is no longer in memory (oldest: %lld)",
+                             (long long) t->v_long, (long long) g.rawoffset);
+                    msg_out = serv_new_error(ERROR_USAGE, buf);
+                    serv_msg_send(&msg_out, true);
+
+                    g.conn->passing = false;
+                    serv_free_pass();
+
+                    break;
+                }
+                g.conn->pass.head = MIN(t->v_long, g.ntotal);
+            }
 
             break;
         }
@@ -374,16 +1178,51 @@ serv_process_msg(void)
             int index = msg_in->v_int;
 
             if (index >= 0 && index < EXPECT_OUT_NUM) {
-                if (g.expout[index] != NULL) {
-                    msg_out = ttlv_new_text(TAG_EXPOUT_TEXT,
-                        strlen(g.expout[index]),
-                        g.expout[index]);
-                } else {
-                    msg_out = ttlv_new_text(TAG_EXPOUT_TEXT, 0, "");
+                serv_send_expout(index);
+            } else {
+                snprintf(buf, sizeof(buf), "index must be in range 0-%d",
+                         EXPECT_OUT_NUM - 1);
+                msg_out = serv_new_error(ERROR_USAGE, buf);
+                serv_msg_send(&msg_out, true);
+            }
+
+            break;
+        }
+
+    case TAG_EXPOUT_NAME:
+        {
+            char * name = (char *) msg_in->v_text;
+            int index;
+
+            for (index = 0; index < EXPECT_OUT_NUM; ++index) {
+                if (g.expname[index] != NULL && streq(g.expname[index], name) ) {
+                    break;
                 }
+            }
+            if (index < EXPECT_OUT_NUM) {
+                serv_send_expout(index);
             } else {
-                msg_out = serv_new_error(ERROR_USAGE, "index must in range 0-9");
+                snprintf(buf, sizeof(buf), "no such named group: %s", name);
+                msg_out = serv_new_error(ERROR_USAGE, buf);
+                serv_msg_send(&msg_out, true);
             }
+
+            break;
+        }
+
+    case TAG_EXPOUT_OFFSET:
+        {
+            snprintf(buf, sizeof(buf), "%lld", (long long) g.expend);
+            msg_out = ttlv_new_text(TAG_EXPOUT_TEXT, strlen(buf), buf);
+            serv_msg_send(&msg_out, true);
+
+            break;
+        }
+
+    case TAG_EXPOUT_BRANCH:
+        {
+            snprintf(buf, sizeof(buf), "%d", g.expbranch);
+            msg_out = ttlv_new_text(TAG_EXPOUT_TEXT, strlen(buf), buf);
             serv_msg_send(&msg_out, true);
 
             break;
@@ -421,8 +1260,7 @@ serv_process_msg(void)
 
     case TAG_CLOSE:
         if (is_PTM_OPEN) {
-            close(g.fd_ptm);
-            g.fd_ptm = -1;
+            serv_close_ptm();
         }
         msg_out = ttlv_new_struct(TAG_ACK);
         serv_msg_send(&msg_out, true);
@@ -463,6 +1301,32 @@ serv_process_msg(void)
             if ( (t = ttlv_find_child(msg_in, TAG_IDLETIME) ) != NULL) {
                 g.cmdopts->spawn.idle = t->v_int;
             }
+            if (ttlv_find_child(msg_in, TAG_BUFSIZE) != NULL
+                || ttlv_find_child(msg_in, TAG_HISTORY) != NULL) {
+                int bufsize = g.cmdopts->spawn.bufsize;
+                int history = g.cmdopts->spawn.history;
+                char * errmsg;
+
+                if ( (t = ttlv_find_child(msg_in, TAG_BUFSIZE) ) != NULL) {
+                    bufsize = t->v_int;
+                }
+                if ( (t = ttlv_find_child(msg_in, TAG_HISTORY) ) != NULL) {
+                    history = t->v_int;
+                }
+                if ( (errmsg = bufsize_check(bufsize, history) ) != NULL) {
+                    msg_out = serv_new_error(ERROR_USAGE, errmsg);
+                    serv_msg_send(&msg_out, true);
+
+                    break;
+                }
+
+                /* the storage grows on demand and is never shrunk. if there's
+                 * more data than the new size it'll be dropped as old data
+                 * gets consumed. */
+                g.cmdopts->spawn.bufsize = bufsize;
+                g.cmdopts->spawn.history = history;
+                g.rawbuf.cap = bufsize;
+            }
 
             msg_out = ttlv_new_struct(TAG_ACK);
             serv_msg_send(&msg_out, true);
@@ -472,10 +1336,26 @@ serv_process_msg(void)
 
     case TAG_INFO:
         {
+            ttlv_t * t;
+            int64_t head, total;
+            char * expbuf;
             int n_expbuf = 0;
 
-            buf_raw2expect();
-            n_expbuf = MIN(g.expcnt, MAX_EXPBUF_PEEK);
+            /* get -range */
+            if ( (t = ttlv_find_child(msg_in, TAG_RANGE_OFF) ) != NULL) {
+                int64_t from = t->v_long;
+                int64_t len = ttlv_find_child(msg_in, TAG_RANGE_LEN)->v_long;
+
+                if (from < 0) {
+                    from = MAX(0, g.ntotal + from);
+                }
+                if (serv_send_output(from, from + MIN(len, g.ntotal - from) ) < 0) {
+                    break;
+                }
+            }
+
+            expbuf = exp_view(g.exphead, & head, & total);
+            n_expbuf = MIN(total - head, MAX_EXPBUF_PEEK);
 
             msg_out = ttlv_new_struct(TAG_INFO);
 
@@ -490,7 +1370,10 @@ serv_process_msg(void)
                 ttlv_new_int(TAG_TTL,         g.cmdopts->spawn.ttl),
                 ttlv_new_int(TAG_IDLETIME,    g.cmdopts->spawn.idle),
                 ttlv_new_int(TAG_ZOMBIE_TTL,  g.cmdopts->spawn.zombie_idle),
-                ttlv_new_raw(TAG_EXPBUF,      n_expbuf, g.expbuf + g.expcnt - n_expbuf),
+                ttlv_new_int(TAG_BUFSIZE,     g.cmdopts->spawn.bufsize),
+                ttlv_new_int(TAG_HISTORY,     g.cmdopts->spawn.history),
+                ttlv_new_raw(TAG_EXPBUF,      n_expbuf,
+                             expbuf + (total - head - n_expbuf) ),
                 NULL);
             serv_msg_send( & msg_out, true);
 
@@ -501,26 +1384,44 @@ serv_process_msg(void)
     msg_free(&msg_in);
 }
 
-static void
-serv_read_ptm(void)
+/*
+ * One read() from ptm, of at most `max' bytes.
+ *
+ * RETURN:
+ *   # of bytes read, or 0 if there's nothing more to read for now.
+ */
+static int
+serv_read_ptm_once(int max)
 {
     int nread, ntoread;
-    int oldcnt;
-
-    oldcnt = g.rawnew - g.rawbuf;
+    char * dst;
 
     while (true) {
-        ntoread = g.rawbufsize - (g.newcnt + oldcnt);
+        ntoread = (int64_t) g.rawbuf.cap - (g.ntotal - g.rawoffset);
 
         /* I used to be stupid and forget to check `== 0'. */
-        if (ntoread == 0) {
+        if (ntoread <= 0) {
             /* raw buffer full */
-            return;
+            return 0;
+        }
+
+        /* grow the buffer only when it's getting full */
+        ntoread = MIN(ntoread,
+                      MAX(rb_avail( & g.rawbuf, g.rawoffset, g.ntotal), PTM_READ_MIN) );
+        ntoread = MIN(ntoread, max);
+        dst = rb_reserve( & g.rawbuf, g.rawoffset, g.ntotal, ntoread);
+        if (dst == NULL) {
+            ntoread = rb_avail( & g.rawbuf, g.rawoffset, g.ntotal);
+            debug("cannot grow rawbuf (%s), %d bytes left",
+                  strerror(errno), ntoread);
+            if (ntoread == 0) {
+                return 0;
+            }
+            dst = rb_reserve( & g.rawbuf, g.rawoffset, g.ntotal, ntoread);
         }
 
         /* cannot use `readn()' here as it's in non-blocking mode */
-        nread = read(g.fd_ptm, g.rawnew + g.newcnt,
-                     g.rawbufsize - (g.newcnt + oldcnt) );
+        nread = read(g.fd_ptm, dst, ntoread);
         if (nread > 0) {
             break;
         }
@@ -541,7 +1442,7 @@ serv_read_ptm(void)
                     continue;
                 } else if (errno == EAGAIN) {
                     debug("read(ptm) returned EAGAIN");
-                    return;
+                    return 0;
                 } else {
                     /* other fatal errors */
                     debug("read(ptm) returned -1: %s (%d)", strerror(errno), errno);
@@ -549,308 +1450,930 @@ serv_read_ptm(void)
             }
 
             debug("close(ptm)");
-            close(g.fd_ptm);
-            g.fd_ptm = -1;
+            serv_close_ptm();
 
-            return;
+            return 0;
         }
     }
 
     /* logfile */
     if (g.cmdopts->spawn.logfd >= 0) {
         /* ignore any errors */
-        write(g.cmdopts->spawn.logfd, g.rawnew + g.newcnt, nread);
+        write(g.cmdopts->spawn.logfd, dst, nread);
     }
 
-    g.newcnt += nread;
+    nul_index_add(dst, nread);
+    nl_index_add(dst, nread);
     g.ntotal += nread;
+    * RAW_AT(g.ntotal) = '\0';
+
+    return nread;
 }
 
+/*
+ * Ack the `send's whose data have been written to ptm (or are within the
+ * -sendq limit), or which will never be.
+ */
 static void
-drop_old_data(void)
+serv_ack_sends(void)
 {
-    int oldcnt, dropsize;
+    ttlv_t * msg_out;
+    int i;
 
-    /* keep at most MAX_OLD_DATA old raw data */
-    oldcnt = g.rawnew - g.rawbuf;
-    if (oldcnt > MAX_OLD_DATA) {
-        dropsize = oldcnt - MAX_OLD_DATA;
-        oldcnt = MAX_OLD_DATA;
+    for (i = 0; i < g.nconns; ++i) {
+        g.conn = g.conns[i];
+        if (is_CONNECTED && g.conn->sending
+            && g.inq.written + g.cmdopts->spawn.sendq >= g.conn->send_until) {
+            g.conn->sending = false;
 
-        memmove(g.rawbuf, g.rawbuf + dropsize, oldcnt + g.newcnt);
-        g.rawnew -= dropsize;
-        g.rawoffset += dropsize;
+            msg_out = ttlv_new_struct(TAG_ACK);
+            ttlv_append_child(msg_out,
+                ttlv_new_long(TAG_OUTPUT_OFFSET, g.conn->send_offset), NULL);
+            serv_msg_send(&msg_out, true);
+        }
     }
+    g.conn = & g.noconn;
+}
+
+/*
+ * Read from ptm till EAGAIN, `rawbuf' is full or PTM_DRAIN_MAX bytes (the
+ * read budget in hub mode, so the other sessions get their turns) have been
+ * read. A Linux pty gives at most 4K per read() so this saves a round of
+ * matching and a TAG_OUTPUT for every 4K from a fast child.
+ */
+static void
+serv_read_ptm(void)
+{
+    int budget, nread;
 
-    /* keep at most MAX_OLD_DATA expect buffer data */
-    if (g.expcnt > MAX_OLD_DATA) {
-        dropsize = g.expcnt - MAX_OLD_DATA;
+    budget = g.read_budget > 0 ? g.read_budget : PTM_DRAIN_MAX;
+    while (budget > 0 && is_PTM_OPEN) {
+        nread = serv_read_ptm_once(budget);
+        if (nread == 0) {
+            break;
+        }
+        budget -= nread;
 
-        memmove(g.expbuf, g.expbuf + dropsize,  MAX_OLD_DATA);
-        g.expcnt = MAX_OLD_DATA;
-        g.expbuf[g.expcnt] = '\0';
+        /* not worth a read() for a few bytes, pass what we have first */
+        if ( (int64_t) g.rawbuf.cap - (g.ntotal - g.rawoffset) < PTM_READ_MIN) {
+            break;
+        }
     }
 }
 
-/* copy to "expect" buffer with NULL bytes removed */
-static void
-buf_raw2expect(void)
+/*
+ * # of NULs before `off' (which is still in `rawbuf').
+ */
+static int64_t
+nuls_before(int64_t off)
 {
-    int i, ncopy;
-    char * copy_start;
+    struct nul_run * run;
+    int lo = g.nul_start, hi = g.nul_end, mid;
+
+    /* the first run at or after `off' */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (g.nulruns[mid].pos < off) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == g.nul_start) {
+        return lo < g.nul_end ? g.nulruns[lo].before : g.nultotal;
+    }
 
-    if (g.expoffset < g.rawoffset) {
-        g.expoffset = g.rawoffset;
-        g.expcnt = 0;
+    run = & g.nulruns[lo - 1];
+    return run->before + MIN(run->len, off - run->pos);
+}
+
+/* offset -> expect offset */
+#define EXP_OFF(off)    ( (off) - nuls_before(off) )
+
+/*
+ * expect offset -> offset, the NULs at `eoff' are not included. (All the
+ * NULs of a run are at the same expect offset.)
+ */
+static int64_t
+raw_off(int64_t eoff)
+{
+    struct nul_run * run;
+    int lo = g.nul_start, hi = g.nul_end, mid;
+
+    /* the first run at or after `eoff' */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        run = & g.nulruns[mid];
+        if (run->pos - run->before < eoff) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == g.nul_start) {
+        return eoff + (lo < g.nul_end ? g.nulruns[lo].before : g.nultotal);
     }
 
-    ncopy = g.ntotal - g.expoffset;
-    assert(g.expcnt + ncopy <= g.expbufsize);
+    run = & g.nulruns[lo - 1];
+    return eoff + run->before + run->len;
+}
+
+/*
+ * Remember where the NULs are in new data (at `ntotal').
+ */
+static void
+nul_index_add(const char * buf, int len)
+{
+    const char * p = buf, * end = buf + len;
+    struct nul_run * run;
+    int64_t pos;
+    int n;
+
+    while ( (p = memchr(p, '\0', end - p) ) != NULL) {
+        for (n = 1; p + n < end && p[n] == '\0'; ++n) {
+        }
+        pos = g.ntotal + (p - buf);
 
-    g.expoffset = g.ntotal;
-    copy_start = g.rawnew + g.newcnt - ncopy;
-    for (i = 0; i < ncopy; ++i) {
-        if (copy_start[i] != '\0') {
-            g.expbuf[g.expcnt] = copy_start[i];
-            ++ g.expcnt;
+        run = g.nul_end > g.nul_start ? & g.nulruns[g.nul_end - 1] : NULL;
+        if (run != NULL && run->pos + run->len == pos) {
+            run->len += n;
+        } else {
+            run = index_push( & g.nulruns, & g.nul_start, & g.nul_end,
+                             & g.nul_cap, sizeof(g.nulruns[0]) );
+            run->pos = pos;
+            run->len = n;
+            run->before = g.nultotal;
         }
+        g.nultotal += n;
+        p += n;
     }
-    g.expbuf[g.expcnt] = '\0';
 }
 
-static bool
-expect_exact(void)
+/*
+ * Remember where the NLs are in new data (at `ntotal') and when it came in.
+ */
+static void
+nl_index_add(const char * buf, int len)
 {
-    int pattern_len;
-    char * found;
+    const char * p = buf, * end = buf + len;
+    struct read_mark * mark;
+    struct timespec now;
+
+    while ( (p = memchr(p, '\n', end - p) ) != NULL) {
+        * (int64_t *) index_push( & g.nls, & g.nl_start, & g.nl_end,
+                                 & g.nl_cap, sizeof(g.nls[0]) )
+            = g.ntotal + (p - buf);
+        ++p;
+    }
 
-    if ((g.conn.pass.expflags & PASS_EXPECT_ICASE) != 0) {
-        found = strcasestr(g.expbuf, g.conn.pass.pattern);
-    } else {
-        found = strstr(g.expbuf, g.conn.pass.pattern);
+    Clock_gettime( & now);
+    mark = g.mark_end > g.mark_start ? & g.marks[g.mark_end - 1] : NULL;
+    if (mark == NULL || Clock_diff( & mark->when, & now) >= LOOKBACK_MARK_SECS) {
+        mark = index_push( & g.marks, & g.mark_start, & g.mark_end,
+                          & g.mark_cap, sizeof(g.marks[0]) );
+        mark->when = now;
+        mark->pos = g.ntotal;
     }
-    if (found != NULL) {
-        pattern_len = strlen(g.conn.pass.pattern);
-        g.expcnt = strlen(found + pattern_len);
-        memmove(g.expbuf, found + pattern_len, g.expcnt);
-        g.expbuf[g.expcnt] = '\0';
+}
 
-        free_expect_out();
-        g.expout[0] = strdup(g.conn.pass.pattern);
+static void
+drop_old_data(void)
+{
+    int history = g.cmdopts->spawn.history;
+    struct serv_conn * c;
+    int i;
 
-        return true;
+    /* keep at most `history' old raw data, the rest goes to the scrollback */
+    if (g.rawnew - g.rawoffset > history) {
+        if (g.sb.fd >= 0 && sb_append( & g.sb, RAW_AT(g.rawoffset),
+                                      g.rawnew - history - g.rawoffset) < 0) {
+            debug("write(scrollback): %s (%d)", strerror(errno), errno);
+            sb_close( & g.sb);
+        }
+        g.rawoffset = g.rawnew - history;
     }
 
-    return false;
+    /* keep at most `history' data not matched yet */
+    if (g.ntotal - g.exphead > history) {
+        g.exphead = g.ntotal - history;
+    }
+    g.exphead = MAX(g.exphead, g.rawoffset);
+    for (i = 0; i < g.nconns; ++i) {
+        c = g.conns[i];
+        if (c->sock >= 0 && c->passing) {
+            c->pass.head = MAX(c->pass.head, MAX(g.ntotal - history, g.rawoffset) );
+        }
+    }
+
+    while (g.nul_start < g.nul_end
+           && g.nulruns[g.nul_start].pos + g.nulruns[g.nul_start].len <= g.rawoffset) {
+        ++g.nul_start;
+    }
+    while (g.nl_start < g.nl_end && g.nls[g.nl_start] < g.rawoffset) {
+        ++g.nl_start;
+    }
+    while (g.mark_end - g.mark_start > 1
+           && g.marks[g.mark_start + 1].pos <= g.rawoffset) {
+        if (g.sb.fd >= 0) {
+            sb_mark( & g.sb, & g.marks[g.mark_start].when,
+                    g.marks[g.mark_start].pos);
+        }
+        ++g.mark_start;
+    }
 }
 
-static bool
-expect_glob(void)
+/*
+ * Where the earliest of the expects in progress (or the next one) starts.
+ */
+static int64_t
+exp_oldest(void)
 {
-    bug("server side should never see PASS_EXPECT_GLOB");
-    return false;
+    struct serv_conn * c;
+    int64_t oldest = g.exphead;
+    int i;
+
+    for (i = 0; i < g.nconns; ++i) {
+        c = g.conns[i];
+        if (c->sock >= 0 && c->passing && c->pass.nbranches > 0) {
+            oldest = MIN(oldest, c->pass.head);
+        }
+    }
+
+    return oldest;
 }
 
-static bool
-expect_ere(void)
+/*
+ * The data from `from' with the NUL bytes removed, [* head, * total) in
+ * expect offsets. The copy is shared by all the expects in progress.
+ */
+static char *
+exp_view(int64_t from, int64_t * head, int64_t * total)
 {
-    regex_t re;
-    regmatch_t matches[EXPECT_OUT_NUM];
-    int reflags = REG_EXTENDED;
-    int i, ret, len;
-    bool nosub = false;
+    struct nul_run * last;
+    const char * src;
+    char * dst;
+    int n, need;
+    int64_t oldest, keep;
+
+    * head = EXP_OFF(from);
+    * total = g.ntotal - g.nultotal;
+
+    /* no NULs, the data is right there */
+    last = g.nul_end > g.nul_start ? & g.nulruns[g.nul_end - 1] : NULL;
+    if (last == NULL || last->pos + last->len <= from) {
+        oldest = exp_oldest();
+        if (last == NULL || last->pos + last->len <= oldest) {
+            free(g.strip.buf);
+            g.strip.buf = NULL;
+            g.strip.size = 0;
+        }
 
-    if ((g.conn.pass.expflags & PASS_EXPECT_NOSUB) != 0) {
-        nosub = true;
-    }
-    if ((g.conn.pass.expflags & PASS_EXPECT_ICASE) != 0) {
-        reflags |= REG_ICASE;
+        return RAW_AT(from);
     }
-    if ((g.conn.pass.expflags & PASS_EXPECT_NEWLINE) != 0) {
-        reflags |= REG_NEWLINE;
+
+    /* what's been copied is still useful unless a -raw match has gone past
+     * it. drop what's been matched (by all the expects) once in a while. */
+    keep = MIN(* head, EXP_OFF(exp_oldest() ) );
+    if (g.strip.buf == NULL || * head < g.strip.head || * head > g.strip.total
+        || g.strip.rawend < from) {
+        g.strip.head = g.strip.total = * head;
+        g.strip.rawend = from;
+    } else if (keep - g.strip.head > g.strip.size / 2) {
+        memmove(g.strip.buf, g.strip.buf + (keep - g.strip.head),
+                g.strip.total - keep);
+        g.strip.head = keep;
     }
 
-    ret = regcomp( & re, g.conn.pass.pattern, reflags);
-    if (ret != 0) {
-        return false;
+    /* copy the new data */
+    n = g.ntotal - g.strip.rawend;
+    need = (g.strip.total - g.strip.head) + n + 1;
+    if (need > g.strip.size) {
+        g.strip.size = MAX(need, g.strip.size * 2);
+        g.strip.buf = realloc(g.strip.buf, g.strip.size);
+        if (g.strip.buf == NULL) {
+            fatal_sys("realloc");
+        }
     }
+    src = RAW_AT(g.strip.rawend);
+    dst = g.strip.buf + (g.strip.total - g.strip.head);
+    dst += ns_strip(dst, src, n);
+    * dst = '\0';
+    g.strip.total = g.strip.head + (dst - g.strip.buf);
+    g.strip.rawend = g.ntotal;
+
+    return g.strip.buf + (* head - g.strip.head);
+}
 
-    ret = regexec( & re, g.expbuf, EXPECT_OUT_NUM, matches, 0);
-    regfree( & re);
-    if (ret != 0) {
-        return false;
+/*
+ * Point the matchers at the data not matched yet: with NUL bytes removed
+ * (see exp_view()), or as is for -raw.
+ */
+static void
+serv_match_view(void)
+{
+    if ((g.conn->pass.expflags & PASS_EXPECT_RAW) == 0) {
+        g.conn->pass.mbase = exp_view(g.conn->pass.head, & g.conn->pass.mhead,
+                                      & g.conn->pass.mtotal);
+    } else {
+        g.conn->pass.mbase = RAW_AT(g.conn->pass.head);
+        g.conn->pass.mhead = g.conn->pass.head;
+        g.conn->pass.mtotal = g.ntotal;
     }
+}
 
-    /* $expect_out(N,string) */
-    if ( ! nosub) {
-        free_expect_out();
+/*
+ * Where to start scanning the expect buffer.
+ */
+static int64_t
+expect_scan_from(struct pass_branch * br)
+{
+    return MAX(MATCH_HEAD, br->scanned);
+}
 
-        for (i = 0; i < EXPECT_OUT_NUM; ++i) {
-            if (matches[i].rm_so == -1) {
-                continue;
-            }
+/*
+ * [from, MATCH_TOTAL) has been scanned without a match.
+ */
+static void
+expect_scan_failed(struct pass_branch * br, int64_t from)
+{
+    int64_t next = MATCH_HEAD;
+    char * start, * pc;
 
-            len = matches[i].rm_eo - matches[i].rm_so;
-            g.expout[i] = malloc(len + 1);
-            memcpy(g.expout[i], g.expbuf + matches[i].rm_so, len);
-            g.expout[i][len] = 0;
+    if (br->overlap >= 0) {
+        next = MAX(next, MATCH_TOTAL - br->overlap);
+    }
+    if (br->oneline) {
+        /* only the last (incomplete) line can still have a match */
+        start = MATCH_AT(from);
+        for (pc = start + (MATCH_TOTAL - from) - 1; pc >= start; --pc) {
+            if (* pc == '\n') {
+                next = MAX(next, from + (pc - start) + 1);
+                break;
+            }
         }
     }
 
-    g.expcnt = strlen(g.expbuf + matches[0].rm_eo);
-    memmove(g.expbuf, g.expbuf + matches[0].rm_eo, g.expcnt);
-    g.expbuf[g.expcnt] = '\0';
+    br->scanned = MAX(br->scanned, next);
+}
 
-    return true;
+/*
+ * The match is [* so, * eo) (in MATCH_TOTAL bytes).
+ */
+static bool
+expect_exact(struct pass_branch * br, int64_t * so, int64_t * eo)
+{
+    int64_t from;
+    int found;
+
+    from = expect_scan_from(br);
+    found = ms_find( & br->ms, MATCH_AT(from), MATCH_TOTAL - from);
+    if (found >= 0) {
+        * so = from + found;
+        * eo = * so + br->patlen;
+
+        return true;
+    }
+
+    expect_scan_failed(br, from);
+    return false;
 }
 
+/*
+ * All the -exact patterns at once. The one which ends first wins.
+ */
 static bool
-serv_expect(void)
+expect_exact_set(int * index, int64_t * so, int64_t * eo)
 {
-    if (g.expcnt == 0 && not_PTM_OPEN) {
-        /* ptm is closed and there's no data in expect buf */
-        return false;
+    acm_t * ac = g.conn->pass.acm;
+    int64_t pos = g.conn->pass.acm_pos;
+    int state = g.conn->pass.acm_state;
+    int n;
+
+    /* start over if the partial match the state stands for is no longer
+     * in the buffer */
+    if (pos - acm_depth(ac, state) < MATCH_HEAD) {
+        pos = MATCH_HEAD;
+        state = 0;
     }
 
-    if ((g.conn.pass.expflags & PASS_EXPECT_EXACT) != 0) {
-        return expect_exact();
-    } else if ((g.conn.pass.expflags & PASS_EXPECT_GLOB) != 0) {
-        return expect_glob();
-    } else if ((g.conn.pass.expflags & PASS_EXPECT_ERE) != 0) {
-        return expect_ere();
-    } else {
+    n = acm_scan(ac, & state, MATCH_AT(pos), MATCH_TOTAL - pos, index);
+    if (n < 0) {
+        g.conn->pass.acm_pos = MATCH_TOTAL;
+        g.conn->pass.acm_state = state;
+
         return false;
     }
+
+    * eo = pos + n;
+    * so = * eo - ac->lens[* index];
+    g.conn->pass.acm_pos = * eo;
+    g.conn->pass.acm_state = state;
+
+    return true;
 }
 
+/*
+ * Only the data not yet looked at is scanned (see gm_match()). The match is
+ * [* so, * eo) (in MATCH_TOTAL bytes).
+ */
 static bool
-exp_timed_out(void)
+expect_glob(struct pass_branch * br, int64_t * so, int64_t * eo)
 {
-    if (g.conn.pass.timeout < 0) {
-        return false;
-    } else if (g.conn.pass.timeout == 0) {
-        return true;
+    int s, e;
+
+    /* start over if data has been dropped */
+    if (br->glob_head != MATCH_HEAD) {
+        br->glob_head = MATCH_HEAD;
+        gm_reset( & br->glob_state);
     }
 
-    if (Clock_diff( & g.conn.pass.startime, NULL) > g.conn.pass.timeout) {
-        return true;
+    if ( ! gm_match(br->glob, & br->glob_state, MATCH_AT(MATCH_HEAD), MATCHCNT,
+                    & s, & e) ) {
+        return false;
     }
+    * so = MATCH_HEAD + s;
+    * eo = MATCH_HEAD + e;
 
-    return false;
+    return true;
 }
 
-static void
-serv_pass(void)
+/*
+ * -re with -engine dfa. Only the data not yet fed to the automaton is
+ * scanned. The match is the one which ends first (and, of those, the one
+ * which starts first) and there are no subexpression matches.
+ */
+static bool
+expect_dfa(struct pass_branch * br, regmatch_t * matches)
 {
-    ttlv_t * msg_out;
-    int exitstatus;
-    int lookback, newlines, nsend;
-    char * pc = NULL, * psend = NULL;
-
-    /* expect/interact/wait */
-    if (not_CONNECTED || ! is_PASSING) {
-        return;
+    int64_t pos = br->dfa_pos, eo;
+    int state = br->dfa_state;
+    int i, n, next;
+
+    /* start over if data has been dropped since the state was built as it
+     * may stand for matches starting there */
+    if (br->dfa_head != MATCH_HEAD) {
+        br->dfa_head = MATCH_HEAD;
+        pos = MATCH_HEAD;
+        state = dfa_start(br->dfa, -1);
     }
 
-    /* output from child */
-#if 1
-    lookback = g.conn.pass.lookback;
-    if (lookback <= 0) {
-        psend = g.rawnew;
+    n = dfa_feed(br->dfa, & state, MATCH_AT(pos), MATCH_TOTAL - pos);
+    br->dfa_state = state;
+    if (n >= 0) {
+        eo = pos + n;
+        next = (uint8_t) * MATCH_AT(eo);
+    } else if (dfa_at_end(br->dfa, state) ) {
+        eo = MATCH_TOTAL;
+        next = -1;
     } else {
-        /* don't forget this ! */
-        g.conn.pass.lookback = 0;
+        br->dfa_pos = MATCH_TOTAL;
+        return false;
+    }
+    br->dfa_pos = eo;
 
-        /* printf 'foo\nbar' | tail -n 1
-         *
-         *   vs.
-         *
-         * printf 'foo\nbar\n' | tail -n 1
-         */
-        if (g.ntotal > 0 && g.rawnew[g.newcnt - 1] == '\n') {
-            ++lookback;
-        }
+    matches[0].rm_so = dfa_rfind(br->rdfa, MATCH_AT(MATCH_HEAD), eo - MATCH_HEAD,
+                                 next);
+    matches[0].rm_eo = eo - MATCH_HEAD;
+    if (matches[0].rm_so < 0) {
+        bug("DFA match end without a start");
+    }
+    for (i = 1; i < EXPECT_OUT_NUM; ++i) {
+        matches[i].rm_so = matches[i].rm_eo = -1;
+    }
 
-        newlines = 0;
-        for (pc = g.rawnew + g.newcnt - 1; pc >= g.rawbuf; --pc) {
-            if (pc[0] == '\n') {
-                if (++newlines >= lookback) {
-                    break;
-                }
-            }
-        }
-        if (newlines == 0) {
-            /* [<] No NLs at all, e.g. the first shell prompt */
-            psend = g.rawbuf;
-        } else if (newlines < lookback) {
-            /* [<] There are not enough NLs in the whole buffer (old + new),
-             *     start from the first NL, or rawbuf if rawoffset is 0.
-             */
-            if (g.rawoffset == 0) {
-                psend = g.rawbuf;
-            } else {
-                /* find the first NL */
-                pc = strchr(g.rawbuf, '\n');
-                if (pc < g.rawnew) {
-                    /* [<] The fist NL is in the OLD buffer */
-                    psend = pc + 1;
-                } else {
-                    /* [<] The fist NL is in the NEW buffer */
-                    psend = g.rawnew;
-                }
-            }
-        } else {
-            /* [<] Found #lookback NLs, `pc' now points to a NL */
-            if (pc < g.rawnew) {
-                psend = pc + 1;
-            } else {
-                psend = g.rawnew;
-
-                /* start the output from the nearest NL before `rawnew'
-                 * if possible */
-                for (pc = g.rawnew - 1; pc >= g.rawbuf; --pc) {
-                    if (pc[0] == '\n') {
-                        psend = pc + 1;
-                        break;
-                    }
-                }
-                if (pc < g.rawbuf) {
-                    /* [<] No NLs in old buffer */
-                    if (g.rawoffset == 0) {
-                        psend = g.rawbuf;
-                    }
-                }
-            }
-        }
+    return true;
+}
+
+/*
+ * The matches are relative to MATCH_HEAD.
+ */
+static bool
+expect_ere(struct pass_branch * br, regmatch_t * matches)
+{
+    int ret, off, found;
+    char * expbuf = MATCH_AT(MATCH_HEAD);
+    int64_t from;
+
+    if (br->dfa != NULL) {
+        return expect_dfa(br, matches);
+    }
+    if ( ! br->has_re) {
+        bug("-re pattern not compiled");
     }
 
-    nsend = g.rawnew + g.newcnt - psend;
-    if (nsend > 0) {
-        msg_out = ttlv_new_raw(TAG_OUTPUT, nsend, psend);
-        if (serv_msg_send(&msg_out, true) < 0) {
-            return;
+    from = expect_scan_from(br);
+    off = from - MATCH_HEAD;
+    if (br->has_lit) {
+        found = ms_find( & br->lit, MATCH_AT(from), MATCH_TOTAL - from);
+        if (found < 0) {
+            ++br->lit_misses;
+            expect_scan_failed(br, from);
+            return false;
         }
+        ++br->lit_hits;
 
-        g.rawnew += g.newcnt;
-        g.newcnt = 0;
+        if (br->maxlen != ERE_INF) {
+            off = MAX(off, off + found + br->lit.len - br->maxlen);
+        }
     }
+#ifdef REG_STARTEND
+    /* The string still starts at `expbuf' so `^', `\b', ... see the same
+     * context as scanning from the start. */
+    matches[0].rm_so = off;
+    matches[0].rm_eo = MATCHCNT;
+    ret = regexec( & br->re, expbuf, EXPECT_OUT_NUM, matches, REG_STARTEND);
 #else
-    /* no -lookback support */
-    if (g.newcnt > 0) {
-        msg_out = ttlv_new_raw(TAG_OUTPUT, g.newcnt, g.rawnew);
-        if (serv_msg_send(&msg_out, true) < 0) {
-            return;
-        }
+    {
+        int i, eflags = 0;
 
-        g.rawnew += g.newcnt;
-        g.newcnt = 0;
+        if (off > 0 && ! ((g.conn->pass.expflags & PASS_EXPECT_NEWLINE) != 0
+                          && expbuf[off - 1] == '\n') ) {
+            eflags |= REG_NOTBOL;
+        }
+        ret = regexec( & br->re, expbuf + off, EXPECT_OUT_NUM, matches, eflags);
+        for (i = 0; ret == 0 && i < EXPECT_OUT_NUM; ++i) {
+            if (matches[i].rm_so != -1) {
+                matches[i].rm_so += off;
+                matches[i].rm_eo += off;
+            }
+        }
     }
 #endif
+    if (ret != 0) {
+        expect_scan_failed(br, from);
+        return false;
+    }
 
-    /* "expect" or "interact -re" */
-    if (has_PATTERN) {
-        /* copy data from raw buf to expect buf */
-        buf_raw2expect();
+    return true;
+}
+
+/*
+ * -pcre. A partial match (one which runs into the end of the data) is where
+ * the next scan starts. The matches are relative to MATCH_HEAD.
+ */
+static bool
+expect_pcre(struct pass_branch * br, regmatch_t * matches)
+{
+#ifdef HAVE_PCRE2
+    PCRE2_SIZE * ovector;
+    int64_t from;
+    int i, n, ret;
+
+    /* the subject still starts at MATCH_HEAD so lookbehinds, `^', `\b', ...
+     * see the same context as scanning from the start */
+    from = expect_scan_from(br);
+    ret = pcre2_match(br->pcre, (PCRE2_SPTR) MATCH_AT(MATCH_HEAD), MATCHCNT,
+                      from - MATCH_HEAD, PCRE2_PARTIAL_SOFT, br->pcre_md, NULL);
+    ovector = pcre2_get_ovector_pointer(br->pcre_md);
+    if (ret == PCRE2_ERROR_PARTIAL) {
+        br->scanned = MATCH_HEAD + ovector[0];
+        return false;
+    } else if (ret < 0) {
+        if (ret != PCRE2_ERROR_NOMATCH) {
+            debug("pcre2_match() failed (%d)", ret);
+        }
+        br->scanned = MATCH_TOTAL;
+        return false;
+    }
+
+    n = pcre2_get_ovector_count(br->pcre_md);
+    for (i = 0; i < EXPECT_OUT_NUM; ++i) {
+        if (i < n && ovector[2 * i] != PCRE2_UNSET) {
+            matches[i].rm_so = ovector[2 * i];
+            matches[i].rm_eo = ovector[2 * i + 1];
+        } else {
+            matches[i].rm_so = matches[i].rm_eo = -1;
+        }
+    }
+
+    return true;
+#else
+    bug("-pcre without PCRE2");
+    return false;
+#endif
+}
+
+/*
+ * Remember the names of the groups of the -pcre pattern which matched.
+ */
+static void
+serv_save_names(struct pass_branch * br)
+{
+#ifdef HAVE_PCRE2
+    PCRE2_SPTR table;
+    uint32_t count, size, i;
+    int index;
+
+    pcre2_pattern_info(br->pcre, PCRE2_INFO_NAMECOUNT, & count);
+    pcre2_pattern_info(br->pcre, PCRE2_INFO_NAMEENTRYSIZE, & size);
+    pcre2_pattern_info(br->pcre, PCRE2_INFO_NAMETABLE, & table);
+    for (i = 0; i < count; ++i, table += size) {
+        index = (table[0] << 8) | table[1];
+        if (index < EXPECT_OUT_NUM && g.expname[index] == NULL) {
+            g.expname[index] = strdup( (char *) table + 2);
+        }
+    }
+#endif
+}
+
+/*
+ * Try all the patterns. If more than one match, the match which ends first
+ * wins, and if they end at the same place, the pattern given first wins.
+ */
+static bool
+serv_expect(void)
+{
+    regmatch_t matches[EXPECT_OUT_NUM], best_matches[EXPECT_OUT_NUM];
+    struct pass_branch * br;
+    int i, len, index, best = -1;
+    int64_t so, eo, best_so = 0, best_eo = 0;
+    bool found;
+    char * expbuf;
+
+    serv_match_view();
+    if (MATCHCNT == 0 && not_PTM_OPEN) {
+        /* ptm is closed and there's no data in expect buf */
+        return false;
+    }
+
+    if (g.conn->pass.acm != NULL && expect_exact_set( & index, & so, & eo) ) {
+        best = index;
+        best_so = so;
+        best_eo = eo;
+    }
+
+    for (i = 0; i < g.conn->pass.nbranches; ++i) {
+        br = & g.conn->pass.branches[i];
+        if (br->type == PASS_EXPECT_EXACT) {
+            if (g.conn->pass.acm != NULL) {
+                continue;
+            }
+            found = expect_exact(br, & so, & eo);
+        } else if (br->type == PASS_EXPECT_GLOB) {
+            found = expect_glob(br, & so, & eo);
+        } else if (br->type == PASS_EXPECT_ERE || br->type == PASS_EXPECT_PCRE) {
+            if (br->type == PASS_EXPECT_ERE) {
+                found = expect_ere(br, matches);
+            } else {
+                found = expect_pcre(br, matches);
+            }
+            so = MATCH_HEAD + matches[0].rm_so;
+            eo = MATCH_HEAD + matches[0].rm_eo;
+        } else {
+            found = false;
+        }
+
+        if (found && (best < 0 || eo < best_eo || (eo == best_eo && i < best) ) ) {
+            best = i;
+            best_so = so;
+            best_eo = eo;
+            if (br->type == PASS_EXPECT_ERE || br->type == PASS_EXPECT_PCRE) {
+                memcpy(best_matches, matches, sizeof(matches) );
+            }
+        }
+    }
+    if (best < 0) {
+        return false;
+    }
+
+    /* $expect_out(N,string) */
+    br = & g.conn->pass.branches[best];
+    if (br->type == PASS_EXPECT_ERE || br->type == PASS_EXPECT_PCRE) {
+        if ((g.conn->pass.expflags & PASS_EXPECT_NOSUB) == 0) {
+            free_expect_out();
+
+            expbuf = MATCH_AT(MATCH_HEAD);
+            for (i = 0; i < EXPECT_OUT_NUM; ++i) {
+                if (best_matches[i].rm_so == -1) {
+                    continue;
+                }
+
+                len = best_matches[i].rm_eo - best_matches[i].rm_so;
+                g.expout[i] = malloc(len + 1);
+                memcpy(g.expout[i], expbuf + best_matches[i].rm_so, len);
+                g.expout[i][len] = 0;
+                g.expoutlen[i] = len;
+            }
+            if (br->type == PASS_EXPECT_PCRE) {
+                serv_save_names(br);
+            }
+        }
+    } else {
+        free_expect_out();
+        len = best_eo - best_so;
+        g.expout[0] = malloc(len + 1);
+        memcpy(g.expout[0], MATCH_AT(best_so), len);
+        g.expout[0][len] = 0;
+        g.expoutlen[0] = len;
+    }
+    g.expbranch = best + 1;
+
+    /* consume the matched data. the next expect starts after the furthest
+     * match, whichever client it was for. */
+    if ((g.conn->pass.expflags & PASS_EXPECT_RAW) != 0) {
+        g.conn->pass.head = best_eo;
+    } else {
+        g.conn->pass.head = MAX(g.conn->pass.head, raw_off(best_eo) );
+    }
+    g.exphead = MAX(g.exphead, g.conn->pass.head);
+    g.expend = g.conn->pass.head;
+
+    return true;
+}
+
+static bool
+exp_timed_out(void)
+{
+    if (g.conn->pass.timeout < 0) {
+        return false;
+    } else if (g.conn->pass.timeout == 0) {
+        return true;
+    }
+
+    if (Clock_diff( & g.conn->pass.startime, NULL) > g.conn->pass.timeout) {
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * The last NL before `off' (at or after `rawoffset'), or -1.
+ */
+static int64_t
+nl_before(int64_t off)
+{
+    int lo = g.nl_start, hi = g.nl_end, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (g.nls[mid] < off) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo > g.nl_start ? g.nls[lo - 1] : -1;
+}
+
+/*
+ * Where to start the output for -lookback. Old output is sent from the
+ * beginning of a line if possible, and all the new output is always sent.
+ */
+static int64_t
+lookback_start(void)
+{
+    int64_t nl, seq;
+    int64_t sent = g.conn->pass.sent;
+    int lookback = g.conn->pass.lookback;
+    int nnls = g.nl_end - g.nl_start;
+    int lo, hi, mid;
+    struct timespec cutoff;
+
+    switch (g.conn->pass.lookback_unit) {
+    case LOOKBACK_BYTES:
+        return MIN(sent, MAX(OLDEST_OFF, g.ntotal - lookback) );
+
+    case LOOKBACK_SECS:
+        /* the first mark not older than `lookback' seconds */
+        Clock_gettime( & cutoff);
+        cutoff.tv_sec -= lookback;
+        lo = g.mark_start;
+        hi = g.mark_end;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (g.marks[mid].when.tv_sec < cutoff.tv_sec
+                || (g.marks[mid].when.tv_sec == cutoff.tv_sec
+                    && g.marks[mid].when.tv_nsec < cutoff.tv_nsec) ) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == g.mark_end) {
+            return sent;
+        }
+        /* [<] All that's in memory is new enough, maybe older output too */
+        if (lo == g.mark_start && g.sb.fd >= 0
+            && (nl = sb_find_time( & g.sb, & cutoff) ) >= 0) {
+            return nl;
+        }
+        return MIN(sent, MAX(OLDEST_OFF, g.marks[lo].pos) );
+    }
+
+    /* printf 'foo\nbar' | tail -n 1
+     *
+     *   vs.
+     *
+     * printf 'foo\nbar\n' | tail -n 1
+     */
+    if (nnls > 0 && g.nls[g.nl_end - 1] == g.ntotal - 1) {
+        ++lookback;
+    }
+
+    if (nnls < lookback && g.sb.fd >= 0 && g.sb.tail > g.sb.head) {
+        /* [<] Not enough NLs in memory, find the NL in the scrollback */
+        seq = g.sb.nlcount + nnls - lookback;
+        if (seq < 0) {
+            return g.sb.head;
+        }
+        nl = sb_find_nl( & g.sb, seq);
+        return nl >= 0 ? nl + 1 : g.sb.head;
+    }
+
+    if (nnls == 0) {
+        /* [<] No NLs at all, e.g. the first shell prompt */
+        return g.rawoffset;
+    } else if (nnls < lookback) {
+        /* [<] There are not enough NLs in the whole buffer (old + new),
+         *     start from the first NL, or rawbuf if rawoffset is 0.
+         */
+        if (g.rawoffset == 0) {
+            return g.rawoffset;
+        }
+        nl = g.nls[g.nl_start];
+        return nl < sent ? nl + 1 : sent;
+    }
+
+    /* [<] Found #lookback NLs */
+    nl = g.nls[g.nl_end - lookback];
+    if (nl < sent) {
+        return nl + 1;
+    }
+
+    /* start the output from the nearest NL before `sent' if possible */
+    nl = nl_before(sent);
+    if (nl >= 0) {
+        return nl + 1;
+    }
+
+    /* [<] No NLs in old buffer */
+    return g.rawoffset == 0 ? g.rawoffset : sent;
+}
+
+/*
+ * Send the output [from, to) to the client, the part which has fallen off
+ * `rawbuf' from the scrollback. Each chunk goes out straight from rawbuf
+ * (or the scrollback), without copying.
+ */
+static int
+serv_send_output(int64_t from, int64_t to)
+{
+    const char * data;
+    int len;
+
+    for (from = MAX(from, OLDEST_OFF); from < to; from += len) {
+        if (from < g.rawoffset) {
+            data = sb_at( & g.sb, from, & len);
+            if (data == NULL) {
+                /* [<] mmap() failed */
+                len = g.rawoffset - from;
+                continue;
+            }
+            len = MIN(len, g.rawoffset - from);
+        } else {
+            data = RAW_AT(from);
+            len = to - from;
+        }
+        /* the buffer may be larger than what a message can carry */
+        len = MIN(len, MIN(to - from, MAX_OUTPUT_CHUNK) );
+
+        if (serv_msg_send_raw(TAG_OUTPUT, data, len) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+serv_pass(void)
+{
+    ttlv_t * msg_out;
+    int64_t from;
+
+    /* expect/interact/wait */
+    if (not_CONNECTED || ! is_PASSING) {
+        return;
+    }
+
+    /* output from child */
+    from = g.conn->pass.sent;
+    if (g.conn->pass.lookback > 0) {
+        from = lookback_start();
+
+        /* don't forget this ! */
+        g.conn->pass.lookback = 0;
+    }
+
+    if (from < g.ntotal) {
+        if (serv_send_output(from, g.ntotal) < 0) {
+            return;
+        }
+
+        g.conn->pass.sent = g.ntotal;
+        g.rawnew = g.ntotal;
     }
 
     /* "expect" or "interact" with a pattern */
@@ -859,42 +2382,43 @@ serv_pass(void)
             msg_out = ttlv_new_bool(TAG_MATCHED, 1);
             serv_msg_send(&msg_out, true);
 
-            g.conn.passing = false;
+            g.conn->passing = false;
 
             return;
         }
 
         /* interact, wait */
     } else if (is_INTERACT || is_WAIT) {
-        g.expoffset = g.ntotal - g.newcnt;
-        g.expcnt = 0;
+        g.exphead = g.rawnew;
     }
 
     /* Having received SIGCHLD does not necessarily mean EOF. There may still
      * data from the child for reading. So only report EOF when fd_ptm < 0.
      */
-    if (not_PTM_OPEN && g.newcnt == 0) {
-        if ((g.conn.pass.expflags & PASS_EXPECT_EOF) != 0) {
+    if (not_PTM_OPEN && NEWCNT == 0) {
+        if ((g.conn->pass.expflags & PASS_EXPECT_EOF) != 0) {
             /* [<] expect -eof */
 
-            g.expoffset = g.ntotal;
-            g.expcnt = 0;
+            g.exphead = g.ntotal;
 
             msg_out = ttlv_new_struct(TAG_EOF);
             serv_msg_send(&msg_out, true);
 
-            g.conn.passing = false;
-        } else if ( (g.conn.pass.expflags & PASS_EXPECT_EXIT) != 0) {
+            g.conn->passing = false;
+        } else if ( (g.conn->pass.expflags & PASS_EXPECT_EXIT) != 0) {
             /* [<] interact, wait */
 
-            if ( ! is_CHLD_WAITED && is_CHLD_DEAD) {
-                waitpid(g.child, &  exitstatus, 0);
-                g.waited = true;
+            if (is_CHLD_DEAD) {
+                /* [<] Other clients may be waiting too */
+                if ( ! is_CHLD_WAITED) {
+                    waitpid(g.child, & g.exitstatus, 0);
+                    g.waited = true;
+                }
 
-                msg_out = ttlv_new_int(TAG_EXITED, exitstatus);
+                msg_out = ttlv_new_int(TAG_EXITED, g.exitstatus);
                 serv_msg_send(&msg_out, true);
 
-                g.conn.passing = false;
+                g.conn->passing = false;
             } else {
                 /* wait for the child to exit */
             }
@@ -903,7 +2427,7 @@ serv_pass(void)
             msg_out = serv_new_error(ERROR_EOF, "PTY closed");
             serv_msg_send(&msg_out, true);
 
-            g.conn.passing = false;
+            g.conn->passing = false;
         }
 
         return;
@@ -914,7 +2438,7 @@ serv_pass(void)
         msg_out = serv_new_error(ERROR_TIMEOUT, "expect timed out");
         serv_msg_send(&msg_out, true);
 
-        g.conn.passing = false;
+        g.conn->passing = false;
 
         return;
     }
@@ -923,24 +2447,370 @@ serv_pass(void)
 static void
 serv_cleanup_conn(void)
 {
-    if (g.conn.pass.pattern != NULL) {
-        free(g.conn.pass.pattern);
+    serv_free_pass();
+
+    memset(g.conn, 0, sizeof(* g.conn) );
+    g.conn->sock = -1;
+    g.conn->send_fd = -1;
+}
+
+/*
+ * Find out the nearest time when something needs to be checked even if
+ * nothing happens on the fds (expect -timeout, -ttl, -idle, ...).
+ *
+ * RETURN:
+ *   false: No deadline at all. Sleep until some fd becomes ready.
+ */
+static bool
+serv_deadline(struct timespec * deadline)
+{
+    struct st_spawn * spawn = & g.cmdopts->spawn;
+    struct timespec t, * lastbusy;
+    struct serv_conn * c;
+    bool found = false;
+    int i;
+
+#define TS_BEFORE(t1, t2)                                   \
+    ( (t1)->tv_sec < (t2)->tv_sec                           \
+      || ( (t1)->tv_sec == (t2)->tv_sec && (t1)->tv_nsec < (t2)->tv_nsec) )
+#define SET_DEADLINE(from, secs)                            \
+    do {                                                    \
+        Clock_add( & t, (from), (secs) );                   \
+        if ( ! found || TS_BEFORE( & t, deadline) ) {       \
+            * deadline = t;                                 \
+            found = true;                                   \
+        }                                                   \
+    } while (0)
+
+    /* expect -timeout */
+    for (i = 0; i < g.nconns; ++i) {
+        c = g.conns[i];
+        if (c->sock >= 0 && c->passing && c->pass.timeout > 0) {
+            SET_DEADLINE( & c->pass.startime, c->pass.timeout);
+        }
+    }
+
+    /* -cloexit */
+    if (spawn->cloexit && is_CHLD_DEAD && is_PTM_OPEN) {
+        SET_DEADLINE( & spawn->exittime, CLOEXIT_GRACE);
+    }
+
+    /* -zombie-idle */
+    if (spawn->zombie_idle >= 0
+        && is_CHLD_DEAD && not_PTM_OPEN && no_CLIENTS) {
+        lastbusy = & g.lastactive;
+        if (TS_BEFORE(lastbusy, & spawn->exittime) ) {
+            lastbusy = & spawn->exittime;
+        }
+        SET_DEADLINE(lastbusy, spawn->zombie_idle);
+    }
+
+    /* -ttl */
+    if (spawn->ttl > 0 && no_CLIENTS) {
+        SET_DEADLINE( & spawn->startime, spawn->ttl);
+    }
+
+    /* -idle */
+    if (spawn->idle > 0 && no_CLIENTS) {
+        SET_DEADLINE( & g.lastactive, spawn->idle);
+    }
+
+#undef SET_DEADLINE
+#undef TS_BEFORE
+
+    return found;
+}
+
+/*
+ * The checks which may end the session.
+ *
+ * RETURN:
+ *   false: The session is over.
+ */
+static bool
+serv_check(void)
+{
+    struct st_spawn * spawn = & g.cmdopts->spawn;
+
+    if (is_CHLD_WAITED && no_CLIENTS) {
+        return false;
+    }
+
+    /* -cloexit */
+    if (spawn->cloexit && is_CHLD_DEAD && is_PTM_OPEN) {
+        /* [<] The child has exited but the pty is still open which
+         *     means the child's children are still opening the pty. */
+        if (Clock_diff( & spawn->exittime, NULL) > CLOEXIT_GRACE) {
+            debug("child exited, closing ptm (-cloexit)");
+            serv_close_ptm();
+        }
+    }
+
+    /* -nowait */
+    if (spawn->autowait
+        && is_CHLD_DEAD && not_PTM_OPEN && no_CLIENTS) {
+        debug("child exited, exiting too (-nowait)");
+        return false;
+    }
+
+    /* -zombie-idle */
+    if (spawn->zombie_idle >= 0
+        && is_CHLD_DEAD && not_PTM_OPEN && no_CLIENTS) {
+        if (Clock_diff( & g.lastactive, NULL) > spawn->zombie_idle
+            && Clock_diff( & spawn->exittime, NULL) > spawn->zombie_idle) {
+            debug("the zombie's been idle for %d seconds. killing it now.",
+                  spawn->zombie_idle);
+            return false;
+        }
+    }
+
+    /* -ttl */
+    if (spawn->ttl > 0 && no_CLIENTS) {
+        if (Clock_diff( & spawn->startime, NULL) > spawn->ttl) {
+            debug("server has been alive for TTL (=%d) seconds, bye",
+                  spawn->ttl);
+            return false;
+        }
+    }
+
+    /* -idle */
+    if (spawn->idle > 0 && no_CLIENTS) {
+        if (Clock_diff( & g.lastactive, NULL) > spawn->idle) {
+            debug("server has been IDLE for %d seconds, bye", spawn->idle);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Set what to wait for before the next serv_run().
+ */
+static void
+serv_watch(void)
+{
+    struct st_spawn * spawn = & g.cmdopts->spawn;
+    struct serv_conn * c;
+    struct timespec deadline;
+    int i, ptm_events;
+
+    /* listen to new connections */
+    if (g.fd_listen >= 0) {
+        ev_watch(g.ev, g.fd_listen, g.nconns < MAX_CONNS ? EV_READ : 0);
+    }
+
+    /* read from ptm */
+    if (is_PTM_OPEN) {
+        ptm_events = 0;
+
+        /* [>] This checking is very important or the server may use 100%
+         *     CPU. (example: sexpect sp hexdump /dev/urandom) */
+        if (g.ntotal - g.rawoffset < (int64_t) g.rawbuf.cap) {
+            ptm_events = EV_READ;
+
+            /* [>] For non-blocking mode, we'll drop old data as necessary
+             *     so `rawbuf' would always have free space for new output
+             *     from pts side.
+             */
+        } else if (spawn->nonblock) {
+            ptm_events = EV_READ;
+        }
+        /* queued input */
+        if (g.inq.head < g.inq.len) {
+            ptm_events |= EV_WRITE;
+        }
+        ev_watch(g.ev, g.fd_ptm, ptm_events);
     }
 
-    memset( & g.conn, 0, sizeof(g.conn) );
-    g.conn.sock = -1;
+    /* wait for client requests. A streaming `send' waits until the child
+     * has read enough of its earlier chunks (or of its file). */
+    for (i = 0; i < g.nconns; ++i) {
+        c = g.conns[i];
+        if (c->sock >= 0) {
+            ev_watch(g.ev, c->sock,
+                     c->send_fd >= 0 || (c->streaming
+                         && g.inq.len - g.inq.head >= send_high() )
+                     ? 0 : EV_READ);
+        }
+    }
+
+    ev_set_deadline(g.ev, serv_deadline( & deadline) ? & deadline : NULL);
 }
 
+/*
+ * Take note of an event from ev_wait(). It's handled in serv_run().
+ */
 static void
-serv_loop(void)
+serv_event(const struct ev_event * ev)
+{
+    struct serv_conn * c;
+    int i;
+
+    if (ev->events & EV_SIGNAL) {
+        if (ev->signo == SIGCHLD) {
+            serv_sigCHLD(SIGCHLD);
+        }
+    } else if (is_PTM_OPEN && ev->fd == g.fd_ptm) {
+        if (ev->events & EV_READ) {
+            g.ptm_ready = true;
+        }
+        if (ev->events & EV_WRITE) {
+            g.ptm_writable = true;
+        }
+    } else if ( (ev->events & EV_READ) == 0) {
+        return;
+    } else if (g.fd_listen >= 0 && ev->fd == g.fd_listen) {
+        g.listen_ready = true;
+    } else if (g.fd_pid >= 0 && ev->fd == g.fd_pid) {
+        /* [<] The child has exited, the pidfd stays readable */
+        ev_watch(g.ev, g.fd_pid, 0);
+        serv_sigCHLD(SIGCHLD);
+    } else {
+        for (i = 0; i < g.nconns; ++i) {
+            c = g.conns[i];
+            if (c->sock >= 0 && ev->fd == c->sock) {
+                c->ready = true;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * RETURN:
+ *   false: No free slot for a new client.
+ */
+static bool
+serv_add_conn(int sock)
+{
+    if (g.nconns >= MAX_CONNS) {
+        return false;
+    }
+    if (g.nconns == g.maxconns) {
+        g.maxconns = MIN(MAX(g.maxconns * 2, 4), MAX_CONNS);
+        if (Realloc( (void **) & g.conns,
+                     g.maxconns * sizeof(g.conns[0]) ) == NULL) {
+            fatal_sys("realloc");
+        }
+    }
+    g.conn = calloc(1, sizeof(* g.conn) );
+    if (g.conn == NULL) {
+        fatal_sys("calloc");
+    }
+    g.conns[g.nconns++] = g.conn;
+
+    debug("new client connected (%d)", g.nconns);
+    serv_cleanup_conn();
+    g.conn->sock = sock;
+    Clock_gettime( & g.conn->pass.startime);
+
+    return true;
+}
+
+/*
+ * Free the closed connections.
+ */
+static void
+serv_reap_conns(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < g.nconns; ++i) {
+        g.conn = g.conns[i];
+        if (is_CONNECTED) {
+            g.conns[n++] = g.conn;
+        } else {
+            serv_free_pass();
+            free(g.conn);
+        }
+    }
+    g.nconns = n;
+    g.conn = & g.noconn;
+}
+
+/*
+ * Handle what serv_event() has found.
+ */
+static void
+serv_run(void)
 {
-    int r;
-    int newconn, fd_max;
+    struct st_spawn * spawn = & g.cmdopts->spawn;
     struct sockaddr_un cli_addr;
     socklen_t sock_len;
-    fd_set readfds;
-    struct timeval timeout;
-    struct st_spawn * spawn = & g.cmdopts->spawn;
+    int i, newconn;
+
+    /* new connect request */
+    if (g.listen_ready) {
+        g.listen_ready = false;
+
+        sock_len = sizeof(cli_addr);
+        newconn = accept(g.fd_listen, (struct sockaddr *) & cli_addr,
+                         & sock_len);
+        if (newconn < 0) {
+            if (errno != EINTR) {
+                fatal_sys("accept");
+            }
+        } else if ( ! serv_add_conn(newconn) ) {
+            /* [<] `fd_listen' is not watched when there's no free slot */
+            bug("no free slot for the new client");
+            close(newconn);
+        }
+    }
+
+    /* new data from pty */
+    if (g.ptm_ready && is_PTM_OPEN) {
+        g.ptm_ready = false;
+        serv_read_ptm();
+    }
+    /* -nonblock is ON, drop some data when rawbuf is full */
+    if (spawn->nonblock && no_CLIENTS) {
+        int oldcnt;
+        oldcnt = g.rawnew - g.rawoffset;
+        if (oldcnt + NEWCNT >= g.rawbuf.cap && oldcnt <= spawn->history) {
+            debug("non-blocking: rawbuf full, drop %d bytes", NONBLOCK_DROP_SIZE);
+
+            /* Here we only mark more data as _old_ and the oldest data will
+             * be automatically dropped in `drop_old_data()'.
+             */
+            g.rawnew += NONBLOCK_DROP_SIZE;
+        }
+    }
+
+    /* queued input to pty */
+    if (g.ptm_writable) {
+        g.ptm_writable = false;
+        serv_write_ptm();
+    }
+
+    /* new messages from clients */
+    for (i = 0; i < g.nconns; ++i) {
+        g.conn = g.conns[i];
+        if (g.conn->ready && is_CONNECTED) {
+            g.conn->ready = false;
+            serv_process_msg();
+        }
+    }
+    serv_read_sendfds();
+    serv_ack_sends();
+
+    /* expect/interact/wait, each client on its own */
+    for (i = 0; i < g.nconns; ++i) {
+        g.conn = g.conns[i];
+        if (is_CONNECTED && is_PASSING) {
+            serv_pass();
+        }
+    }
+    serv_reap_conns();
+
+    drop_old_data();
+}
+
+static void
+serv_loop(void)
+{
+    int i, nevs;
+    struct ev_event evs[EV_MAX_FDS];
 
     /* N.B.:
      *  - The child's exiting does not necessarily mean the pty has been closed
@@ -952,209 +2822,230 @@ serv_loop(void)
      *  - After the child exits and ptm is closed, there may still some data
      *    in "rawbuf" when can be sent to the client (interact/expect/wait).
      *  - After the child exits and ptm is closed, there may still some data
-     *    in "rawbuf" which has not been copied to "expbuf" for "expect".
+     *    in "rawbuf" which has not been matched by "expect".
+     *  - There's no polling. Everything must be driven by fds, signals or
+     *    deadlines (see `serv_deadline()') or the server would sleep forever.
      */
-    while ( ! is_CHLD_WAITED || is_CONNECTED) {
-        /* -cloexit */
-        if (spawn->cloexit && is_CHLD_DEAD && is_PTM_OPEN) {
-            /* [<] The child has exited but the pty is still open which
-             *     means the child's children are still opening the pty. */
-            static int n = 0;
-            if (++n > 1) {
-                debug("child exited, closing ptm (-cloexit)");
-                close(g.fd_ptm);
-                g.fd_ptm = -1;
-            }
-        }
+    while (serv_check() ) {
+        serv_watch();
 
-        /* -nowait */
-        if (spawn->autowait
-            && is_CHLD_DEAD && not_PTM_OPEN && not_CONNECTED) {
-            debug("child exited, exiting too (-nowait)");
-            break;
+        nevs = ev_wait(g.ev, evs, ARRAY_SIZE(evs) );
+        if (nevs < 0) {
+            fatal_sys("ev_wait");
         }
-
-        /* -zombie-idle */
-        if (spawn->zombie_idle >= 0
-            && is_CHLD_DEAD && not_PTM_OPEN && not_CONNECTED) {
-            if (Clock_diff( & g.lastactive, NULL) > spawn->zombie_idle
-                && Clock_diff( & spawn->exittime, NULL) > spawn->zombie_idle) {
-                debug("the zombie's been idle for %d seconds. killing it now.",
-                      spawn->zombie_idle);
-                break;
-            }
+        for (i = 0; i < nevs; ++i) {
+            serv_event( & evs[i]);
         }
 
-        /* -ttl */
-        if (spawn->ttl > 0 && not_CONNECTED) {
-            if (Clock_diff( & spawn->startime, NULL) > spawn->ttl) {
-                debug("server has been alive for TTL (=%d) seconds, bye",
-                      spawn->ttl);
-                break;
-            }
+        serv_run();
+    }
+}
+
+/*
+ * A new session (for `cmdopts'), which becomes `g'.
+ */
+static void
+serv_init(struct st_cmdopts * cmdopts)
+{
+    g_sess = calloc(1, sizeof(* g_sess) );
+    if (g_sess == NULL) {
+        fatal_sys("calloc");
+    }
+    g.cmdopts = cmdopts;
+
+    g.noconn.sock = -1;
+    g.noconn.send_fd = -1;
+    g.conn = & g.noconn;
+    g.conns = NULL;
+    g.nconns = 0;
+    g.maxconns = 0;
+
+    Clock_gettime( & g.lastactive);
+
+    if (rb_init( & g.rawbuf, g.cmdopts->spawn.bufsize) < 0) {
+        fatal_sys("cannot allocate buffers");
+    }
+    * RAW_AT(0) = '\0';
+
+    g.fd_ptm    = -1;
+    g.fd_listen = -1;
+    g.fd_pid    = -1;
+    g.ntotal    = 0;
+    g.rawoffset = 0;
+    g.rawnew    = 0;
+    g.exphead   = 0;
+    g.nultotal  = 0;
+    g.sb.fd     = -1;
+    g.expend    = -1;
+}
+
+/*
+ * Open the logfile and the scrollback.
+ *
+ * NOTE: This must be done before chdir("/") in case the logfile is
+ *       specified with a relative pathname.
+ *
+ * RETURN: NULL if OK, or the error message.
+ */
+static char *
+serv_open_files(void)
+{
+    struct st_spawn * spawn = & g.cmdopts->spawn;
+
+    if (spawn->logfile != NULL) {
+        debug("open the logfile");
+        if (spawn->append) {
+            spawn->logfd = open(spawn->logfile, O_WRONLY | O_APPEND);
+        } else {
+            spawn->logfd = open(spawn->logfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        }
+        if (spawn->logfd < 0) {
+            debug("open(logfile): %s (%d)", strerror(errno), errno);
+        } else {
+            fcntl(spawn->logfd, F_SETFD, FD_CLOEXEC);
         }
+    }
 
-        /* -idle */
-        if (spawn->idle > 0 && not_CONNECTED) {
-            if (Clock_diff( & g.lastactive, NULL) > spawn->idle) {
-                debug("server has been IDLE for %d seconds, bye", spawn->idle);
-                break;
-            }
+    /* the scrollback file (same as above) */
+    if (spawn->scrollback_file != NULL || spawn->scrollback > 0) {
+        debug("open the scrollback file");
+        if (sb_open( & g.sb, spawn->scrollback_file, spawn->scrollback) < 0) {
+            return "cannot open the scrollback file";
         }
+    }
 
-        FD_ZERO( & readfds);
-        fd_max = 0;
+    return NULL;
+}
 
-        /* listen to new connections */
-        if (not_CONNECTED) {
-            FD_SET(g.fd_listen, & readfds);
-            if (g.fd_listen > fd_max) {
-                fd_max = g.fd_listen;
-            }
-        }
+/* serv_spawn()'s error which is not from a failed syscall */
+static char ERR_PTS_WAIT[] = "failed to wait for the child to open pts";
 
-        /* read from ptm */
-        if (is_PTM_OPEN) {
-            /* [>] This checking is very important or the server may use 100%
-             *     CPU. (example: sexpect sp hexdump /dev/urandom) */
-            if (g.rawnew + g.newcnt < g.rawbuf + g.rawbufsize) {
-                FD_SET(g.fd_ptm, & readfds);
-                if (g.fd_ptm > fd_max) {
-                    fd_max = g.fd_ptm;
-                }
+/*
+ * Spawn the child on a new pty of size `ws' (if not NULL). The child's
+ * signal mask is `childmask'.
+ *
+ * RETURN: NULL if OK, or the error message (with errno set, except for
+ *         ERR_PTS_WAIT).
+ */
+static char *
+serv_spawn(const struct winsize * ws, const sigset_t * childmask)
+{
+    struct st_spawn * spawn = & g.cmdopts->spawn;
+    pid_t pid;
 
-                /* [>] For non-blocking mode, we'll drop old data as necessary
-                 *     so `rawbuf' would always have free space for new output
-                 *     from pts side.
-                 */
-            } else if (spawn->nonblock) {
-                FD_SET(g.fd_ptm, & readfds);
-                if (g.fd_ptm > fd_max) {
-                    fd_max = g.fd_ptm;
-                }
-            }
+    pid = pty_fork(&g.fd_ptm, g.ptsname, sizeof(g.ptsname), NULL, NULL);
+    if (pid < 0) {
+        return "fork failed";
+    } else if (pid == 0) {
+        /* child */
+        if (g.fd_listen >= 0) {
+            close(g.fd_listen);
         }
 
-        /* wait for client requests */
-        if (is_CONNECTED) {
-            FD_SET(g.conn.sock, & readfds);
-            if (g.conn.sock > fd_max) {
-                fd_max = g.conn.sock;
-            }
-        }
+        sigprocmask(SIG_SETMASK, childmask, NULL);
 
-        /* With select(timeout=10ms), on my macOS 11.6 Big Sur (32GB mem), a
-         * background sexpect for "ssh -D" (with or without "-v") uses 0.4% CPU
-         * which is unnecessarily _high_. Tried timeout=100ms and the CPU usage
-         * dropped to 0%. Seems like it's good enough to use a 100ms+ timeout.
-         */
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 200 * 1000;
-        /* FIXME: [??] On macOS, select returns -1 (EBADF) after pts is closed */
-        r = select(fd_max + 1, & readfds, NULL, NULL, & timeout);
-        if (r < 0) {
-            if (errno == EINTR) {
-                continue;
-            } else {
-                fatal_sys("select");
-            }
+        if (spawn->nohup) {
+            sig_handle(SIGHUP, SIG_IGN);
         }
 
-        /* new connect request */
-        if (FD_ISSET(g.fd_listen, & readfds) ) {
-            sock_len = sizeof(cli_addr);
-            newconn = accept(g.fd_listen, (struct sockaddr *) & cli_addr,
-                             & sock_len);
-            if (newconn < 0) {
-                if (errno == EINTR) {
-                    continue;
-                } else {
-                    fatal_sys("accept");
-                }
-            } else {
-                if (is_CONNECTED) {
-                    bug("old conn still alive!");
-                    close(g.conn.sock);
+        if (spawn->envp != NULL) {
+            /* [<] hub mode: the client's environment, already without
+             *     SEXPECT_SOCKFILE and with -term applied */
+            environ = spawn->envp;
+        } else {
+            if (spawn->TERM != NULL) {
+                if (setenv("TERM", spawn->TERM, 1) < 0) {
+                    fatal_sys("setenv(TERM)");
                 }
-                debug("new client connected");
-                serv_cleanup_conn();
-                g.conn.sock = newconn;
-                Clock_gettime( & g.conn.pass.startime);
             }
+
+            /* don't pass SEXPECT_SOCKFILE to the spawned process */
+            unsetenv("SEXPECT_SOCKFILE");
         }
 
-        /* new data from pty */
-        if (is_PTM_OPEN) {
-            if (FD_ISSET(g.fd_ptm, & readfds) ) {
-                serv_read_ptm();
-            }
+        if (spawn->cwd != NULL && chdir(spawn->cwd) < 0) {
+            fatal_sys("chdir(%s)", spawn->cwd);
         }
-        /* -nonblock is ON, drop some data when rawbuf is full */
-        if (spawn->nonblock && not_CONNECTED) {
-            int oldcnt;
-            oldcnt = g.rawnew - g.rawbuf;
-            if (oldcnt + g.newcnt == g.rawbufsize && oldcnt <= MAX_OLD_DATA) {
-                debug("non-blocking: rawbuf full, drop %d bytes", NONBLOCK_DROP_SIZE);
-
-                /* Here we only mark more data as _old_ and the oldest data will
-                 * be automatically dropped in `drop_old_data()'.
-                 */
-                g.rawnew += NONBLOCK_DROP_SIZE;
-                g.newcnt -= NONBLOCK_DROP_SIZE;
+
+        /* set pty winsize if we are on a tty */
+        if (ws != NULL) {
+            if (ioctl(STDIN_FILENO, TIOCSWINSZ, ws) < 0) {
+                error("failed to set winsize: %s (%d)", strerror(errno), errno);
             }
         }
 
-        /* new message from client */
-        if (is_CONNECTED && FD_ISSET(g.conn.sock, & readfds) ) {
-            serv_process_msg();
+        if (execvp(spawn->argv[0], spawn->argv) < 0) {
+            fatal_sys("failed to spawn '%s'", spawn->argv[0]);
         }
+    }
 
-        /* expect/interact/wait */
-        if (is_CONNECTED && is_PASSING) {
-            serv_pass();
-        }
+    g.child = pid;
+    Clock_gettime( & spawn->startime);
 
-        drop_old_data();
-    }
-}
+    /* set ptm to be non-blocking */
+    if (1) {
+        /*
+         * On macOS, fcntl(O_NONBLOCK) may fail before the child opens the
+         * pts. So wait a while (until pty/master becomes writable) for the
+         * child to open the pts.
+         *
+         * (poll() does not work with ptys on macOS so it's only for fds
+         * beyond FD_SETSIZE, which can only be in hub mode on Linux.)
+         */
+        bool ready;
 
-static void
-serv_init(void)
-{
-    g.conn.sock   = -1;
+        debug("waiting for the child to open pts");
+        if (g.fd_ptm < FD_SETSIZE) {
+            fd_set writefds;
+            struct timeval timeout;
 
-    Clock_gettime( & g.lastactive);
+            timeout.tv_sec = 5;
+            timeout.tv_usec = 0;
 
-    g.rawbufsize = SIZE_RAW_BUF;
-    g.expbufsize = SIZE_RAW_BUF;
+            FD_ZERO(&writefds);
+            FD_SET(g.fd_ptm, &writefds);
 
-    g.rawbuf = malloc(g.rawbufsize + 1);
-    g.expbuf = malloc(g.expbufsize + 1);
-    g.rawnew = g.rawbuf;
+            select(g.fd_ptm + 1, NULL, &writefds, NULL, &timeout);
+            ready = FD_ISSET(g.fd_ptm, &writefds);
+        } else {
+            struct pollfd pfd;
 
-    g.newcnt = 0;
-    g.expcnt = 0;
+            pfd.fd = g.fd_ptm;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
 
-    g.ntotal    = 0;
-    g.rawoffset = 0;
-    g.expoffset = 0;
+            poll( & pfd, 1, 5 * 1000);
+            ready = (pfd.revents & POLLOUT) != 0;
+        }
+        if ( ! ready) {
+            return ERR_PTS_WAIT;
+        }
+
+        if (fcntl(g.fd_ptm, F_SETFL, O_NONBLOCK) < 0) {
+            return "fcntl(ptm) failed";
+        }
+        fcntl(g.fd_ptm, F_SETFD, FD_CLOEXEC);
+    }
+
+    g.ev = ev_new();
+    if (g.ev == NULL) {
+        fatal_sys("ev_new");
+    }
+
+    return NULL;
 }
 
 void
 serv_main(struct st_cmdopts * cmdopts)
 {
-    pid_t pid;
-    int ret;
     int fd_conn;
     bool ontty = false;
     struct winsize ws;
     struct sockaddr_un srv_addr = { 0 };
-    struct st_spawn * spawn = NULL;
+    sigset_t sigchld, oldmask;
+    char * errmsg;
 
-    serv_init();
-
-    g.cmdopts = cmdopts;
-    spawn = & cmdopts->spawn;
+    serv_init(cmdopts);
 
     /* get current winsize */
     if (isatty(STDIN_FILENO) ) {
@@ -1178,21 +3069,9 @@ serv_main(struct st_cmdopts * cmdopts)
         }
     }
 
-    /* open logfile
-     *
-     * NOTE: This must be done before chdir("/") in case the logfile is
-     *       specified with a relative pathname.
-     */
-    if (spawn->logfile != NULL) {
-        debug("open the logfile");
-        if (spawn->append) {
-            spawn->logfd = open(spawn->logfile, O_WRONLY | O_APPEND);
-        } else {
-            spawn->logfd = open(spawn->logfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-        }
-        if (spawn->logfd < 0) {
-            debug("open(logfile): %s (%d)", strerror(errno), errno);
-        }
+    /* open logfile and the scrollback */
+    if ( (errmsg = serv_open_files() ) != NULL) {
+        fatal_sys("%s", errmsg);
     }
 
     /* socket() */
@@ -1226,7 +3105,7 @@ serv_main(struct st_cmdopts * cmdopts)
 
     /* start listening before becoming a daemon so client does not need to wait
      * before trying to connect */
-    if (listen(g.fd_listen, 0) < 0) {
+    if (listen(g.fd_listen, MAX_CONNS) < 0) {
         fatal_sys("listen");
     }
 
@@ -1243,91 +3122,212 @@ serv_main(struct st_cmdopts * cmdopts)
 
         /* N.B: Don't close ALL ! */
         for (fd = 3; fd < 16; ++fd) {
-            if (fd != g.fd_listen && fd != cmdopts->spawn.logfd) {
+            if (fd != g.fd_listen && fd != cmdopts->spawn.logfd
+                && fd != g.sb.fd) {
                 close(fd);
             }
         }
     }
 
+    /* Block SIGCHLD until the event loop is ready to receive it or it'd be
+     * lost if the child exits very quickly. */
+    sigemptyset( & sigchld);
+    sigaddset( & sigchld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, & sigchld, & oldmask);
+
     /* spawn the child */
-    pid = pty_fork(&g.fd_ptm, g.ptsname, sizeof(g.ptsname), NULL, NULL);
-    if (pid < 0) {
-        fatal_sys("fork");
-    } else if (pid == 0) {
-        /* child */
-        close(g.fd_listen);
+    errmsg = serv_spawn(ontty ? & ws : NULL, & oldmask);
+    if (errmsg == ERR_PTS_WAIT) {
+        fatal(ERROR_GENERAL, "%s", errmsg);
+    } else if (errmsg != NULL) {
+        fatal_sys("%s", errmsg);
+    }
 
-        if (cmdopts->spawn.nohup) {
-            sig_handle(SIGHUP, SIG_IGN);
-        }
+    /* This must be after exec() or the following usage would not work
+     * as expected:
+     *
+     *  $ sexpect spawn cat a-file-in-current-dir
+     */
+    chdir("/");
 
-        if (cmdopts->spawn.TERM != NULL) {
-            if (setenv("TERM", cmdopts->spawn.TERM, 1) < 0) {
-                fatal_sys("setenv(TERM)");
-            }
-        }
+    sig_handle(SIGPIPE, SIG_IGN);
 
-        /* don't pass SEXPECT_SOCKFILE to the spawned process */
-        unsetenv("SEXPECT_SOCKFILE");
+    if (ev_watch_signal(g.ev, SIGCHLD) < 0) {
+        fatal_sys("ev_watch_signal(SIGCHLD)");
+    }
 
-        /* set pty winsize if we are on a tty */
-        if (ontty) {
-            if (ioctl(STDIN_FILENO, TIOCSWINSZ, & ws) < 0) {
-                error("failed to set winsize: %s (%d)", strerror(errno), errno);
-            }
-        }
+    debug("ready to recv requests");
+    serv_loop();
 
-        if (execvp(cmdopts->spawn.argv[0], cmdopts->spawn.argv) < 0) {
-            fatal_sys("failed to spawn '%s'", cmdopts->spawn.argv[0]);
-        }
-    } else {
-        /* This must be after exec() or the following usage would not work
-         * as expected:
-         *
-         *  $ sexpect spawn cat a-file-in-current-dir
-         */
-        chdir("/");
+    debug("removing %s", cmdopts->sockpath);
+    unlink(cmdopts->sockpath);
 
-        g.child = pid;
-        Clock_gettime( & spawn->startime);
-    }
+    exit(0);
+}
 
-    /* set ptm to be non-blocking */
-    if (1) {
-        /*
-         * On macOS, fcntl(O_NONBLOCK) may fail before the child opens the
-         * pts. So wait a while (until pty/master becomes writable) for the
-         * child to open the pts.
-         */
-        fd_set writefds;
-        struct timeval timeout;
+#ifdef HAVE_HUB
+
+/*
+ * Hub mode (see hub.c): the sessions are created by the hub's main thread
+ * and then served by one of the workers, through the functions below.
+ */
 
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
+session_t *
+sess_spawn(struct st_cmdopts * cmdopts, const struct winsize * ws,
+           const sigset_t * childmask, int read_budget,
+           char * errbuf, int errlen)
+{
+    session_t * s;
+    char * errmsg;
 
-        FD_ZERO(&writefds);
-        FD_SET(g.fd_ptm, &writefds);
+    serv_init(cmdopts);
+    s = g_sess;
+    g.read_budget = read_budget;
 
-        debug("waiting for the child to open pts");
-        select(g.fd_ptm + 1, NULL, &writefds, NULL, &timeout);
-        if (! FD_ISSET(g.fd_ptm, &writefds) ) {
-            fatal(ERROR_GENERAL, "failed to wait for the child to open pts");
+    errmsg = serv_open_files();
+    if (errmsg == NULL) {
+        errmsg = serv_spawn(ws, childmask);
+    }
+    if (errmsg == NULL) {
+        /* SIGCHLD cannot tell which session's child has exited */
+        g.fd_pid = syscall(SYS_pidfd_open, g.child, 0);
+        if (g.fd_pid < 0) {
+            errmsg = "pidfd_open";
         }
-
-        ret = fcntl(g.fd_ptm, F_SETFL, O_NONBLOCK);
-        if (ret < 0) {
-            fatal_sys("fcntl(ptm)");
+    }
+    if (errmsg != NULL) {
+        if (errmsg == ERR_PTS_WAIT) {
+            snprintf(errbuf, errlen, "%s", errmsg);
+        } else {
+            snprintf(errbuf, errlen, "%s: %s", errmsg, strerror(errno) );
+        }
+        if (g.child > 0) {
+            kill(g.child, SIGKILL);
+            waitpid(g.child, NULL, 0);
+            g.waited = true;
         }
+        sess_free(s);
+        return NULL;
     }
+    ev_watch(g.ev, g.fd_pid, EV_READ);
 
-    sig_handle(SIGPIPE, SIG_IGN);
-    sig_handle(SIGCHLD, serv_sigCHLD);
+    serv_watch();
 
-    debug("ready to recv requests");
-    serv_loop();
+    return s;
+}
 
-    debug("removing %s", cmdopts->sockpath);
-    unlink(cmdopts->sockpath);
+/*
+ * The fd to watch (EV_READ) for sess_run().
+ */
+int
+sess_fd(session_t * s)
+{
+    return ev_fd(s->ev);
+}
 
-    exit(0);
+pid_t
+sess_pid(session_t * s)
+{
+    return s->child;
 }
+
+/*
+ * RETURN:
+ *   false: Too many clients.
+ */
+bool
+sess_add_conn(session_t * s, int sock)
+{
+    bool added;
+
+    g_sess = s;
+    added = serv_add_conn(sock);
+    serv_watch();
+
+    return added;
+}
+
+/*
+ * Handle what's happened to the session since the last time, without
+ * blocking.
+ *
+ * RETURN:
+ *   false: The session is over.
+ */
+bool
+sess_run(session_t * s)
+{
+    struct ev_event evs[EV_MAX_FDS];
+    int i, nevs;
+
+    g_sess = s;
+
+    nevs = ev_poll(g.ev, evs, ARRAY_SIZE(evs) );
+    if (nevs < 0) {
+        fatal_sys("ev_poll");
+    }
+    for (i = 0; i < nevs; ++i) {
+        serv_event( & evs[i]);
+    }
+
+    serv_run();
+    if ( ! serv_check() ) {
+        return false;
+    }
+    serv_watch();
+
+    return true;
+}
+
+/*
+ * RETURN:
+ *   The child's pid if it's not been waited for (the caller should reap it
+ *   some time), or 0.
+ */
+pid_t
+sess_free(session_t * s)
+{
+    pid_t child = 0;
+    int i;
+
+    g_sess = s;
+
+    for (i = 0; i < g.nconns; ++i) {
+        g.conn = g.conns[i];
+        if (is_CONNECTED) {
+            serv_close_conn();
+        }
+    }
+    serv_reap_conns();
+    free(g.conns);
+    if (is_PTM_OPEN) {
+        /* [>] The child would get SIGHUP */
+        close(g.fd_ptm);
+    }
+    if (g.fd_pid >= 0) {
+        close(g.fd_pid);
+    }
+    if (g.child > 0 && ! is_CHLD_WAITED) {
+        child = g.child;
+    }
+    if (g.cmdopts->spawn.logfd >= 0) {
+        close(g.cmdopts->spawn.logfd);
+        g.cmdopts->spawn.logfd = -1;
+    }
+    sb_close( & g.sb);
+    ev_free(g.ev);
+    rb_free( & g.rawbuf);
+    free(g.nulruns);
+    free(g.nls);
+    free(g.marks);
+    free(g.strip.buf);
+    free(g.inq.buf);
+    free_expect_out();
+
+    free(s);
+    g_sess = NULL;
+
+    return child;
+}
+
+#endif /* HAVE_HUB */
@@ -0,0 +1,27 @@
+#ifndef SERVER_H__
+#define SERVER_H__
+
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include "common.h"
+
+/*
+ * One spawned child and its clients. serv_main() serves one session in its
+ * own daemon, in hub mode (see hub.c) one process has many of them, each
+ * served by one worker thread at a time.
+ */
+typedef struct session session_t;
+
+session_t * sess_spawn(struct st_cmdopts * cmdopts, const struct winsize * ws,
+                       const sigset_t * childmask, int read_budget,
+                       char * errbuf, int errlen);
+int     sess_fd(session_t * s);
+pid_t   sess_pid(session_t * s);
+bool    sess_add_conn(session_t * s, int sock);
+bool    sess_run(session_t * s);
+pid_t   sess_free(session_t * s);
+
+#endif
@@ -0,0 +1,93 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "common.h"
+#include "acmatch.h"
+
+#define NPATS   6
+
+/* the first (lowest id) pattern ending at the leftmost possible place */
+static int
+naive_scan(char pats[][8], int npats, const char * buf, int len, bool icase,
+           int * id)
+{
+    int end, i, plen;
+
+    for (end = 1; end <= len; ++end) {
+        for (i = 0; i < npats; ++i) {
+            plen = strlen(pats[i]);
+            if (plen > end) {
+                continue;
+            }
+            if (icase ? strncasecmp(buf + end - plen, pats[i], plen) == 0
+                      : strncmp(buf + end - plen, pats[i], plen) == 0) {
+                * id = i;
+                return end;
+            }
+        }
+    }
+
+    return -1;
+}
+
+int
+main()
+{
+    char pats[NPATS][8];
+    char buf[64];
+    int round, i, j, len, plen, state, off, n, id, exp_n, exp_id;
+    bool icase;
+    acm_t * ac;
+
+    srand(1);
+
+    for (round = 0; round < 20000; ++round) {
+        icase = round % 2;
+
+        ac = acm_new(icase);
+        for (i = 0; i < NPATS; ++i) {
+            plen = 1 + rand() % 4;
+            for (j = 0; j < plen; ++j) {
+                pats[i][j] = "abAB"[rand() % (icase ? 4 : 2)];
+            }
+            pats[i][plen] = '\0';
+            acm_add(ac, pats[i], plen, i);
+        }
+        acm_build(ac);
+
+        len = rand() % sizeof(buf);
+        for (j = 0; j < len; ++j) {
+            buf[j] = "abcAB"[rand() % 5];
+        }
+        exp_n = naive_scan(pats, NPATS, buf, len, icase, & exp_id);
+
+        /* feed the data in random pieces */
+        state = 0;
+        n = -1;
+        for (off = 0; off < len; off += j) {
+            j = 1 + rand() % (len - off);
+            n = acm_scan(ac, & state, buf + off, j, & id);
+            if (n >= 0) {
+                n += off;
+                break;
+            }
+        }
+
+        if (n != exp_n || (n >= 0 && (id != exp_id || ac->lens[id] != strlen(pats[id]) ) ) ) {
+            printf("round %d (icase=%d): %.*s\n", round, icase, len, buf);
+            for (i = 0; i < NPATS; ++i) {
+                printf("  [%d] %s\n", i, pats[i]);
+            }
+            printf("  got %d/%d, expected %d/%d\n", n, id, exp_n, exp_id);
+            exit(1);
+        }
+
+        acm_free(ac);
+    }
+
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Benchmark: how fast the server reads the child's output from the pty and
+# passes it to an `expect -eof' client, and how many read()s and write()s
+# (from /proc/PID/io, so Linux only) it takes the server per MB.
+#
+# Usage: [BUFSIZE=<spawn -bufsize>] BINDIR=<build-dir> bash tests/bench-ptm.sh [MB]
+#
+
+MB=${1:-64}
+BINDIR=${BINDIR:-$(cd ${0%/*}/.. && pwd)/build}
+SEXPECT=$BINDIR/sexpect
+
+export SEXPECT_SOCKFILE=/tmp/sexpect-bench-ptm.$$.sock
+
+# the output starts after `send' and the child is still there when we look
+# at the server after it's all been passed
+$SEXPECT sp -ttl 60 -bufsize ${BUFSIZE:-16k} \
+    sh -c "read go; head -c ${MB}m /dev/zero | tr '\\0' x; echo; echo BENCH_END; sleep 5" || exit 1
+srv=$( $SEXPECT get -ppid )
+
+t0=$( date +%s.%N )
+$SEXPECT send -cr go
+$SEXPECT ex -t 60 -ex BENCH_END > /dev/null || exit 1
+t1=$( date +%s.%N )
+
+# read() and write() syscalls and CPU ticks (utime + stime) by the server
+io=( $( awk '$1 == "syscr:" || $1 == "syscw:" { print $2 }' /proc/$srv/io ) )
+cpu=$( awk '{ print $14 + $15 }' /proc/$srv/stat )
+$SEXPECT kill -KILL
+$SEXPECT wait > /dev/null
+
+awk -v mb=$MB -v t0=$t0 -v t1=$t1 -v r=${io[0]} -v w=${io[1]} \
+    -v cpu=$cpu -v hz=$( getconf CLK_TCK ) 'BEGIN {
+    secs = t1 - t0
+    printf "%d MB in %.2f s: %.1f MB/s, %.0f read()s/MB, %.0f write()s/MB, " \
+           "%.1f ms CPU/MB\n", mb, secs, mb / secs, r / mb, w / mb,
+           cpu * 1000 / hz / mb
+}'
+rm -f $SEXPECT_SOCKFILE
@@ -0,0 +1,247 @@
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "ere.h"
+#include "dfa.h"
+
+/*
+ * Find the earliest match end and the leftmost start of the matches ending
+ * there, feeding the data in random pieces.
+ */
+static int
+dfa_search(dfa_t * dfa, dfa_t * rdfa, const char * buf, int len, int * so)
+{
+    int state, off, j, n, eo, next;
+
+    state = dfa_start(dfa, -1);
+    eo = -1;
+    for (off = 0; off < len; off += j) {
+        j = 1 + rand() % (len - off);
+        n = dfa_feed(dfa, & state, buf + off, j);
+        if (n >= 0) {
+            eo = off + n;
+            break;
+        }
+    }
+    if (eo < 0) {
+        if ( ! dfa_at_end(dfa, state) ) {
+            return -1;
+        }
+        eo = len;
+    }
+
+    next = eo < len ? (unsigned char) buf[eo] : -1;
+    * so = dfa_rfind(rdfa, buf, eo, next);
+
+    return eo;
+}
+
+/* does `re' (anchored at both ends) match [so, eo) exactly? */
+static bool
+naive_match(regex_t * re, const char * buf, int so, int eo)
+{
+    char str[64];
+
+    memcpy(str, buf + so, eo - so);
+    str[eo - so] = '\0';
+
+    return regexec(re, str, 0, NULL, 0) == 0;
+}
+
+static int
+naive_search(regex_t * re, const char * buf, int len, int * so)
+{
+    int s, e;
+
+    for (e = 0; e <= len; ++e) {
+        for (s = 0; s <= e; ++s) {
+            if (naive_match(re, buf, s, e) ) {
+                * so = s;
+                return e;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static void
+gen_pattern(char * out, int depth)
+{
+    static char * atoms[] = { "a", "b", ".", "[ab]", "[^a]", "\n" };
+    static char * quants[] = { "", "", "", "*", "+", "?", "{1,2}", "{0,2}" };
+    int i, n;
+
+    n = 1 + rand() % 3;
+    for (i = 0; i < n; ++i) {
+        if (depth < 2 && rand() % 4 == 0) {
+            strcat(out, "(");
+            gen_pattern(out, depth + 1);
+            strcat(out, ")");
+        } else {
+            strcat(out, atoms[rand() % ARRAY_SIZE(atoms)]);
+        }
+        strcat(out, quants[rand() % ARRAY_SIZE(quants)]);
+    }
+    if (rand() % 4 == 0) {
+        strcat(out, "|");
+        gen_pattern(out, depth + 1);
+    }
+}
+
+int
+main()
+{
+    struct {
+        char * pattern;
+        int    flags;
+        char * text;
+        int    len;     /* -1 for strlen(text) */
+        int    so, eo;  /* -1 if no match */
+    } cases[] = {
+        { "foo",            0,              "xxfoobar", -1,     2,  5 },
+        { "a+",             0,              "baaa",     -1,     1,  2 },
+        { "a|ab",           0,              "xab",      -1,     1,  2 },
+        { "b|ab",           0,              "xab",      -1,     1,  3 },
+        { "x*",             0,              "abc",      -1,     0,  0 },
+        { "b{2,3}",         0,              "abbbb",    -1,     1,  3 },
+        { "[$#] $",         0,              "bash-5.1$ ", -1,   8, 10 },
+        { "[$#] $",         0,              "x$ y",     -1,    -1, -1 },
+        { "^ab",            0,              "xab",      -1,    -1, -1 },
+        { "^ab",            ERE_NEWLINE,    "x\nab",    -1,     2,  4 },
+        { "ab$",            0,              "ab\ncd",   -1,    -1, -1 },
+        { "ab$",            ERE_NEWLINE,    "ab\ncd",   -1,     0,  2 },
+        { "a.c",            0,              "a\nc",     -1,     0,  3 },
+        { "a.c",            ERE_NEWLINE,    "a\nc",     -1,    -1, -1 },
+        { "\\bfoo\\b",      0,              "afoo foo", -1,     5,  8 },
+        { "\\<x",           0,              "ax x",     -1,     3,  4 },
+        { "o\\>",           0,              "foo bar",  -1,     2,  3 },
+        { "\\Bo",           0,              "oo",       -1,     1,  2 },
+        { "\\`a",           0,              "aa",       -1,     0,  1 },
+        { "a\\'",           0,              "aa",       -1,     1,  2 },
+        { "foo",            ERE_ICASE,      "xFoO",     -1,     1,  4 },
+        { "(ab|cd)+e",      0,              "abcdabe",  -1,     0,  7 },
+        /* NUL bytes are just data */
+        { "ba",             0,              "\0\0ba",    4,     2,  4 },
+        { "a.b",            0,              "a\0bab",    5,    -1, -1 },
+    };
+    char * neg_cases[] = {
+        "(a)\\1",
+        "(x{255}){255}",
+    };
+    char pattern[256], anchored[300], buf[16];
+    ere_t * re;
+    dfa_t * dfa, * rdfa;
+    regex_t regex;
+    int round, i, len, so, eo, exp_so, exp_eo;
+
+    srand(1);
+
+    printf("cases:\n");
+    for (i = 0; i < ARRAY_SIZE(cases); ++i) {
+        re = ere_parse(cases[i].pattern, cases[i].flags);
+        dfa = dfa_new(re, false);
+        rdfa = dfa_new(re, true);
+        if (dfa == NULL || rdfa == NULL) {
+            printf("%20s  ->  NULL\n", cases[i].pattern);
+            exit(1);
+        }
+        len = cases[i].len >= 0 ? cases[i].len : strlen(cases[i].text);
+
+        so = -1;
+        eo = dfa_search(dfa, rdfa, cases[i].text, len, & so);
+        printf("%20s  ->  %d, %d\n", cases[i].pattern, so, eo);
+        if (so != cases[i].so || eo != cases[i].eo) {
+            printf("%20s  expected %d, %d\n", "", cases[i].so, cases[i].eo);
+            exit(1);
+        }
+
+        dfa_free(dfa);
+        dfa_free(rdfa);
+        ere_free(re);
+    }
+
+    printf("neg_cases:\n");
+    for (i = 0; i < ARRAY_SIZE(neg_cases); ++i) {
+        re = ere_parse(neg_cases[i], 0);
+        if (re == NULL) {
+            printf("%20s  ->  parse error\n", neg_cases[i]);
+            exit(1);
+        }
+        dfa = dfa_new(re, false);
+        printf("%20s  ->  %s\n", neg_cases[i], dfa == NULL ? "NULL" : "OK");
+        if (dfa != NULL) {
+            exit(1);
+        }
+        ere_free(re);
+    }
+
+    /* thousands of states, the cache has to be flushed */
+    {
+        static char big[20000 + 1];
+
+        re = ere_parse("a[ab]{11}c", 0);
+        dfa = dfa_new(re, false);
+        rdfa = dfa_new(re, true);
+        len = sizeof(big) - 1;
+        for (i = 0; i < len - 1; ++i) {
+            big[i] = "ab"[rand() % 2];
+        }
+        big[len - 13] = 'a';
+        big[len - 1] = 'c';
+
+        so = -1;
+        eo = dfa_search(dfa, rdfa, big, len, & so);
+        printf("%20s  ->  %d, %d\n", "a[ab]{11}c", so, eo);
+        if (so != len - 13 || eo != len) {
+            exit(1);
+        }
+
+        dfa_free(dfa);
+        dfa_free(rdfa);
+        ere_free(re);
+    }
+
+    /* random patterns against regexec() */
+    for (round = 0; round < 3000; ++round) {
+        pattern[0] = '\0';
+        gen_pattern(pattern, 0);
+        snprintf(anchored, sizeof(anchored), "^(%s)$", pattern);
+        if (regcomp( & regex, anchored, REG_EXTENDED | REG_NOSUB) != 0) {
+            printf("regcomp failed: %s\n", anchored);
+            exit(1);
+        }
+        re = ere_parse(pattern, 0);
+        if (re == NULL) {
+            printf("ere_parse failed: %s\n", pattern);
+            exit(1);
+        }
+        dfa = dfa_new(re, false);
+        rdfa = dfa_new(re, true);
+
+        len = rand() % 12;
+        for (i = 0; i < len; ++i) {
+            buf[i] = "ab\nc"[rand() % 4];
+        }
+
+        exp_so = so = -1;
+        exp_eo = naive_search( & regex, buf, len, & exp_so);
+        eo = dfa_search(dfa, rdfa, buf, len, & so);
+        if (eo != exp_eo || so != exp_so) {
+            printf("round %d: /%s/ on \"%.*s\"\n", round, pattern, len, buf);
+            printf("  got %d, %d, expected %d, %d\n", so, eo, exp_so, exp_eo);
+            exit(1);
+        }
+
+        regfree( & regex);
+        dfa_free(dfa);
+        dfa_free(rdfa);
+        ere_free(re);
+    }
+
+    printf("OK\n");
+    return 0;
+}
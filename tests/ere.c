@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "ere.h"
+
+int
+main()
+{
+    struct {
+        char * pattern;
+        int    flags;
+        int    maxlen;
+        bool   newline;     /* can match a NL */
+    } pos_cases[] = {
+        { "abc",            0,              3,          false },
+        { "a|bcd|",         0,              3,          false },
+        { "(ab)?c{2,5}",    0,              7,          false },
+        { "x{,3}",          0,              3,          false },
+        { "x{3,}",          0,              ERE_INF,    false },
+        { "a.c",            0,              3,          true  },
+        { "a.c",            ERE_NEWLINE,    3,          false },
+        { "[^a]",           0,              1,          true  },
+        { "[^a]",           ERE_NEWLINE,    1,          false },
+        { "^\\$ $",         0,              2,          false },
+        { "\\bfoo\\>",      0,              3,          false },
+        { "(a)\\1",         0,              ERE_INF,    false },
+        { "()*",            0,              0,          false },
+        { "\\s",            0,              1,          true  },
+        { "[]a-c[:digit:][.-.]]{2}", 0,     2,          false },
+        { "[[=x=]-]",       0,              1,          false },
+        { "a\\{",           0,              2,          false },
+    };
+    char * neg_cases[] = {
+        "(",
+        "a)",
+        "*a",
+        "a|+",
+        "a{",
+        "a{2,1}",
+        "a{1,x}",
+        "[a",
+        "[[:foo:]]",
+        "[[.space.]]",
+        "[z-a]",
+        "\\1",
+        "a\\",
+    };
+    struct {
+        char * pattern;
+        int    flags;
+        char * required;    /* NULL if none */
+    } lit_cases[] = {
+        { "\\$ $",                0,          "$ " },
+        { "password:",              0,          "password:" },
+        { "[0-9]+ packets received", 0,         " packets received" },
+        { "bash-[.0-9]+[$#] $",     0,          "bash-" },
+        { "foo|bar",                0,          NULL },
+        { "foobar|fooqux",          0,          "foo" },
+        { "x(abc){2}y",             0,          "xabcabcy" },
+        { "(ab)+c",                 0,          "abc" },
+        { "a*",                     0,          NULL },
+        { "a.c",                    0,          "a" },
+        { "(a)\\1x",              0,          "a" },
+        { "HeLLo",                  ERE_ICASE,  "hello" },
+        { "[Hh]ello",               0,          "ello" },
+    };
+    ere_t * re;
+    int i, maxlen;
+    bool newline;
+    char * req;
+
+    printf("pos_cases:\n");
+    for (i = 0; i < ARRAY_SIZE(pos_cases); ++i) {
+        re = ere_parse(pos_cases[i].pattern, pos_cases[i].flags);
+        if (re == NULL) {
+            printf("%30s  ->  NULL\n", pos_cases[i].pattern);
+            exit(1);
+        }
+        maxlen = ere_maxlen(re);
+        newline = ere_can_match(re, '\n');
+        printf("%30s  ->  maxlen=%d newline=%d\n", pos_cases[i].pattern,
+               maxlen, newline);
+        if (maxlen != pos_cases[i].maxlen || newline != pos_cases[i].newline) {
+            exit(1);
+        }
+        ere_free(re);
+    }
+
+    printf("lit_cases:\n");
+    for (i = 0; i < ARRAY_SIZE(lit_cases); ++i) {
+        re = ere_parse(lit_cases[i].pattern, lit_cases[i].flags);
+        if (re == NULL) {
+            printf("%30s  ->  NULL\n", lit_cases[i].pattern);
+            exit(1);
+        }
+        req = ere_required(re);
+        printf("%30s  ->  %s\n", lit_cases[i].pattern, req ? req : "(null)");
+        if ( (req == NULL) != (lit_cases[i].required == NULL)
+             || (req != NULL && ! streq(req, lit_cases[i].required) ) ) {
+            exit(1);
+        }
+        free(req);
+        ere_free(re);
+    }
+
+    printf("neg_cases:\n");
+    for (i = 0; i < ARRAY_SIZE(neg_cases); ++i) {
+        re = ere_parse(neg_cases[i], 0);
+        if (re != NULL) {
+            printf("%30s  ->  OK\n", neg_cases[i]);
+            exit(1);
+        }
+        printf("%30s  ->  NULL\n", neg_cases[i]);
+    }
+
+    return 0;
+}
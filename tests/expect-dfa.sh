@@ -0,0 +1,47 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect ex -engine dfa -re "$re_ps1"
+
+# output which comes in slowly
+assert_run sexpect s -cr 'for s in 1 2 3 4; do printf "<$s>"; sleep .3; done; echo'
+assert_run sexpect ex -t 5 -engine dfa -re '<2>.*<4>'
+assert '[[ $( sexpect out ) == "<2><3><4>" ]]'
+assert_run sexpect ex -engine dfa -re "$re_ps1"
+
+# the match which ends first, and no subexpressions
+assert_run sexpect s -cr 'printf "\161\161\161\n"'
+assert_run sexpect ex -t 5 -engine dfa -re '(q)+'
+assert '[[ $( sexpect out ) == q ]]'
+assert '[[ -z $( sexpect out -i 1 ) ]]'
+assert_run sexpect ex -engine dfa -re "$re_ps1"
+
+# -nocase, -anchor and -glob
+assert_run sexpect s -cr 'printf "x\n"; sleep .5; printf YY; sleep .5; echo'
+assert_run sexpect ex -t 5 -engine dfa -nocase -anchor -re '^yy$'
+assert_run sexpect ex -engine dfa -gl 'bash-*[$#] '
+
+# NUL bytes are ignored as with regexec()
+assert_run sexpect s -cr 'printf "x\0\0y\0z\n"'
+assert_run sexpect ex -t 5 -engine dfa -re 'xyz'
+assert_run sexpect ex -engine dfa -re "$re_ps1"
+
+# with other patterns
+assert_run sexpect s -cr 'echo f""oo'
+assert_run sexpect ex -t 5 -engine dfa -ex foo -re 'fo'
+assert '[[ $( sexpect out -b ) == 2 ]]'
+assert '[[ $( sexpect out ) == fo ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# not supported
+negass_run sexpect ex -t 1 -engine dfa -re '(a)\1'
+negass_run sexpect ex -t 1 -engine dfa -ex foo
+negass_run sexpect ex -t 1 -engine foo -re foo
+
+assert_run sexpect s -c 'exit 0\r'
+assert_run sexpect w
@@ -0,0 +1,45 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect ex -re "$re_ps1"
+
+# patterns split across output which comes in slowly
+assert_run sexpect s -cr 'for s in ab cd ef gh; do printf $s; sleep .3; done; echo'
+assert_run sexpect ex -t 5 bcdefg
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'for s in ab cd ef gh; do printf $s; sleep .3; done; echo'
+assert_run sexpect ex -t 5 -re 'b.*g'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'for s in ab cd ef gh; do printf $s; sleep .3; done; echo'
+assert_run sexpect ex -t 5 -nocase -re 'B[CD]{2}E'
+assert_run sexpect ex -re "$re_ps1"
+
+# the literal string the pattern requires comes in pieces
+assert_run sexpect s -cr 'for s in 12 " pack" "ets rec" eived; do printf "$s"; sleep .3; done; echo'
+assert_run sexpect ex -t 5 -re '[0-9]+ packets received'
+assert '[[ $( sexpect out ) == "12 packets received" ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'for s in 12 " pack" "ets rec" eived; do printf "$s"; sleep .3; done; echo'
+assert_run sexpect ex -t 5 -nocase -re '[0-9]+ PACKETS received'
+assert_run sexpect ex -re "$re_ps1"
+
+# `^' does not match where the last scan stopped
+assert_run sexpect s -cr 'printf xx; sleep .5; printf yy; sleep .5; echo'
+negass_run sexpect ex -t 2 -re '^yy'
+assert_run sexpect ex -re "$re_ps1"
+
+# ... but still matches at line starts with -anchor
+assert_run sexpect s -cr 'printf "x\n"; sleep .5; printf yy; sleep .5; echo'
+assert_run sexpect ex -t 5 -anchor -re '^yy'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -c 'exit 0\r'
+assert_run sexpect w
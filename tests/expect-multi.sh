@@ -0,0 +1,43 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect ex -re "$re_ps1"
+
+# the pattern which matches first wins
+assert_run sexpect s -cr 'sleep .3; echo pass""word:'
+assert_run sexpect ex -t 5 -ex 'error' -re "$re_ps1" -ex 'password:'
+assert '[[ $( sexpect expect_out -branch ) == 3 ]]'
+assert '[[ $( sexpect expect_out ) == password: ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# a set of exact strings, found in pieces
+assert_run sexpect s -cr 'for s in E""r r""or ": x"; do printf "$s"; sleep .3; done; echo'
+assert_run sexpect ex -t 5 -ex foo -ex 'or: x' -ex 'rror:' -ex bar
+assert '[[ $( sexpect out -b ) == 3 ]]'
+assert '[[ $( sexpect out ) == rror: ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# same end, the pattern given first wins
+assert_run sexpect s -cr 'printf "x\171z\n"'
+assert_run sexpect ex -t 5 -nocase -gl 'X?Z' -ex YZ -re 'Y+Z'
+assert '[[ $( sexpect out -b ) == 1 ]]'
+assert '[[ $( sexpect out ) == xyz ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# no match
+assert_run sexpect s -cr 'echo x""yz'
+negass_run sexpect ex -t 1 -ex foo -ex bar -re "x[0-9]"
+assert '[[ $( sexpect out -b ) == 0 ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# an invalid pattern fails the whole expect
+negass_run sexpect ex -t 1 -ex foo -re 'a(b'
+negass_run sexpect ex -eof -ex foo
+
+assert_run sexpect s -c 'exit 0\r'
+assert_run sexpect w
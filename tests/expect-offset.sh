@@ -0,0 +1,37 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+
+# no match yet
+assert '[[ $( sexpect expout -offset ) == -1 ]]'
+
+assert_run sexpect ex -re "$re_ps1"
+end=$( sexpect expout -offset )
+assert '(( end > 0 ))'
+
+# send reports where its output starts
+off=$( sexpect s -offset -cr 'printf "\101\n\102\n"' )
+assert '(( off == end ))'
+assert_run sexpect ex -re "$re_ps1"
+
+# all consumed, but -since goes back to the output after the send
+negass_run sexpect ex -t 1 -c -ex 'A\r\n'
+assert_run sexpect ex -since $off -t 1 -c -ex 'A\r\n'
+assert '(( $( sexpect expout -offset ) > off ))'
+assert_run sexpect ex -since $off -t 1 -c -ex 'B\r\n'
+
+# nothing has been dropped yet so 0 is still in memory
+assert_run sexpect ex -since 0 -t 1 -re "$re_ps1"
+assert_run sexpect ex -from 0 -t 1 -re "$re_ps1"
+
+# send -offset alone just reports the offset
+off=$( sexpect s -offset )
+assert '(( off > end ))'
+
+assert_run sexpect s -enter exit
+assert_run sexpect w
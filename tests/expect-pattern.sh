@@ -34,6 +34,26 @@ if (( 1 )); then
     assert_run sexpect ex -re "$re_ps1"
 fi
 
+# expect -glob matches the longest string from the leftmost start
+assert_run sexpect s -cr 'printf "x%sy%sz\n" FOO BAR'
+assert_run sexpect ex -gl 'x[A-Z]*z'
+assert '[[ $( sexpect expout ) == xFOOyBARz ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'printf "x%sy%sz\n" FOO BAR'
+assert_run sexpect ex -nocase -gl 'X[a-z]?o'
+assert '[[ $( sexpect expout ) == xFOO ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# the glob is matched across separate reads
+assert_run sexpect s -cr 'printf "x%s" FOO; sleep 1; printf "y%sz\n" BAR'
+assert_run sexpect ex -gl 'x[A-Z]*y*z'
+assert '[[ $( sexpect expout ) == xFOOyBARz ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+negass_run sexpect ex -t 5 -gl 'a[b'
+assert 'sexpect ex -t 5 -gl "a[b" 2>&1 | grep "invalid glob"'
+
 # NULs removed for pattern matching
 assert_run sexpect s -cr 'printf "foo\0\0\0\0bar\n" '
 assert_run sexpect ex foobar
@@ -44,5 +64,9 @@ assert_run sexpect s -cr 'printf "foo\0\0\0\0bar\n" '
 assert 'sexpect ex foobar | tr "\0" x | grep xxxx'
 assert_run sexpect ex -re "$re_ps1"
 
+# invalid regex reported up front
+negass_run sexpect ex -t 5 -re 'a(b'
+assert 'sexpect ex -t 5 -re "a(b" 2>&1 | grep "invalid regex"'
+
 assert_run sexpect s -c 'exit 0\r'
 assert_run sexpect w
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+# without PCRE2 -pcre just fails
+if sexpect ex -pcre x 2>&1 | grep -q 'without PCRE2'; then
+    info "built without PCRE2, skipped"
+    exit 0
+fi
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 bash --norc
+
+re_ps1='bash-[.\d]+[$#] $'
+assert_run sexpect ex -pcre "$re_ps1"
+
+# lookaheads and lazy quantifiers, on output which comes in slowly
+assert_run sexpect s -cr 'for s in 1 2 3 4; do printf "<$s>"; sleep .3; done; echo'
+assert_run sexpect ex -t 5 -pcre '<\d>.*?(?=<[34]>)'
+assert '[[ $( sexpect out ) == "<1><2>" ]]'
+assert_run sexpect ex -pcre "$re_ps1"
+
+# more than 9 groups, and named groups
+assert_run sexpect s -cr 'printf "\141bcdefghijk\n"'
+assert_run sexpect ex -t 5 -pcre '(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)(?<kay>k)'
+assert '[[ $( sexpect out -i 10 ) == j ]]'
+assert '[[ $( sexpect out -i 11 ) == k ]]'
+assert '[[ $( sexpect out -name kay ) == k ]]'
+negass_run sexpect out -name foo
+assert_run sexpect ex -pcre "$re_ps1"
+
+# -nocase and -anchor
+assert_run sexpect s -cr 'printf "x\nYY\n"'
+assert_run sexpect ex -t 5 -nocase -anchor -pcre '^yy\r$'
+assert_run sexpect ex -pcre "$re_ps1"
+
+# with other patterns
+assert_run sexpect s -cr 'echo x""1'
+assert_run sexpect ex -t 5 -ex foo -pcre 'x\d'
+assert '[[ $( sexpect out -b ) == 2 ]]'
+assert_run sexpect ex -pcre "$re_ps1"
+
+negass_run sexpect ex -t 1 -pcre 'a(b'
+
+assert_run sexpect s -c 'exit 0\r'
+assert_run sexpect w
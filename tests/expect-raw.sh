@@ -0,0 +1,63 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect ex -re "$re_ps1"
+
+# NUL bytes in -exact patterns
+assert_run sexpect s -cr 'printf "\101\0\0\102\n"'
+assert_run sexpect ex -raw -c -ex 'A\0\0B'
+assert '[[ $( sexpect expout | od -An -c | tr -d " " ) == "A\\0\\0B" ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# NUL bytes in a set of -exact patterns
+assert_run sexpect s -cr 'printf "\170\141\0\143\171\171\n"'
+negass_run sexpect ex -t 1 -raw -c -ex 'a\0b' -ex zzz
+assert '[[ $( sexpect out -b ) == 0 ]]'
+assert_run sexpect ex -raw -c -ex 'a\0b' -ex zzz -ex 'a\0c'
+assert '[[ $( sexpect out -b ) == 3 ]]'
+assert '[[ $( sexpect expout | od -An -c | tr -d " " ) == "a\\0c" ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# -re, -glob and -engine dfa on the raw data
+assert_run sexpect s -cr 'printf "\101\0\0\102\n"'
+assert_run sexpect ex -raw -re 'A[^x]{2}B'
+assert '[[ $( sexpect expout | wc -c ) == 4 ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'printf "\101\0\0\102\n"'
+assert_run sexpect ex -raw -gl 'A??B'
+assert '[[ $( sexpect expout | wc -c ) == 4 ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'printf "\101\0\0\102\n"'
+assert_run sexpect ex -raw -engine dfa -re 'A[^x]{2}B'
+assert '[[ $( sexpect expout | wc -c ) == 4 ]]'
+assert_run sexpect ex -re "$re_ps1"
+
+# -raw starts where the last expect stopped and the next one continues
+# after the -raw match
+assert_run sexpect s -cr 'printf "\101\0\102\0\103\0\104\n"'
+assert_run sexpect ex A
+assert_run sexpect ex -raw -c -ex '\0B\0'
+assert_run sexpect ex CD
+assert_run sexpect ex -re "$re_ps1"
+
+# lots of NUL runs, with and without -raw
+assert_run sexpect s -cr 'for ((i = 1; i <= 3000; ++i)); do printf "\170%d\0" $i; done; echo'
+assert_run sexpect ex x1000x
+assert_run sexpect ex -raw -c -ex 'x2000\0'
+assert_run sexpect ex x2999x3000
+assert_run sexpect ex -re "$re_ps1"
+
+# NUL bytes are only allowed in -raw -exact patterns
+negass_run sexpect ex -c -ex 'A\0B'
+negass_run sexpect ex -raw -c -re 'A\0B'
+negass_run sexpect ex -raw
+
+assert_run sexpect s -enter exit
+assert_run sexpect w
@@ -0,0 +1,172 @@
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "globmatch.h"
+
+/* what expect -glob used to do: glob2re() and regexec() */
+static bool
+re_match(const char * glob, bool icase, const char * buf, int len,
+         int * so, int * eo)
+{
+    char * re_str, str[64];
+    regex_t re;
+    regmatch_t m[1];
+    int ret;
+
+    if (glob2re(glob, & re_str, NULL) == NULL) {
+        printf("glob2re failed: %s\n", glob);
+        exit(1);
+    }
+    if (regcomp( & re, re_str, REG_EXTENDED | (icase ? REG_ICASE : 0) ) != 0) {
+        printf("regcomp failed: %s\n", re_str);
+        exit(1);
+    }
+    memcpy(str, buf, len);
+    str[len] = '\0';
+    ret = regexec( & re, str, 1, m, 0);
+    regfree( & re);
+    free(re_str);
+
+    if (ret != 0) {
+        return false;
+    }
+    * so = m[0].rm_so;
+    * eo = m[0].rm_eo;
+    return true;
+}
+
+/* feed the data in random pieces, each one checked against re_match() */
+static bool
+check(const char * glob, bool icase, const char * buf, int len)
+{
+    globmatch_t * gm;
+    gm_state_t st;
+    int off, so, eo, exp_so, exp_eo;
+    bool found, exp_found;
+
+    gm = gm_compile(glob, icase);
+    if (gm == NULL) {
+        printf("gm_compile failed: %s\n", glob);
+        return false;
+    }
+    gm_reset( & st);
+
+    off = 0;
+    do {
+        off += rand() % (len - off + 1);
+
+        so = eo = exp_so = exp_eo = -1;
+        found = gm_match(gm, & st, buf, off, & so, & eo);
+        exp_found = re_match(glob, icase, buf, off, & exp_so, & exp_eo);
+        if (found != exp_found || so != exp_so || eo != exp_eo) {
+            printf("`%s'%s on \"%.*s\"\n", glob, icase ? " (nocase)" : "",
+                   off, buf);
+            printf("  got %d, %d, expected %d, %d\n", so, eo, exp_so, exp_eo);
+            gm_free(gm);
+            return false;
+        }
+    } while ( ! found && off < len);
+
+    gm_free(gm);
+    return true;
+}
+
+int
+main()
+{
+    struct {
+        char * glob;
+        bool   icase;
+        char * text;
+    } cases[] = {
+        { "foo",            false,  "xxfoobar" },
+        { "*",              false,  "abc" },
+        { "a*",             false,  "xaaa" },
+        { "*b",             false,  "abab" },
+        { "a*b",            false,  "xaxbxbx" },
+        { "a*b*c",          false,  "cabcbcac" },
+        { "[$#] ",          false,  "bash-5.1$ " },
+        { "^ab",            false,  "xab" },
+        { "^ab",            false,  "abab" },
+        { "ab$",            false,  "abab" },
+        { "^*$",            false,  "abc" },
+        { "^$",             false,  "" },
+        { "a^b$c",          false,  "xa^b$c" },
+        { "a?c",            false,  "a\nc" },
+        { "[!a]b",          false,  "abbb" },
+        { "[]]x",           false,  "a]x" },
+        { "[a-c]*[x-z]",    false,  "0b1y2z3" },
+        { "\\*\\?\\[\\]\\\\", false, "*?[]\\" },
+        { "pass*:",         true,   "PASSWORD: " },
+        { "[A-C]x",         true,   "bX" },
+        { "[!A]",           true,   "ab" },
+        { ".+|<>(){}",      false,  "-.+|<>(){}-" },
+    };
+    char * neg_cases[] = {
+        "[",
+        "[]",
+        "[!",
+        "[a",
+        "[[:alpha:]]",
+        "\\",
+        "\\a",
+        "[z-a]",
+    };
+    static char * atoms[] = {
+        "a", "b", "ab", "?", "*", "**", "[ab]", "[!a]", "\\*", "\n",
+    };
+    char glob[64], buf[32];
+    globmatch_t * gm;
+    int round, i, n, len;
+
+    srand(1);
+
+    printf("cases:\n");
+    for (i = 0; i < ARRAY_SIZE(cases); ++i) {
+        printf("%20s\n", cases[i].glob);
+        if ( ! check(cases[i].glob, cases[i].icase, cases[i].text,
+                     strlen(cases[i].text) ) ) {
+            exit(1);
+        }
+    }
+
+    printf("neg_cases:\n");
+    for (i = 0; i < ARRAY_SIZE(neg_cases); ++i) {
+        gm = gm_compile(neg_cases[i], false);
+        printf("%20s  ->  %s\n", neg_cases[i], gm == NULL ? "NULL" : "OK");
+        if (gm != NULL) {
+            exit(1);
+        }
+    }
+
+    /* random globs against glob2re() and regexec() */
+    for (round = 0; round < 20000; ++round) {
+        glob[0] = '\0';
+        if (rand() % 4 == 0) {
+            strcat(glob, "^");
+        }
+        n = 1 + rand() % 4;
+        for (i = 0; i < n; ++i) {
+            strcat(glob, atoms[rand() % ARRAY_SIZE(atoms)]);
+        }
+        if (rand() % 4 == 0) {
+            strcat(glob, "$");
+        }
+
+        len = rand() % 16;
+        for (i = 0; i < len; ++i) {
+            buf[i] = "aAb*\n"[rand() % 5];
+        }
+
+        if ( ! check(glob, rand() % 4 == 0, buf, len) ) {
+            printf("round %d\n", round);
+            exit(1);
+        }
+    }
+
+    printf("OK\n");
+    return 0;
+}
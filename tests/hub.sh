@@ -0,0 +1,45 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+# the hub exits after idle for 3 seconds without sessions
+assert_run sexpect hub -workers 2 -idle 3
+
+export PS1='\s-\v\$ '
+assert_run sexpect -session one sp -t 10 -ttl 30 bash --norc
+assert_run sexpect -session two sp -t 10 -ttl 30 bash --norc
+negass_run sexpect -session one sp bash --norc
+negass_run sexpect -session three get -pid
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect -session one ex -re "$re_ps1"
+export SEXPECT_SESSION=two
+assert_run sexpect ex -re "$re_ps1"
+
+# each session has its own child
+pid1=$( sexpect -session one get -pid )
+pid2=$( sexpect -session two get -pid )
+assert '[[ $pid1 -gt 0 && $pid2 -gt 0 && $pid1 != $pid2 ]]'
+
+# the child gets the client's cwd and environment, without SEXPECT_*
+assert_run sexpect -session one s -cr 'echo "[$PWD]"'
+assert_run sexpect -session one ex -ex "[$PWD]"
+assert_run sexpect -session two s -cr 'echo "[${SEXPECT_SESSION-unset}]"'
+assert_run sexpect -session two ex -ex '[unset]'
+
+assert_run sexpect -session one s -cr 'exit 3'
+assert_run sexpect -session two s -cr 'exit 4'
+sexpect -session one w; ret1=$?
+sexpect -session two w; ret2=$?
+assert '(( ret1 == 3 && ret2 == 4 ))'
+
+# both sessions are over, the name can be used again
+assert_run sexpect -session one sp -t 10 -ttl 30 bash --norc
+assert_run sexpect -session one ex -re "$re_ps1"
+assert_run sexpect -session one s -cr 'exit 5'
+sexpect -session one w; ret1=$?
+assert '(( ret1 == 5 ))'
+
+# and the hub has gone
+run sleep 5
+negass_run sexpect -session one get -pid
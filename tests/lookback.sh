@@ -0,0 +1,36 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'for i in 1 2 3 4 5; do echo L$i; done'
+assert_run sexpect ex -c -re "L5\r\n.*$re_ps1"
+
+# lines: L4, L5 and the prompt
+out=$( sexpect ex -lb 3 -t 1 -re zzz | tr -d '\r' )
+assert '[[ $out == L4$'\''\n'\''L5$'\''\n'\''*bash-* ]]'
+
+# bytes
+out=$( sexpect ex -lb 6b -t 1 -re zzz | tr -d '\r' )
+assert '[[ ${#out} == 6 && $out == *" " ]]'
+
+# seconds
+run sleep 2
+assert_run sexpect s -cr 'printf "N\145W\n"'
+assert_run sexpect ex -c -re "NeW\r\n.*$re_ps1"
+out=$( sexpect ex -lb 1s -t 1 -re zzz | tr -d '\r' )
+assert '[[ $out == *NeW* && $out != *L5* ]]'
+
+out=$( sexpect ex -lb 100s -t 1 -re zzz | tr -d '\r' )
+assert '[[ $out == *L5*NeW* ]]'
+
+negass_run sexpect ex -lb 1x -t 1
+negass_run sexpect ex -lb -1 -t 1
+
+assert_run sexpect s -enter exit
+assert_run sexpect w
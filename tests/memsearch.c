@@ -0,0 +1,165 @@
+/*
+ * memsearch [-bench]
+ *
+ * Without -bench, check all the supported search kernels against a naive
+ * search. With -bench, compare them with strstr()/strcasestr() (what
+ * expect -exact used before) on multi-KB buffers. Configure with
+ * -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "common.h"
+#include "memsearch.h"
+
+static char * level_names[] = { "scalar", "sse2", "avx2" };
+
+static int
+naive_find(const char * needle, int len, const char * hay, int haylen,
+           bool icase)
+{
+    int i;
+
+    for (i = 0; i + len <= haylen; ++i) {
+        if (icase ? strncasecmp(hay + i, needle, len) == 0
+                  : memcmp(hay + i, needle, len) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int
+check(void)
+{
+    char hay[300], needle[40];
+    int round, level, i, len, haylen, found, expected;
+    bool icase;
+    memsearch_t ms;
+
+    srand(1);
+
+    for (round = 0; round < 50000; ++round) {
+        icase = round % 2;
+        len = 1 + rand() % (round % 3 == 0 ? 3 : sizeof(needle) - 1);
+        haylen = rand() % sizeof(hay);
+        for (i = 0; i < len; ++i) {
+            needle[i] = "aAbB@`"[rand() % 6];
+        }
+        for (i = 0; i < haylen; ++i) {
+            hay[i] = "aAbB@`"[rand() % 6];
+        }
+        /* make a match more likely */
+        if (rand() % 2 && haylen >= len) {
+            memcpy(hay + rand() % (haylen - len + 1), needle, len);
+        }
+        expected = naive_find(needle, len, hay, haylen, icase);
+
+        ms_init( & ms, needle, len, icase);
+        for (level = MS_SCALAR; level <= ms_best_level(); ++level) {
+            ms.level = level;
+            found = ms_find( & ms, hay, haylen);
+            if (found != expected) {
+                printf("%s (icase=%d): needle=%.*s hay=%.*s: got %d, expected %d\n",
+                       level_names[level], icase, len, needle, haylen, hay,
+                       found, expected);
+                return 1;
+            }
+        }
+        ms_free( & ms);
+    }
+
+    printf("OK (%s)\n", level_names[ms_best_level()]);
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Look for a prompt at the end of some shell-like output, like expect
+ * does after every read.
+ */
+static void
+bench(const char * needle, int haylen)
+{
+    const char * text = "drwxr-xr-x  2 root root  4096 Jan  1 00:00 bin\n";
+    int len = strlen(needle), textlen = strlen(text);
+    int i, level, iters, found = 0;
+    double t, mbps;
+    char * hay;
+    char * volatile vhay;   /* or the compiler may call strstr() only once */
+    bool icase;
+    memsearch_t ms;
+
+    hay = malloc(haylen + 1);
+    for (i = 0; i < haylen - len; ++i) {
+        hay[i] = text[i % textlen];
+    }
+    memcpy(hay + haylen - len, needle, len + 1);
+    vhay = hay;
+
+    iters = (256 << 20) / haylen;
+    for (icase = false; ; icase = true) {
+        printf("`%s', %d bytes%s:\n", needle, haylen, icase ? ", -nocase" : "");
+
+        t = now();
+        for (i = 0; i < iters; ++i) {
+            char * p = icase ? strcasestr(vhay, needle) : strstr(vhay, needle);
+            found += p - hay;
+        }
+        t = now() - t;
+        mbps = (double) haylen * iters / t / (1 << 20);
+        printf("    %-12s %8.0f MB/s\n", icase ? "strcasestr" : "strstr", mbps);
+
+        ms_init( & ms, needle, len, icase);
+        for (level = MS_SCALAR; level <= ms_best_level(); ++level) {
+            ms.level = level;
+            t = now();
+            for (i = 0; i < iters; ++i) {
+                found += ms_find( & ms, hay, haylen);
+            }
+            t = now() - t;
+            mbps = (double) haylen * iters / t / (1 << 20);
+            printf("    %-12s %8.0f MB/s\n", level_names[level], mbps);
+        }
+        ms_free( & ms);
+
+        if (icase) {
+            break;
+        }
+    }
+
+    if (found == 0) {
+        printf("impossible\n");
+    }
+    free(hay);
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc > 1 && streq(argv[1], "-bench") ) {
+        /* the first byte is rare in the data, or not */
+        bench("[root@localhost ~]# ", 4 * 1024);
+        bench("[root@localhost ~]# ", 64 * 1024);
+        bench("root@localhost:~$ ", 4 * 1024);
+        bench("root@localhost:~$ ", 64 * 1024);
+        return 0;
+    }
+
+    return check();
+}
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 30 bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect ex -re "$re_ps1"
+
+# two expects waiting at the same time, each with its own cursor
+sexpect ex -t 10 -ex ALPHA & pid1=$!
+sexpect ex -t 10 -ex BETA  & pid2=$!
+sleep 1
+
+# other clients are not blocked by them
+assert '[[ $( sexpect get -pid ) -gt 0 ]]'
+assert_run sexpect s -cr 'printf "\101LPHA\n"; sleep 1; printf "\102ETA\n"'
+assert_run wait $pid1
+assert_run wait $pid2
+
+# the next expect starts after the furthest match
+negass_run sexpect ex -t 1 -ex ALPHA
+assert_run sexpect ex -re "$re_ps1"
+
+# more than one client can wait for the exit status
+assert_run sexpect s -cr 'exit 3'
+sexpect w & pid1=$!
+sexpect w & pid2=$!
+wait $pid1; ret1=$?
+wait $pid2; ret2=$?
+assert '(( ret1 == 3 && ret2 == 3 ))'
@@ -0,0 +1,161 @@
+/*
+ * nulstrip [-bench]
+ *
+ * Without -bench, check ns_strip() and all the supported kernels against a
+ * plain loop, also in place. With -bench, compare them with that loop
+ * (what the server used before) at several NUL densities. Configure with
+ * -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "memsearch.h"
+#include "nulstrip.h"
+
+static char * level_names[] = { "scalar", "sse2", "avx2" };
+
+static int
+plain_strip(char * dst, const char * src, int len)
+{
+    int i, n = 0;
+
+    for (i = 0; i < len; ++i) {
+        if (src[i] != '\0') {
+            dst[n++] = src[i];
+        }
+    }
+
+    return n;
+}
+
+/*
+ * NULs come in runs, like from a terminal app padding its output.
+ */
+static void
+fill(char * buf, int len, int permille)
+{
+    int i, run;
+
+    for (i = 0; i < len; ++i) {
+        buf[i] = 'a' + i % 26;
+    }
+    if (permille == 0) {
+        return;
+    }
+    for (i = 0; i < len; ++i) {
+        if (rand() % 1000 < permille) {
+            for (run = 1 + rand() % 4; run > 0 && i < len; --run, ++i) {
+                buf[i] = '\0';
+            }
+        }
+    }
+}
+
+static int
+check(void)
+{
+    static const int densities[] = { 0, 1, 10, 100, 500, 900, 1000 };
+    char src[300], expected[300], dst[300];
+    int round, level, len, n, expn;
+
+    srand(1);
+
+    for (round = 0; round < 50000; ++round) {
+        len = rand() % sizeof(src);
+        fill(src, len, densities[round % ARRAY_SIZE(densities)]);
+        expn = plain_strip(expected, src, len);
+
+        for (level = MS_SCALAR - 1; level <= ms_best_level(); ++level) {
+            /* MS_SCALAR - 1: ns_strip() */
+            memcpy(dst, src, len);
+            if (round % 2) {
+                n = level < MS_SCALAR ? ns_strip(dst, dst, len)
+                                      : ns_strip_level(dst, dst, len, level);
+            } else {
+                n = level < MS_SCALAR ? ns_strip(dst, src, len)
+                                      : ns_strip_level(dst, src, len, level);
+            }
+            if (n != expn || memcmp(dst, expected, n) != 0) {
+                printf("%s (len=%d, in place=%d): got %d bytes, expected %d\n",
+                       level < MS_SCALAR ? "ns_strip" : level_names[level],
+                       len, round % 2, n, expn);
+                return 1;
+            }
+        }
+    }
+
+    printf("OK (%s)\n", level_names[ms_best_level()]);
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench(int permille, int len)
+{
+    int i, level, iters, n = 0;
+    double t, mbps;
+    char * src, * dst;
+
+    src = malloc(len);
+    dst = malloc(len);
+    fill(src, len, permille);
+
+    iters = (256 << 20) / len;
+    printf("%d bytes, %.1f%% NULs:\n", len, permille / 10.0);
+
+    t = now();
+    for (i = 0; i < iters; ++i) {
+        n += plain_strip(dst, src, len);
+    }
+    t = now() - t;
+    mbps = (double) len * iters / t / (1 << 20);
+    printf("    %-12s %8.0f MB/s\n", "loop", mbps);
+
+    for (level = MS_SCALAR - 1; level <= ms_best_level(); ++level) {
+        t = now();
+        for (i = 0; i < iters; ++i) {
+            n += level < MS_SCALAR ? ns_strip(dst, src, len)
+                                   : ns_strip_level(dst, src, len, level);
+        }
+        t = now() - t;
+        mbps = (double) len * iters / t / (1 << 20);
+        printf("    %-12s %8.0f MB/s\n",
+               level < MS_SCALAR ? "ns_strip" : level_names[level], mbps);
+    }
+
+    if (n == 0) {
+        printf("impossible\n");
+    }
+    free(src);
+    free(dst);
+}
+
+int
+main(int argc, char ** argv)
+{
+    static const int densities[] = { 0, 1, 10, 100, 500 };
+    int i;
+
+    if (argc > 1 && streq(argv[1], "-bench") ) {
+        srand(1);
+        for (i = 0; i < ARRAY_SIZE(densities); ++i) {
+            bench(densities[i], 4 * 1024);
+            bench(densities[i], 64 * 1024);
+        }
+        return 0;
+    }
+
+    return check();
+}
@@ -0,0 +1,231 @@
+/*
+ * proto [-bench]
+ *
+ * Without -bench, check that ttlv_decode() and ttlv_decode_arena() (with and
+ * without TTLV_DECODE_NOCOPY) give back what's encoded and reject broken
+ * messages. With -bench, compare their decode throughput for the kinds of
+ * messages the client and the server pass most: a keystroke (TAG_INPUT),
+ * a chunk of output (TAG_OUTPUT) and an expect request (TAG_PASS).
+ * Configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "proto.h"
+
+enum {
+    DECODE_MALLOC,
+    DECODE_ARENA,
+    DECODE_NOCOPY,
+    DECODE_END__,
+};
+
+static char * mode_names[] = { "malloc", "arena", "arena nocopy" };
+
+static ttlv_t *
+new_pass(int nbranches)
+{
+    ttlv_t * msg, * branch;
+    char pattern[64];
+    int i;
+
+    msg = ttlv_new_struct(TAG_PASS);
+    ttlv_append_child(msg,
+        ttlv_new_int(TAG_PASS_SUBCMD, PASS_SUBCMD_EXPECT),
+        ttlv_new_int(TAG_EXP_FLAGS, PASS_EXPECT_ERE),
+        ttlv_new_int(TAG_EXP_TIMEOUT, 10),
+        ttlv_new_long(TAG_EXP_SINCE, 1234567890123LL),
+        ttlv_new_bool(TAG_NONBLOCK, true),
+        NULL);
+    for (i = 0; i < nbranches; ++i) {
+        snprintf(pattern, sizeof(pattern), "%.*s", i + 1,
+                 "[$#] $|password:|continue \\(yes/no\\)\\?");
+        branch = ttlv_new_struct(TAG_BRANCH);
+        ttlv_append_child(branch,
+            ttlv_new_int(TAG_EXP_FLAGS, PASS_EXPECT_ERE),
+            ttlv_new_text(TAG_PATTERN, strlen(pattern), pattern),
+            NULL);
+        ttlv_append_child(msg, branch, NULL);
+    }
+
+    return msg;
+}
+
+static ttlv_t *
+new_raw(int tag, int len)
+{
+    ttlv_t * msg;
+    char * data;
+    int i;
+
+    data = malloc(len + 1);
+    for (i = 0; i < len; ++i) {
+        data[i] = 'a' + i % 26;
+    }
+    msg = ttlv_new_raw(tag, len, data);
+    free(data);
+
+    return msg;
+}
+
+static int
+encode(ttlv_t * msg, uint8_t * buf, int size)
+{
+    int len;
+
+    len = ttlv_encode(msg, buf, size);
+    if (len != ttlv_calc_size(msg) ) {
+        printf("encoded %d bytes but the size is %d\n", len,
+               ttlv_calc_size(msg) );
+        exit(1);
+    }
+
+    return len;
+}
+
+static int
+decode(int mode, uint8_t * buf, int len, ttlv_t ** msg)
+{
+    if (mode == DECODE_MALLOC) {
+        return ttlv_decode(buf, len, msg);
+    } else {
+        return ttlv_decode_arena(buf, len, msg, ttlv_arena_new(len),
+                                 mode == DECODE_NOCOPY ? TTLV_DECODE_NOCOPY : 0);
+    }
+}
+
+static bool
+same(ttlv_t * a, ttlv_t * b)
+{
+    for ( ; a != NULL && b != NULL; a = a->next, b = b->next) {
+        if (a->tag != b->tag || a->type != b->type) {
+            return false;
+        }
+        switch (a->type) {
+        case TTYPE_STRUCT:
+            if ( ! same(a->child, b->child) ) {
+                return false;
+            }
+            break;
+        case TTYPE_LONG:
+            if (a->v_long != b->v_long) {
+                return false;
+            }
+            break;
+        case TTYPE_TEXT:
+        case TTYPE_RAW:
+            if (a->length != b->length
+                || memcmp(a->v_raw, b->v_raw, a->length) != 0
+                || b->v_raw[b->length] != 0) {
+                return false;
+            }
+            break;
+        default:
+            if (a->v_int != b->v_int) {
+                return false;
+            }
+        }
+    }
+
+    return a == NULL && b == NULL;
+}
+
+static int
+check(void)
+{
+    static uint8_t buf[PASS_MAX_MSG], copy[PASS_MAX_MSG];
+    ttlv_t * msg, * out;
+    int round, mode, len, cut, ret;
+
+    for (round = 0; round < 300; ++round) {
+        if (round % 3 == 0) {
+            msg = new_pass(round % MAX_BRANCH);
+        } else {
+            msg = new_raw(round % 2 ? TAG_OUTPUT : TAG_INPUT, round * 7 % 200);
+        }
+        len = encode(msg, buf, sizeof(buf) );
+
+        for (mode = 0; mode < DECODE_END__; ++mode) {
+            memcpy(copy, buf, len);
+            ret = decode(mode, copy, len, & out);
+            if (ret != len || ! same(msg, out) ) {
+                printf("%s: decoding message #%d (%d bytes) failed\n",
+                       mode_names[mode], round, len);
+                return 1;
+            }
+            ttlv_free( & out);
+
+            /* broken messages */
+            for (cut = 1; cut < len; cut += 1 + len / 10) {
+                memcpy(copy, buf, len);
+                ret = decode(mode, copy, len - cut, & out);
+                if (ret >= 0 || out != NULL) {
+                    printf("%s: message #%d cut to %d bytes decoded\n",
+                           mode_names[mode], round, len - cut);
+                    return 1;
+                }
+            }
+        }
+        ttlv_free( & msg);
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench(char * name, ttlv_t * msg)
+{
+    static uint8_t buf[PASS_MAX_MSG];
+    ttlv_t * out;
+    int i, mode, len, iters, n = 0;
+    double t;
+
+    len = encode(msg, buf, sizeof(buf) );
+    iters = MAX( (512 << 20) / len, 1000);
+    iters = MIN(iters, 4000000);
+    printf("%s, %d bytes:\n", name, len);
+
+    for (mode = 0; mode < DECODE_END__; ++mode) {
+        t = now();
+        for (i = 0; i < iters; ++i) {
+            n += decode(mode, buf, len, & out);
+            ttlv_free( & out);
+        }
+        t = now() - t;
+        printf("    %-14s %10.0f msgs/s %8.0f MB/s\n", mode_names[mode],
+               iters / t, (double) len * iters / t / (1 << 20) );
+    }
+
+    if (n == 0) {
+        printf("impossible\n");
+    }
+    ttlv_free( & msg);
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc > 1 && streq(argv[1], "-bench") ) {
+        bench("TAG_INPUT (a keystroke)", new_raw(TAG_INPUT, 1) );
+        bench("TAG_OUTPUT", new_raw(TAG_OUTPUT, 4 * 1024 - 1) );
+        bench("TAG_OUTPUT", new_raw(TAG_OUTPUT, 60 * 1024 - 1) );
+        bench("TAG_PASS (expect with 4 patterns)", new_pass(4) );
+        return 0;
+    }
+
+    return check();
+}
@@ -0,0 +1,70 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+export PS1='\s-\v\$ '
+re_ps1='bash-[.0-9]+[$#] $'
+
+#
+# -scrollback SIZE
+#
+negass_run sexpect sp -scrollback 99999999999999999999 -t 10 -ttl 20 bash --norc
+negass_run sexpect sp -scrollback 9999999999G -t 10 -ttl 20 bash --norc
+
+assert_run sexpect sp -scrollback 64k -t 10 -ttl 20 bash --norc
+assert_run sexpect ex -re "$re_ps1"
+
+# way more than -history (8K) but less than the scrollback
+assert_run sexpect s -cr 'seq 1 5000'
+assert_run sexpect ex -c -re "\n5000\r\n.*$re_ps1"
+
+# -lookback reaches into the scrollback
+out=$( sexpect ex -lb 4002 -t 1 -re zzz | tr -d '\r' | head -1 )
+assert '[[ $out == 1000 ]]'
+out=$( sexpect ex -lb 20000b -t 1 -re zzz | wc -c )
+assert '(( out == 20000 ))'
+
+# get -range from the start and from the end
+out=$( sexpect get -range 0 100 | tr -d '\r' )
+assert '[[ $out == *"seq 1 5000"*$'\''\n'\''2$'\''\n'\''3$'\''\n'\''* ]]'
+out=$( sexpect get -range -20 8 | wc -c )
+assert '(( out == 8 ))'
+
+# expect -from only works for what's still in memory
+negass_run sexpect ex -from 0 -t 1 seq
+out=$( sexpect get -range 0 100 | wc -c )
+assert '(( out == 100 ))'
+
+# the ring drops the oldest data
+assert_run sexpect s -cr 'seq 1 20000'
+assert_run sexpect ex -c -re "\n20000\r\n.*$re_ps1"
+out=$( sexpect get -range 0 100 | wc -c )
+assert '(( out == 0 ))'
+out=$( sexpect ex -lb 100000b -t 1 -re zzz | wc -c )
+assert '(( out > 64 * 1024 && out <= 64 * 1024 + 8 * 1024 ))'
+
+assert_run sexpect s -enter exit
+assert_run sexpect w
+
+#
+# -scrollback FILE keeps everything
+#
+file=$BINDIR/tests/scrollback.out
+rm -f $file
+assert_run sexpect sp -scrollback $file -t 10 -ttl 20 bash --norc
+assert_run sexpect ex -re "$re_ps1"
+assert_run sexpect s -cr 'seq 1 30000'
+assert_run sexpect ex -c -re "\n30000\r\n.*$re_ps1"
+assert '[[ $( tr -d "\r" < $file | grep -c "^[0-9]*$" ) -gt 20000 ]]'
+out=$( sexpect ex -lb 29999 -t 1 -re zzz | tr -d '\r' | head -1 )
+assert '[[ $out == 3 ]]'
+
+# expect -from the oldest data in memory (right after what's in the file)
+assert_run sexpect s -cr 'printf "\101\102\103\n"'
+assert_run sexpect ex -re "$re_ps1"
+negass_run sexpect ex -t 1 ABC
+assert_run sexpect ex -from $( wc -c < $file ) -t 1 ABC
+
+assert_run sexpect s -enter exit
+assert_run sexpect w
+rm -f $file
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+data=$BINDIR/tests/TEST_$TNAME.data
+printf '%01024d' 0 > $data
+
+# much more input than the pty can hold while the child is not reading
+assert_run sexpect sp -t 10 -ttl 30 \
+    sh -c 'stty raw -echo; echo RE""ADY; sleep 2; head -c 204800 | wc -c; sleep 5'
+assert_run sexpect ex READY
+for ((i = 0; i < 200; ++i)); do
+    sexpect s -f $data || fatal "send #$i failed"
+done
+assert_run sexpect ex 204800
+assert_run sexpect kill -KILL
+negass_run sexpect w
+
+# -sendq: `send' does not wait for the child
+assert_run sexpect sp -t 10 -ttl 30 -sendq 1m \
+    sh -c 'stty raw -echo; echo RE""ADY; sleep 5; head -c 204800 | wc -c; sleep 5'
+assert_run sexpect ex READY
+SECONDS=0
+for ((i = 0; i < 200; ++i)); do
+    sexpect s -f $data || fatal "send #$i failed"
+done
+assert '(( SECONDS < 4 ))'
+assert_run sexpect ex 204800
+assert_run sexpect kill -KILL
+negass_run sexpect w
+
+rm -f $data
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+data=$BINDIR/tests/TEST_$TNAME.data
+head -c 1048576 /dev/zero | tr '\0' 0 > $data
+
+# one `send' for a large file
+assert_run sexpect sp -t 10 -ttl 30 \
+    sh -c 'stty raw -echo; echo RE""ADY; echo "[$(head -c 1048576 | wc -c)]"; sleep 5'
+assert_run sexpect ex READY
+assert_run sexpect s -f $data
+assert_run sexpect ex -re '\[ *1048576\]'
+assert_run sexpect kill -KILL
+negass_run sexpect w
+
+# stdin, and -fd with -limit
+assert_run sexpect sp -t 10 -ttl 30 \
+    sh -c 'stty raw -echo; echo RE""ADY; echo "[$(head -c 300000 | wc -c)]"; \
+           echo "[$(head -c 1000 | wc -c)]"; sleep 5'
+assert_run sexpect ex READY
+head -c 300000 $data | run sexpect s -f - || fatal
+assert_run sexpect ex -re '\[ *300000\]'
+run sexpect s -fd 4 -limit 1000 4< $data || fatal
+assert_run sexpect ex -re '\[ *1000\]'
+assert_run sexpect kill -KILL
+negass_run sexpect w
+
+# -strip -cr
+printf 'abc  \n \n\n' > $data
+assert_run sexpect sp -t 10 -ttl 30 \
+    sh -c 'stty raw -echo; echo RE""ADY; head -c 4 | tr "\r" R; echo; \
+           head -c 4; echo; sleep 5'
+assert_run sexpect ex READY
+assert_run sexpect s -f $data -strip -cr
+assert_run sexpect s XYZW
+assert_run sexpect ex -c -ex 'abcR\nXYZW'
+assert_run sexpect kill -KILL
+negass_run sexpect w
+
+rm -f $data
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+source $SRCDIR/tests/common.sh || exit 1
+
+negass_run sexpect sp -bufsize 8k -history 8k true
+negass_run sexpect sp -bufsize 1g true
+negass_run sexpect sp -history 100 true
+negass_run sexpect sp -bufsize 10x true
+
+export PS1='\s-\v\$ '
+assert_run sexpect sp -t 10 -ttl 20 -bufsize 1m -history 256k bash --norc
+
+re_ps1='bash-[.0-9]+[$#] $'
+assert_run sexpect ex -re "$re_ps1"
+
+assert "[[ $( sexpect get -bufsize ) == 1048576 ]]"
+assert "[[ $( sexpect get -history ) == 262144 ]]"
+
+# a match spanning much more than the default buffer size
+assert_run sexpect s -cr 'printf "BEGIN%0100000dEND\n" 0'
+assert 'sexpect ex -re "BEGIN0+END" > /dev/null'
+assert "[[ $( sexpect expect_out | wc -c ) == 100008 ]]"
+assert_run sexpect ex -re "$re_ps1"
+
+# lots of output much faster than the client reads it
+assert_run sexpect s -cr 'seq 200000; echo DO""NE'
+assert 'sexpect ex DONE > /dev/null'
+assert_run sexpect ex -re "$re_ps1"
+
+negass_run sexpect set -history 2m
+assert_run sexpect set -bufsize 64k -history 16k
+assert "[[ $( sexpect get -bufsize ) == 65536 ]]"
+assert "[[ $( sexpect get -history ) == 16384 ]]"
+
+assert_run sexpect s -cr 'printf "BEGIN%010000dEND\n" 0'
+assert 'sexpect ex -re "BEGIN0+END" > /dev/null'
+assert_run sexpect ex -re "$re_ps1"
+
+assert_run sexpect s -cr 'exit 0'
+assert_run sexpect w